@@ -100,9 +100,11 @@ def _generate_one(f, cfg):
 
 
 # Run pca under nsys
-def _run_pca(name, nsys_output, num_gpus, launcher, np_flag, lets):
+def _run_pca(name, nsys_output, num_gpus, launcher, np_flag, lets, native=False, out_of_bounds="truncate"):
     bind_flag = ["--bind-to", "none"] if Path(launcher).name in ("mpirun", "mpiexec") else []
     lets_flag = ["--lets"] if lets else []
+    # native: pca generates its own slice of the group, no particles.h5 needed
+    source = ["--generate", "--out-of-bounds", out_of_bounds, name] if native else [str(PARTICLES_H5), name]
     cmd = [
         launcher, np_flag, str(num_gpus), *bind_flag,
         str(NSYS_BINARY), "profile",
@@ -110,7 +112,7 @@ def _run_pca(name, nsys_output, num_gpus, launcher, np_flag, lets):
         "--trace=cuda,nvtx",
         "--nvtx-capture", "Initial",
         str(PCA_BINARY), "--gpu", "--save", *lets_flag,
-        str(PARTICLES_H5), name,
+        *source,
     ]
     print(f"  $ {' '.join(cmd)}", flush=True)
     result = subprocess.run(cmd)
@@ -164,7 +166,7 @@ def _generate_plots(name, output_folder):
 
 # Lazily generate distributions in batches, profile, plot, clean up
 def run_batches(generators, n_particles, scale_factors, rotations=None,
-                out_of_bounds="truncate", batch_size=5, num_gpus=1, lets=False):
+                out_of_bounds="truncate", batch_size=5, num_gpus=1, lets=False, native=False):
     if not PCA_BINARY.exists():
         print(f"ERROR: {PCA_BINARY} not found. Build the project first.")
         sys.exit(1)
@@ -192,10 +194,11 @@ def run_batches(generators, n_particles, scale_factors, rotations=None,
         print(f"  BATCH {batch_num}/{n_batches}  ({len(batch)} distributions)")
         print(f"{'='*70}")
 
-        print(f"\nWriting {len(batch)} distributions to {PARTICLES_H5} ...")
-        with h5.File(str(PARTICLES_H5), "w") as f:
-            for cfg in batch:
-                _generate_one(f, cfg)
+        if not native:
+            print(f"\nWriting {len(batch)} distributions to {PARTICLES_H5} ...")
+            with h5.File(str(PARTICLES_H5), "w") as f:
+                for cfg in batch:
+                    _generate_one(f, cfg)
 
         for cfg in batch:
             name = cfg["name"]
@@ -204,14 +207,15 @@ def run_batches(generators, n_particles, scale_factors, rotations=None,
 
             print(f"\n--- {name} ---")
             nsys_output = Path(name)
-            rc = _run_pca(name, nsys_output, num_gpus, launcher, np_flag, lets)
+            rc = _run_pca(name, nsys_output, num_gpus, launcher, np_flag, lets, native, out_of_bounds)
             if rc != 0:
                 print(f"  WARNING: pca exited with code {rc}")
             _generate_plots(name, folder)
             _collect_nsys_rep(nsys_output, folder)
 
-        print(f"\nCleaning up {PARTICLES_H5} ...")
-        PARTICLES_H5.unlink(missing_ok=True)
+        if not native:
+            print(f"\nCleaning up {PARTICLES_H5} ...")
+            PARTICLES_H5.unlink(missing_ok=True)
 
     print(f"\n{'='*70}")
     print("All batches complete!")
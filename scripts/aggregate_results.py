@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+# Flatten the JSON records written by `pca --json <path>` into one row per (run, phase/stage).
+import argparse
+import json
+import pathlib
+
+import pandas
+
+META_KEYS = ["group", "timestamp", "git_hash", "host", "mode", "n", "n_local", "ranks", "threads",
+             "bucket_size", "bucket_size_focus", "theta"]
+
+
+def parse_args() -> argparse.Namespace:
+    parser = argparse.ArgumentParser(description="Aggregate pca JSON benchmark records")
+    parser.add_argument("inputs", type=pathlib.Path, nargs="+", help="JSON lines files written with --json")
+    parser.add_argument("-o", "--output", type=pathlib.Path, default=None, help="Write the table as CSV")
+    return parser.parse_args()
+
+
+def load_records(paths):
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                line = line.strip()
+                if line:
+                    yield json.loads(line)
+
+
+def flatten(record):
+    meta = {k: record.get(k) for k in META_KEYS}
+    for kind in ("phases", "stages"):
+        for name, stats in record.get(kind, {}).items():
+            row = dict(meta, kind=kind[:-1], name=name)
+            row.update({k: v for k, v in stats.items() if not isinstance(v, list)})
+            yield row
+
+
+def main():
+    args = parse_args()
+    df = pandas.DataFrame([row for rec in load_records(args.inputs) for row in flatten(rec)])
+    if args.output:
+        df.to_csv(args.output, index=False)
+    else:
+        cols = ["group", "mode", "n", "ranks", "threads", "kind", "name", "median", "mad", "ci95", "n"]
+        print(df[[c for c in dict.fromkeys(cols) if c in df.columns]].to_string(index=False))
+
+
+if __name__ == "__main__":
+    main()
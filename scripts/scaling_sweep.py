@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+# Rank x thread scaling sweep: launch pca once per rank count with --scaling/--threads/--json,
+# then print speedup and parallel efficiency per stage over all (ranks, threads) points.
+import argparse
+import json
+import pathlib
+import shutil
+import subprocess
+import sys
+
+import pandas
+
+
+def parse_args() -> argparse.Namespace:
+    parser = argparse.ArgumentParser(description="Strong/weak scaling sweep over MPI ranks and OpenMP threads")
+    parser.add_argument("groups", nargs="+", help="Distribution specs (with --generate) or <dataset.h5> <groups ...>")
+    parser.add_argument("--pca", type=pathlib.Path, default=pathlib.Path("build/src/pca"))
+    parser.add_argument("--ranks", type=str, default="1", help="Comma separated rank counts")
+    parser.add_argument("--threads", type=str, default="1,2,4,8", help="Comma separated OpenMP thread counts")
+    parser.add_argument("--scaling", choices=["strong", "weak"], default="strong")
+    parser.add_argument("--n-per-core", type=int, default=None, help="Particles per core for weak scaling")
+    parser.add_argument("--lets", action="store_true", help="Benchmark runnerCpuMulti instead of processCpu")
+    parser.add_argument("--generate", action="store_true", help="Positional arguments are distribution specs")
+    parser.add_argument("--json", type=pathlib.Path, default=pathlib.Path("scaling.jsonl"))
+    parser.add_argument("--no-run", action="store_true", help="Only aggregate an existing --json file")
+    parser.add_argument("-o", "--output", type=pathlib.Path, default=None, help="Write the table as CSV")
+    return parser.parse_args()
+
+
+def run(args):
+    launcher = shutil.which("mpirun") or shutil.which("mpiexec")
+    if not launcher:
+        sys.exit("ERROR: no MPI launcher found (mpirun or mpiexec)")
+    for ranks in args.ranks.split(","):
+        cmd = [launcher, "-np", ranks, "--bind-to", "none", str(args.pca),
+               "--scaling", args.scaling, "--threads", args.threads, "--json", str(args.json)]
+        if args.n_per_core:
+            cmd += ["--n-per-core", str(args.n_per_core)]
+        if args.lets:
+            cmd.append("--lets")
+        if args.generate:
+            cmd.append("--generate")
+        cmd += args.groups
+        print(f"$ {' '.join(cmd)}", flush=True)
+        if subprocess.run(cmd).returncode != 0:
+            sys.exit(f"ERROR: pca failed for {ranks} ranks")
+
+
+def table(path, scaling):
+    rows = []
+    with open(path) as f:
+        for line in f:
+            if not line.strip():
+                continue
+            rec = json.loads(line)
+            if rec.get("scaling") != scaling:
+                continue
+            base = dict(group=rec["group"], mode=rec["mode"], ranks=rec["ranks"], threads=rec["threads"],
+                        cores=rec["ranks"] * rec["threads"])
+            for name, stats in list(rec["phases"].items()) + list(rec["stages"].items()):
+                rows.append(dict(base, stage=name, median_us=stats["median"]))
+    df = pandas.DataFrame(rows)
+    if df.empty:
+        return df
+
+    def rel(g):
+        g = g.sort_values("cores")
+        t0, c0 = g["median_us"].iloc[0], g["cores"].iloc[0]
+        ratio = t0 / g["median_us"]
+        if scaling == "weak":
+            g["efficiency"] = ratio
+            g["speedup"] = ratio * g["cores"] / c0
+        else:
+            g["speedup"] = ratio
+            g["efficiency"] = ratio * c0 / g["cores"]
+        return g
+
+    return df.groupby(["group", "mode", "stage"], group_keys=False, sort=False).apply(rel)
+
+
+def main():
+    args = parse_args()
+    if not args.no_run:
+        run(args)
+    df = table(args.json, args.scaling)
+    if args.output:
+        df.to_csv(args.output, index=False)
+    for (group, stage), g in df.groupby(["group", "stage"], sort=False):
+        print(f"\n{group} {stage} ({args.scaling})")
+        print(g[["ranks", "threads", "cores", "median_us", "speedup", "efficiency"]].to_string(index=False))
+
+
+if __name__ == "__main__":
+    main()
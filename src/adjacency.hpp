@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "cstone/sfc/box.hpp"
+#include "cstone/sfc/common.hpp"
+#include "cstone/sfc/sfc.hpp"
+#include "cstone/tree/octree.hpp"
+
+/*! @brief leaves sharing a face, edge or corner with each leaf, in CSR layout
+ *
+ * The neighbors of leaf i are neighbors[offsets[i], offsets[i + 1]), sorted by
+ * leaf index, and contact[k] is 1, 2 or 3 for a face, edge or corner contact
+ * of neighbors[k].
+ */
+struct LeafAdjacency {
+  std::vector<uint64_t> offsets;
+  std::vector<cstone::TreeNodeIndex> neighbors;
+  std::vector<uint8_t> contact;
+  //! leaves with a neighbor more than one level finer or coarser
+  size_t unbalancedLeaves = 0;
+
+  size_t numLeaves() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+  size_t bytes() const {
+    return offsets.size() * sizeof(uint64_t) +
+           neighbors.size() * sizeof(cstone::TreeNodeIndex) + contact.size();
+  }
+};
+
+namespace detail {
+
+//! @brief leaf bounds in units of the finest level, [lo, hi) per dimension
+struct IntBox {
+  int lo[3], hi[3];
+};
+
+/*! @brief 0 if @p a and @p b are apart, else the number of dimensions in
+ *         which they only touch: 1 face, 2 edge, 3 corner
+ */
+inline int contactOf(const IntBox &a, const IntBox &b) {
+  int touching = 0;
+  for (int d = 0; d < 3; ++d) {
+    if (a.hi[d] < b.lo[d] || b.hi[d] < a.lo[d])
+      return 0;
+    touching += a.hi[d] == b.lo[d] || b.hi[d] == a.lo[d];
+  }
+  return touching;
+}
+
+} // namespace detail
+
+/*! @brief adjacency of the cornerstone @p leaves, without periodic images
+ *
+ * For each of the 26 directions, the center of the same-level node next to
+ * leaf i is keyed like a particle and masked to that node's key range. The
+ * leaves overlapping the range are contiguous in @p leaves. A single one is
+ * an equal or coarser neighbor, otherwise the finer leaves inside are kept if
+ * their box touches leaf i.
+ *
+ * Leaves are processed in parallel blocks that are concatenated after a scan.
+ * With @p checkBalance each neighbor's level is compared against the 2:1
+ * condition.
+ */
+template <class KeyType, class T>
+LeafAdjacency buildLeafAdjacency(std::span<const KeyType> leaves,
+                                 const cstone::Box<T> &box,
+                                 bool checkBalance = false) {
+  using cstone::TreeNodeIndex;
+  constexpr unsigned maxLevel = cstone::maxTreeLevel<KeyType>{};
+  constexpr int finest = 1 << maxLevel;
+  size_t numLeaves = leaves.size() - 1;
+
+  // geometry in double so that rounding to the integer grid is exact
+  cstone::Box<double> dbox(box.xmin(), box.xmax(), box.ymin(), box.ymax(),
+                           box.zmin(), box.zmax());
+  std::vector<KeyType> prefixes(numLeaves);
+  std::vector<unsigned> levels(numLeaves);
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < numLeaves; ++i) {
+    levels[i] =
+        maxLevel - std::countr_zero(leaves[i + 1] - leaves[i]) / 3;
+    prefixes[i] = cstone::encodePlaceholderBit(leaves[i], 3 * levels[i]);
+  }
+  std::vector<cstone::Vec3<double>> centers(numLeaves), sizes(numLeaves);
+  cstone::nodeFpCenters<KeyType>(
+      std::span<const KeyType>(prefixes.data(), numLeaves), centers.data(),
+      sizes.data(), dbox);
+
+  const double origin[3] = {dbox.xmin(), dbox.ymin(), dbox.zmin()};
+  const double scale[3] = {finest / dbox.lx(), finest / dbox.ly(),
+                           finest / dbox.lz()};
+  std::vector<detail::IntBox> ibox(numLeaves);
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < numLeaves; ++i) {
+    for (int d = 0; d < 3; ++d) {
+      double lo = centers[i][d] - sizes[i][d], hi = centers[i][d] + sizes[i][d];
+      ibox[i].lo[d] = int(std::lround((lo - origin[d]) * scale[d]));
+      ibox[i].hi[d] = int(std::lround((hi - origin[d]) * scale[d]));
+    }
+  }
+
+  constexpr size_t blockSize = 1024;
+  size_t numBlocks = (numLeaves + blockSize - 1) / blockSize;
+  std::vector<std::vector<TreeNodeIndex>> blockNeighbors(numBlocks);
+  std::vector<std::vector<uint8_t>> blockContact(numBlocks);
+
+  LeafAdjacency adj;
+  adj.offsets.assign(numLeaves + 1, 0);
+  size_t unbalanced = 0;
+
+#pragma omp parallel reduction(+ : unbalanced)
+  {
+    double px[26], py[26], pz[26];
+    KeyType probes[26];
+    std::vector<TreeNodeIndex> found;
+
+#pragma omp for schedule(dynamic)
+    for (size_t b = 0; b < numBlocks; ++b) {
+      for (size_t i = b * blockSize; i < std::min((b + 1) * blockSize, numLeaves);
+           ++i) {
+        const detail::IntBox &self = ibox[i];
+        int width = self.hi[0] - self.lo[0];
+        int numProbes = 0;
+        for (int dx = -1; dx <= 1; ++dx)
+          for (int dy = -1; dy <= 1; ++dy)
+            for (int dz = -1; dz <= 1; ++dz) {
+              int dir[3] = {dx, dy, dz};
+              bool inside = dx || dy || dz;
+              for (int d = 0; d < 3; ++d) {
+                int lo = self.lo[d] + dir[d] * width;
+                inside = inside && lo >= 0 && lo + width <= finest;
+              }
+              if (!inside)
+                continue;
+              px[numProbes] = centers[i][0] + 2 * dx * sizes[i][0];
+              py[numProbes] = centers[i][1] + 2 * dy * sizes[i][1];
+              pz[numProbes] = centers[i][2] + 2 * dz * sizes[i][2];
+              ++numProbes;
+            }
+        cstone::computeSfcKeys(px, py, pz, cstone::sfcKindPointer(probes),
+                               numProbes, dbox);
+
+        KeyType range = leaves[i + 1] - leaves[i];
+        found.clear();
+        for (int p = 0; p < numProbes; ++p) {
+          KeyType start = probes[p] - probes[p] % range;
+          auto first = std::upper_bound(leaves.begin(), leaves.end(), start) - 1;
+          auto last = std::lower_bound(first, leaves.end() - 1, start + range);
+          if (last - first == 1) {
+            found.push_back(TreeNodeIndex(first - leaves.begin()));
+            continue;
+          }
+          for (auto it = first; it != last; ++it) {
+            TreeNodeIndex j = TreeNodeIndex(it - leaves.begin());
+            if (detail::contactOf(self, ibox[j]))
+              found.push_back(j);
+          }
+        }
+        std::sort(found.begin(), found.end());
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+
+        bool balanced = true;
+        for (TreeNodeIndex j : found) {
+          blockNeighbors[b].push_back(j);
+          blockContact[b].push_back(uint8_t(detail::contactOf(self, ibox[j])));
+          if (checkBalance)
+            balanced = balanced && levels[j] + 1 >= levels[i] &&
+                       levels[j] <= levels[i] + 1;
+        }
+        unbalanced += !balanced;
+        adj.offsets[i + 1] = found.size();
+      }
+    }
+  }
+
+  std::inclusive_scan(adj.offsets.begin(), adj.offsets.end(),
+                      adj.offsets.begin());
+  adj.neighbors.resize(adj.offsets.back());
+  adj.contact.resize(adj.offsets.back());
+  adj.unbalancedLeaves = unbalanced;
+
+#pragma omp parallel for schedule(static)
+  for (size_t b = 0; b < numBlocks; ++b) {
+    size_t offset = adj.offsets[b * blockSize];
+    std::copy(blockNeighbors[b].begin(), blockNeighbors[b].end(),
+              adj.neighbors.begin() + offset);
+    std::copy(blockContact[b].begin(), blockContact[b].end(),
+              adj.contact.begin() + offset);
+  }
+  return adj;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include "distributions.hpp"
+#include "json.hpp"
+#include "utils.hpp"
+
+#ifndef PCA_GIT_HASH
+#define PCA_GIT_HASH "unknown"
+#endif
+
+enum class ScalingMode { none, strong, weak };
+
+inline const char *scalingName(ScalingMode m) {
+  return m == ScalingMode::strong ? "strong"
+         : m == ScalingMode::weak ? "weak"
+                                  : "none";
+}
+
+//! @brief optional queries on the processCpu tree, run after each phase
+struct QueryOptions {
+  //! target neighbor count of the 2h radius search, 0 disables it
+  unsigned neighbors = 0;
+  //! target neighbor count of the iterative h adaptation, 0 disables it
+  unsigned adaptH = 0;
+  //! k of the k-nearest-neighbor query, 0 disables it
+  unsigned knn = 0;
+  //! number of box and of sphere range queries, 0 disables them
+  unsigned ranges = 0;
+  //! Barnes-Hut accelerations of all particles at the run's theta
+  bool gravity = false;
+  //! number of random tracer points to locate in the leaves, 0 disables it
+  unsigned locate = 0;
+  //! face/edge/corner adjacency of the leaves with a 2:1 balance check
+  bool adjacency = false;
+  //! number of logarithmic distance bins for dual-tree pair counting, 0 disables it
+  unsigned pairBins = 0;
+  //! target neighbor count of the float vs packed 3x21-bit coordinate
+  //! comparison, 0 disables it
+  unsigned quantized = 0;
+};
+
+//! @brief compression of the harness's particle and halo exchanges, see
+//!        compress.hpp
+struct CompressOptions {
+  //! delta-encoded SFC keys
+  bool keys = false;
+  //! XOR-delta float coordinates
+  bool floats = false;
+  //! decide per message from its size and the measured bandwidth
+  bool adaptive = false;
+};
+
+//! @brief options of one pca invocation, shared by all groups it runs
+struct BenchConfig {
+  bool gpu = false;
+  bool lets = false;
+  bool save = false;
+  int bucketSize = 1024;
+  int bucketSizeFocus = 64;
+  float theta = 0.6;
+
+  bool perfCounters = false;
+  bool memory = false;
+  //! probe STREAM bandwidth and flop rate, report stages against them
+  bool roofline = false;
+  //! check the tree invariants after the first trial, see validate.hpp
+  bool validate = false;
+  QueryOptions queries;
+
+  //! untimed trials before measuring
+  int warmup = 1;
+  //! measured trials, the minimum if ciTarget is set
+  int trials = 9;
+  //! keep adding trials until the 95% CI of the mean is within this fraction
+  //! of the mean for both phases, 0 disables
+  double ciTarget = 0;
+  int maxTrials = 100;
+
+  //! append one JSON record per group to this file, empty disables
+  std::string jsonPath;
+
+  //! treat the positional arguments as distribution specs, not HDF5 groups
+  bool generate = false;
+  uint64_t seed = 42;
+  OutOfBounds outOfBounds = OutOfBounds::truncate;
+
+  //! exchange the loaded slices into SFC order before the first sync, see
+  //! partition.hpp
+  bool sfcPartition = false;
+  //! rebalance the pre-partitioned harness slices by neighbor counts at one
+  //! global h aiming for this many neighbors on average, 0 disables; the
+  //! Domain still assigns by count
+  unsigned sliceCostBalance = 0;
+  //! compare blocking and overlapped halo exchange around a neighbor count
+  //! with this many neighbors on average, 0 disables
+  unsigned haloOverlap = 0;
+  //! compare resampling the splitters every step of a drift by the
+  //! perturbation with keeping them up to this imbalance above 1, 0 disables
+  double hysteresis = 0;
+  CompressOptions compress;
+  //! compare the particle exchange through messages and through a shared
+  //! memory window, see shared_exchange.hpp
+  bool sharedExchange = false;
+  //! split shared memory nodes into groups of this many ranks, 0 keeps them
+  int ranksPerNode = 0;
+  //! directory of per-rank checkpoints of the initial domain sync under
+  //! --lets, restored if they match the run, written otherwise
+  std::string checkpointDir;
+  //! time a harness model of each domain sync as SyncModel/... stages, see
+  //! replaySyncModel in runner.cpp
+  bool syncModel = false;
+
+  //! rerun each group for every OpenMP thread count in threadCounts
+  ScalingMode scaling = ScalingMode::none;
+  std::vector<int> threadCounts;
+  //! particles per core (thread x rank) for weak scaling, 0 sizes the
+  //! largest thread count to the whole group
+  size_t nPerCore = 0;
+};
+
+//! @brief statistics of one benchmarked group
+struct BenchResult {
+  Summary initial;
+  Summary perturb;
+  std::vector<std::pair<std::string, Summary>> stages;
+};
+
+//! @brief one row of a speedup / parallel efficiency table
+struct ScalingRow {
+  int cores = 0;
+  double median = 0;
+  double speedup = 0;
+  double efficiency = 0;
+};
+
+/*! @brief speedup and efficiency relative to the first entry
+ *
+ * Strong scaling: speedup = t0 / t, efficiency = speedup * cores0 / cores.
+ * Weak scaling (work proportional to cores): efficiency = t0 / t and the
+ * scaled speedup is efficiency * cores / cores0.
+ */
+inline std::vector<ScalingRow> scalingTable(const std::vector<int> &cores,
+                                            const std::vector<double> &medians,
+                                            ScalingMode mode) {
+  std::vector<ScalingRow> rows;
+  if (cores.empty())
+    return rows;
+  for (size_t i = 0; i < cores.size(); ++i) {
+    ScalingRow r;
+    r.cores = cores[i];
+    r.median = medians[i];
+    double ratio = medians[i] > 0 ? medians[0] / medians[i] : 0;
+    double coreRatio = double(cores[i]) / cores[0];
+    if (mode == ScalingMode::weak) {
+      r.efficiency = ratio;
+      r.speedup = ratio * coreRatio;
+    } else {
+      r.speedup = ratio;
+      r.efficiency = ratio / coreRatio;
+    }
+    rows.push_back(r);
+  }
+  return rows;
+}
+
+inline std::string hostName() {
+  char buf[256] = {0};
+  if (gethostname(buf, sizeof(buf) - 1) != 0)
+    return "unknown";
+  return buf;
+}
+
+inline int numThreads() {
+#if defined(_OPENMP)
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+//! @brief UTC time in ISO 8601
+inline std::string timestamp() {
+  std::time_t now = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now());
+  char buf[32];
+  std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+  return buf;
+}
+
+inline void writeSummary(JsonWriter &json, const Summary &s) {
+  json.field("n", s.n)
+      .field("mean", s.avg)
+      .field("min", s.min)
+      .field("max", s.max)
+      .field("stddev", s.stddev)
+      .field("median", s.median)
+      .field("p05", s.p05)
+      .field("p95", s.p95)
+      .field("mad", s.mad)
+      .field("ci95", s.ci95);
+}
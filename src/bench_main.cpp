@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mpi.h>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "distributions.hpp"
+#include "regression.hpp"
+#include "runner.hpp"
+
+//! the committed baseline, CMake points this into the source tree
+#ifndef PCA_BASELINE_PATH
+#define PCA_BASELINE_PATH "bench/baseline.json"
+#endif
+
+/*! @brief the fixed pca-bench suite
+ *
+ * Every distribution family the octree sees in run_batches.py, at two sizes
+ * and the default focus and global bucket sizes. Changing the suite
+ * invalidates the committed baseline: its dropped entries fail the gate as
+ * missing.
+ */
+struct SuiteCase {
+  std::string spec;
+  int bucketSize;
+};
+
+static std::vector<SuiteCase> benchSuite(bool quick) {
+  const char *dists[] = {"uniform", "normal", "pancake", "spherical",
+                         "filament_xyz"};
+  std::vector<const char *> counts{"100k"};
+  if (!quick)
+    counts.push_back("1m");
+  const int buckets[] = {64, 1024};
+
+  std::vector<SuiteCase> suite;
+  for (const char *dist : dists) {
+    for (const char *count : counts) {
+      for (int bucket : buckets)
+        suite.push_back({std::string(dist) + "_s0p01_n" + count, bucket});
+    }
+  }
+  return suite;
+}
+
+int main(int argc, char *argv[]) {
+  auto printUsage = [&]() {
+    std::cerr << "Usage: " << argv[0]
+              << " [--baseline <path>] [--update-baseline] [--quick] [--lets] "
+                 "[--threshold <fraction>] [--sigmas <k>] [--min-delta <us>] "
+                 "[--warmup <n>] [--trials <n>] [--seed <value>] "
+                 "[--json <path>]\n"
+                 "  Runs the fixed benchmark suite and compares every stage "
+                 "median against the baseline.\n"
+                 "  Exit status: 0 no regression, 1 regression, missing entry "
+                 "or error, 2 no baseline (record one with --update-baseline)"
+              << std::endl;
+  };
+
+  auto parseValue = [&](int &i, const std::string &opt, auto conv,
+                        auto &out) -> bool {
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << opt << std::endl;
+      printUsage();
+      return false;
+    }
+    try {
+      out = conv(argv[++i]);
+    } catch (const std::exception &) {
+      std::cerr << "Invalid value for " << opt << ": " << argv[i] << std::endl;
+      return false;
+    }
+    return true;
+  };
+  auto toInt = [](const char *v) { return std::stoi(v); };
+  auto toDouble = [](const char *v) { return std::stod(v); };
+  auto toString = [](const char *v) { return std::string(v); };
+  auto toSeed = [](const char *v) { return uint64_t(std::stoull(v)); };
+
+  BenchConfig cfg;
+  cfg.generate = true;
+  RegressionThreshold threshold;
+  std::string baselinePath = PCA_BASELINE_PATH;
+  bool update = false;
+  bool quick = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    bool ok = true;
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    } else if (arg == "--baseline") {
+      ok = parseValue(i, arg, toString, baselinePath);
+    } else if (arg == "--update-baseline") {
+      update = true;
+    } else if (arg == "--quick") {
+      quick = true;
+    } else if (arg == "--lets") {
+      cfg.lets = true;
+    } else if (arg == "--threshold") {
+      ok = parseValue(i, arg, toDouble, threshold.relative);
+    } else if (arg == "--sigmas") {
+      ok = parseValue(i, arg, toDouble, threshold.sigmas);
+    } else if (arg == "--min-delta") {
+      ok = parseValue(i, arg, toDouble, threshold.minDeltaUs);
+    } else if (arg == "--warmup") {
+      ok = parseValue(i, arg, toInt, cfg.warmup);
+    } else if (arg == "--trials") {
+      ok = parseValue(i, arg, toInt, cfg.trials);
+    } else if (arg == "--seed") {
+      ok = parseValue(i, arg, toSeed, cfg.seed);
+    } else if (arg == "--json") {
+      ok = parseValue(i, arg, toString, cfg.jsonPath);
+    } else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      printUsage();
+      return 1;
+    }
+    if (!ok)
+      return 1;
+  }
+
+  if (cfg.warmup < 0 || cfg.trials < 2) {
+    std::cerr << "--warmup must be >= 0 and --trials >= 2" << std::endl;
+    return 1;
+  }
+
+  MPI_Init(&argc, &argv);
+
+  int rank = 0, numRanks = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+
+  std::string mode = cfg.lets ? "cpu_multi" : "cpu";
+  std::vector<BaselineEntry> current;
+  for (const auto &c : benchSuite(quick)) {
+    BenchConfig caseCfg = cfg;
+    caseCfg.bucketSize = c.bucketSize;
+    auto particles = generateSlice<Real>(parseDistributionSpec(c.spec), rank,
+                                         numRanks, cfg.seed, cfg.outOfBounds);
+    if (rank == 0)
+      std::cout << "pca-bench [" << c.spec << "] bucket size " << c.bucketSize
+                << std::endl;
+    BenchResult r = runner(particles, c.spec, rank, numRanks, caseCfg);
+
+    std::string prefix =
+        mode + "/" + c.spec + "/b" + std::to_string(c.bucketSize) + "/";
+    current.push_back(baselineEntry(prefix + "Initial", r.initial));
+    current.push_back(baselineEntry(prefix + "Perturb", r.perturb));
+    for (const auto &[name, s] : r.stages)
+      current.push_back(baselineEntry(prefix + name, s));
+  }
+
+  int status = 0;
+  if (rank == 0 && update) {
+    Baseline b{PCA_GIT_HASH, hostName(), timestamp(), numRanks, numThreads(),
+               current};
+    std::ofstream out(baselinePath);
+    if (out) {
+      writeBaseline(out, b);
+      std::cout << "Wrote " << current.size() << " baseline entries to "
+                << baselinePath << std::endl;
+    } else {
+      std::cerr << "Cannot write baseline " << baselinePath << std::endl;
+      status = 1;
+    }
+  } else if (rank == 0) {
+    Baseline base;
+    try {
+      base = readBaseline(baselinePath);
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << "\nRecord one with --update-baseline"
+                << std::endl;
+      status = 2;
+    }
+
+    if (status == 0) {
+      if (base.entries.empty())
+        std::cout << "Warning: baseline " << baselinePath
+                  << " holds no timings yet, every entry passes as new. "
+                     "Record it on the gate machine with --update-baseline "
+                     "and commit it"
+                  << std::endl;
+      else if (base.ranks != numRanks || base.threads != numThreads() ||
+               base.host != hostName())
+        std::cout << "Warning: baseline was recorded on " << base.host
+                  << " with " << base.ranks << " ranks x " << base.threads
+                  << " threads, this run uses " << hostName() << " with "
+                  << numRanks << " x " << numThreads() << std::endl;
+
+      auto diffs = compareToBaseline(base, current, threshold);
+      int regressions = 0, improvements = 0, missing = 0;
+      std::cout << "\nDiff against baseline " << base.gitHash << " ("
+                << base.timestamp << "), most regressed first\n";
+      std::printf("%-11s %8s %8s %12s %12s %10s  %s\n", "status", "score",
+                  "change", "base(us)", "now(us)", "allow(us)", "stage");
+      for (const auto &d : diffs) {
+        if (d.status == DiffStatus::added) {
+          std::printf("%-11s %8s %8s %12s %12.1f %10s  %s\n",
+                      diffStatusName(d.status), "-", "-", "-", d.current, "-",
+                      d.key.c_str());
+          continue;
+        }
+        if (d.status == DiffStatus::missing) {
+          ++missing;
+          std::printf("%-11s %8s %8s %12.1f %12s %10s  %s\n",
+                      diffStatusName(d.status), "-", "-", d.baseline, "-", "-",
+                      d.key.c_str());
+          continue;
+        }
+        regressions += d.status == DiffStatus::regression;
+        improvements += d.status == DiffStatus::improvement;
+        std::printf("%-11s %8.2f %+7.1f%% %12.1f %12.1f %10.1f  %s\n",
+                    diffStatusName(d.status), d.score(), 100 * d.relDelta(),
+                    d.baseline, d.current, d.allowed, d.key.c_str());
+      }
+      std::cout << "\n"
+                << regressions << " regressions, " << missing
+                << " missing, " << improvements << " improvements in "
+                << diffs.size() << " entries" << std::endl;
+      if (std::any_of(diffs.begin(), diffs.end(),
+                      [](const StageDiff &d) { return diffFails(d.status); }))
+        status = 1;
+    }
+  }
+
+  MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Finalize();
+  return status;
+}
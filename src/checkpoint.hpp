@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*! @brief what a domain checkpoint was written for; a checkpoint is only
+ *         restored into a run with the same values
+ */
+struct CheckpointHeader {
+  static constexpr uint64_t magicValue = 0x32544b4344414350; // "PCADCKT2"
+
+  uint64_t magic = magicValue;
+  uint32_t keyBytes = 0;
+  uint32_t realBytes = 0;
+  uint32_t rank = 0;
+  uint32_t numRanks = 0;
+  uint64_t numGlobal = 0;
+  int32_t bucketSize = 0;
+  int32_t bucketSizeFocus = 0;
+  float theta = 0;
+  uint32_t padding = 0;
+  //! generatorHash of the particles the run started from
+  uint64_t generator = 0;
+  //! the initial and the first perturbed sync of the run that wrote the
+  //! checkpoint on this rank, in microseconds
+  float freshInitialUs = 0;
+  float freshPerturbUs = 0;
+  //! particles in this rank's file
+  uint64_t numLocal = 0;
+
+  bool matches(const CheckpointHeader &o) const {
+    return magic == o.magic && keyBytes == o.keyBytes && realBytes == o.realBytes && rank == o.rank &&
+           numRanks == o.numRanks && numGlobal == o.numGlobal && bucketSize == o.bucketSize &&
+           bucketSizeFocus == o.bucketSizeFocus && theta == o.theta && generator == o.generator;
+  }
+};
+
+/*! @brief FNV-1a hash of what produced the particles of a run
+ *
+ * @param name         the dataset group or the distribution spec
+ * @param generated    whether @p name is a distribution spec
+ * @param seed         the generator seed, ignored for dataset groups
+ * @param outOfBounds  the generator's out-of-bounds mode, ignored for dataset
+ *                     groups
+ */
+inline uint64_t generatorHash(const std::string &name, bool generated, uint64_t seed, int outOfBounds) {
+  uint64_t hash = 0xcbf29ce484222325;
+  auto add = [&](const void *data, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      hash ^= static_cast<const unsigned char *>(data)[i];
+      hash *= 0x100000001b3;
+    }
+  };
+  add(name.data(), name.size());
+  add(&generated, sizeof(generated));
+  if (generated) {
+    add(&seed, sizeof(seed));
+    add(&outOfBounds, sizeof(outOfBounds));
+  }
+  return hash;
+}
+
+/*! @brief the particles one rank holds after a converged domain sync, in the
+ *         domain's SFC order
+ *
+ * p holds the perturbation of each particle, so that a restored run applies
+ * the same displacement to the same particle.
+ */
+template <class KeyType, class T> struct DomainCheckpoint {
+  CheckpointHeader header;
+  std::vector<KeyType> keys;
+  std::vector<T> x, y, z, h;
+  std::vector<T> px, py, pz;
+};
+
+//! @brief write @p ckpt to @p path through a temporary file, throws on failure
+template <class KeyType, class T>
+void writeCheckpoint(const std::string &path, const DomainCheckpoint<KeyType, T> &ckpt) {
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out)
+      throw std::runtime_error("Cannot write checkpoint " + tmp);
+    CheckpointHeader header = ckpt.header;
+    header.keyBytes = sizeof(KeyType);
+    header.realBytes = sizeof(T);
+    header.numLocal = ckpt.keys.size();
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(ckpt.keys.data()), ckpt.keys.size() * sizeof(KeyType));
+    for (const std::vector<T> *a : {&ckpt.x, &ckpt.y, &ckpt.z, &ckpt.h, &ckpt.px, &ckpt.py, &ckpt.pz}) {
+      if (a->size() != ckpt.keys.size())
+        throw std::runtime_error("Checkpoint arrays differ in length");
+      out.write(reinterpret_cast<const char *>(a->data()), a->size() * sizeof(T));
+    }
+    if (!out)
+      throw std::runtime_error("Cannot write checkpoint " + tmp);
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("Cannot move checkpoint to " + path);
+}
+
+/*! @brief read the checkpoint at @p path into @p ckpt
+ *
+ * @return false if the file is missing, truncated or was written for a run
+ *         other than @p expected, whose numLocal is ignored
+ */
+template <class KeyType, class T>
+bool readCheckpoint(const std::string &path, const CheckpointHeader &expected, DomainCheckpoint<KeyType, T> &ckpt) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+  CheckpointHeader want = expected;
+  want.keyBytes = sizeof(KeyType);
+  want.realBytes = sizeof(T);
+  in.read(reinterpret_cast<char *>(&ckpt.header), sizeof(ckpt.header));
+  if (!in || !ckpt.header.matches(want))
+    return false;
+
+  size_t n = ckpt.header.numLocal;
+  ckpt.keys.resize(n);
+  in.read(reinterpret_cast<char *>(ckpt.keys.data()), n * sizeof(KeyType));
+  for (std::vector<T> *a : {&ckpt.x, &ckpt.y, &ckpt.z, &ckpt.h, &ckpt.px, &ckpt.py, &ckpt.pz}) {
+    a->resize(n);
+    in.read(reinterpret_cast<char *>(a->data()), n * sizeof(T));
+  }
+  // nothing may follow the last array
+  return bool(in) && in.peek() == std::ifstream::traits_type::eof();
+}
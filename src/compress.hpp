@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+/*! @brief append @p keys as zigzag deltas of their predecessor in LEB128
+ *         varints
+ *
+ * Keys of one message are SFC-sorted and close together, so most deltas fit
+ * in one to three bytes instead of eight. Unsorted keys stay lossless.
+ */
+template <class K>
+void encodeKeyDeltas(std::span<const K> keys, std::vector<uint8_t> &out) {
+  using S = std::make_signed_t<K>;
+  K prev = 0;
+  for (K k : keys) {
+    int64_t d = S(k - prev);
+    prev = k;
+    uint64_t z = (uint64_t(d) << 1) ^ uint64_t(d >> 63);
+    while (z >= 0x80) {
+      out.push_back(uint8_t(z) | 0x80);
+      z >>= 7;
+    }
+    out.push_back(uint8_t(z));
+  }
+}
+
+//! @brief decode @p n keys written by encodeKeyDeltas, returns the end of input
+template <class K>
+const uint8_t *decodeKeyDeltas(const uint8_t *in, size_t n, K *keys) {
+  K prev = 0;
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t z = 0;
+    for (int shift = 0;; shift += 7) {
+      uint8_t b = *in++;
+      z |= uint64_t(b & 0x7f) << shift;
+      if (b < 0x80)
+        break;
+    }
+    int64_t d = int64_t(z >> 1) ^ -int64_t(z & 1);
+    prev = K(prev + K(d));
+    keys[i] = prev;
+  }
+  return in;
+}
+
+/*! @brief append @p values XORed with their predecessor, keeping only the
+ *         nonzero low bytes
+ *
+ * Neighbors in SFC order share sign, exponent and the leading mantissa bits,
+ * which XOR to zero. One control byte holds the byte counts of two values.
+ */
+template <class T>
+void encodeXorFloats(std::span<const T> values, std::vector<uint8_t> &out) {
+  using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+  U prev = 0;
+  for (size_t i = 0; i < values.size(); i += 2) {
+    size_t ctrl = out.size();
+    out.push_back(0);
+    for (size_t j = i; j < std::min(i + 2, values.size()); ++j) {
+      U bits = std::bit_cast<U>(values[j]);
+      U x = bits ^ prev;
+      prev = bits;
+      int numBytes = (std::bit_width(x) + 7) / 8;
+      out[ctrl] |= uint8_t(numBytes << (4 * (j - i)));
+      for (int b = 0; b < numBytes; ++b)
+        out.push_back(uint8_t(x >> (8 * b)));
+    }
+  }
+}
+
+//! @brief decode @p n values written by encodeXorFloats, returns the end of input
+template <class T>
+const uint8_t *decodeXorFloats(const uint8_t *in, size_t n, T *values) {
+  using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+  U prev = 0;
+  for (size_t i = 0; i < n; i += 2) {
+    uint8_t ctrl = *in++;
+    for (size_t j = i; j < std::min(i + 2, n); ++j) {
+      int numBytes = (ctrl >> (4 * (j - i))) & 0xf;
+      U x = 0;
+      for (int b = 0; b < numBytes; ++b)
+        x |= U(*in++) << (8 * b);
+      prev ^= x;
+      values[j] = std::bit_cast<T>(prev);
+    }
+  }
+  return in;
+}
+
+/*! @brief compression settings and counters of the particle and halo
+ *         exchanges
+ *
+ * Each message starts with a flag byte telling which of its columns are
+ * encoded, so the sender decides per message. In adaptive mode a message is
+ * compressed only if it is at least minBytes and encoding, decoding and
+ * sending the smaller payload is estimated to beat sending it raw at the
+ * measured bandwidth. The codec throughput and the compression ratio are
+ * running averages over the messages compressed so far.
+ */
+struct ExchangeCodec {
+  static constexpr uint8_t keysFlag = 1, floatsFlag = 2;
+
+  bool keys = false;
+  bool floats = false;
+  bool adaptive = false;
+  //! bytes/s between two ranks, 0 if unknown
+  double bandwidth = 0;
+  size_t minBytes = 4096;
+
+  //! raw bytes per second through encode plus decode, and wire / raw bytes
+  double codecRate = 0;
+  double ratio = 1;
+
+  //! off-rank totals
+  size_t rawBytes = 0;
+  size_t wireBytes = 0;
+  double encodeSeconds = 0;
+  double decodeSeconds = 0;
+
+  bool enabled() const { return keys || floats; }
+
+  //! @brief whether to compress a message of @p bytes raw bytes
+  bool compress(size_t bytes) const {
+    if (!enabled())
+      return false;
+    if (!adaptive)
+      return true;
+    if (bytes < minBytes)
+      return false;
+    // nothing measured yet, compress to learn the rate and ratio
+    if (codecRate == 0 || bandwidth == 0)
+      return true;
+    return bytes / codecRate + bytes * ratio / bandwidth < bytes / bandwidth;
+  }
+
+  //! @brief fold one compressed message into the running estimates
+  void learn(size_t raw, size_t wire, double seconds) {
+    constexpr double w = 0.25;
+    double rate = seconds > 0 ? raw / seconds : 0;
+    codecRate = codecRate == 0 ? rate : (1 - w) * codecRate + w * rate;
+    ratio = (1 - w) * ratio + w * double(wire) / std::max<size_t>(raw, 1);
+  }
+};
+
+/*! @brief append a column of @p n values, raw or with the codec chosen by
+ *         @p encoded
+ */
+template <class V>
+void appendColumn(const V *values, size_t n, bool encoded,
+                  std::vector<uint8_t> &out) {
+  if (!encoded) {
+    size_t pos = out.size();
+    out.resize(pos + n * sizeof(V));
+    std::memcpy(out.data() + pos, values, n * sizeof(V));
+  } else if constexpr (std::is_floating_point_v<V>) {
+    encodeXorFloats(std::span<const V>(values, n), out);
+  } else {
+    encodeKeyDeltas(std::span<const V>(values, n), out);
+  }
+}
+
+//! @brief read a column written by appendColumn, returns the end of input
+template <class V>
+const uint8_t *readColumn(const uint8_t *in, size_t n, bool encoded, V *values) {
+  if (!encoded) {
+    std::memcpy(values, in, n * sizeof(V));
+    return in + n * sizeof(V);
+  }
+  if constexpr (std::is_floating_point_v<V>)
+    return decodeXorFloats(in, n, values);
+  else
+    return decodeKeyDeltas(in, n, values);
+}
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <numbers>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*! @brief the part of a particle group owned by one rank
+ *
+ * Global indices [start, end) of n particles, initial positions ix/iy/iz and
+ * perturbations px/py/pz, as in the HDF5 groups written by dist_helpers.py.
+ */
+template <std::floating_point T> struct ParticleSlice {
+  size_t n = 0;
+  size_t start = 0;
+  size_t end = 0;
+  std::vector<T> ix, iy, iz, px, py, pz;
+};
+
+/*! @brief move sorted particles by the perturbations of their input order
+ *
+ * x[i] holds input particle ordering[i], as after a key sort with
+ * sort_by_key; px, py, pz are still in input order. The gather through
+ * @p ordering is fused with the update.
+ */
+template <class T, class IndexType>
+void perturbSorted(std::span<const IndexType> ordering,
+                   const std::vector<T> &px, const std::vector<T> &py,
+                   const std::vector<T> &pz, std::vector<T> &x,
+                   std::vector<T> &y, std::vector<T> &z) {
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < ordering.size(); ++i) {
+    x[i] += px[ordering[i]];
+    y[i] += py[ordering[i]];
+    z[i] += pz[ordering[i]];
+  }
+}
+
+/*! @brief counter-based random numbers
+ *
+ * Seeded from (seed, particle index) so that every particle draws the same
+ * values regardless of how many ranks or threads generate the group.
+ */
+class CounterRng {
+public:
+  CounterRng(uint64_t seed, uint64_t index, uint64_t stream)
+      : state_(mix(seed ^ mix(index ^ mix(stream)))) {}
+
+  //! @brief uniform in [a, b)
+  double uniform(double a, double b) {
+    state_ += 0x9e3779b97f4a7c15ull;
+    double u = double(mix(state_) >> 11) * 0x1.0p-53;
+    return a + (b - a) * u;
+  }
+
+  //! @brief normal with mean 0 and standard deviation @p scale (Box-Muller)
+  double normal(double scale = 1.0) {
+    double u1 = uniform(0, 1);
+    double u2 = uniform(0, 1);
+    return scale * std::sqrt(-2.0 * std::log1p(-u1)) *
+           std::cos(2 * std::numbers::pi * u2);
+  }
+
+private:
+  static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  uint64_t state_;
+};
+
+enum class Distribution {
+  uniform,
+  normal,
+  rectangular,
+  pancake,
+  pancake_tilted,
+  spherical,
+  filament_z,
+  filament_yz,
+  filament_xyz
+};
+
+//! @brief names of dist_helpers.py, with or without the "_initial" suffix
+inline bool distributionFromName(const std::string &name, Distribution &d) {
+  static const std::pair<const char *, Distribution> names[] = {
+      {"uniform", Distribution::uniform},
+      {"normal", Distribution::normal},
+      {"rectangular", Distribution::rectangular},
+      {"pancake", Distribution::pancake},
+      {"pancake_tilted", Distribution::pancake_tilted},
+      {"pancake_initial_tilted", Distribution::pancake_tilted},
+      {"spherical", Distribution::spherical},
+      {"filament_z", Distribution::filament_z},
+      {"filament_yz", Distribution::filament_yz},
+      {"filament_xyz", Distribution::filament_xyz}};
+  std::string base = name;
+  if (base.size() > 8 && base.ends_with("_initial"))
+    base.resize(base.size() - 8);
+  for (const auto &[n, kind] : names) {
+    if (base == n) {
+      d = kind;
+      return true;
+    }
+  }
+  return false;
+}
+
+enum class OutOfBounds { truncate, remove };
+
+//! @brief a generated group, named like run_batches.py does
+struct DistributionSpec {
+  std::string dist;
+  Distribution kind = Distribution::uniform;
+  size_t n = 0;
+  double scale = 0;
+  //! rotation angles in radians, applied as Rz * Ry * Rx
+  std::array<double, 3> rotation{0, 0, 0};
+};
+
+//! @brief decode "1p5" -> 1.5 and "n2" -> -2 as in dist_helpers._format_scale
+inline double decodeNumber(std::string s) {
+  if (!s.empty() && s[0] == 'n')
+    s[0] = '-';
+  for (char &c : s) {
+    if (c == 'p')
+      c = '.';
+  }
+  size_t pos = 0;
+  double v = std::stod(s, &pos);
+  if (pos != s.size())
+    throw std::invalid_argument("trailing characters in " + s);
+  return v;
+}
+
+//! @brief decode particle counts "10k", "1m", "1p5m" or "1000"
+inline size_t decodeCount(std::string s) {
+  double mult = 1;
+  if (!s.empty() && (s.back() == 'k' || s.back() == 'm')) {
+    mult = s.back() == 'k' ? 1e3 : 1e6;
+    s.pop_back();
+  }
+  return size_t(std::llround(decodeNumber(s) * mult));
+}
+
+/*! @brief parse "<dist>[_rx<deg>][_ry<deg>][_rz<deg>]_s<scale>_n<count>"
+ *
+ * e.g. "filament_xyz_s0p01_n10m" or "pancake_rx45_s0p1_n1m", the group names
+ * produced by run_batches.py.
+ */
+inline DistributionSpec parseDistributionSpec(const std::string &name) {
+  std::vector<std::string> tokens;
+  size_t pos = 0;
+  while (pos <= name.size()) {
+    size_t next = name.find('_', pos);
+    if (next == std::string::npos)
+      next = name.size();
+    tokens.push_back(name.substr(pos, next - pos));
+    pos = next + 1;
+  }
+
+  auto fail = [&](const std::string &why) {
+    return std::invalid_argument("Invalid distribution spec '" + name +
+                                 "': " + why);
+  };
+
+  if (tokens.size() < 3)
+    throw fail("expected <dist>_s<scale>_n<count>");
+
+  DistributionSpec spec;
+  const std::string &countTok = tokens.back();
+  const std::string &scaleTok = tokens[tokens.size() - 2];
+  if (countTok.size() < 2 || countTok[0] != 'n')
+    throw fail("missing particle count n<count>");
+  if (scaleTok.size() < 2 || scaleTok[0] != 's')
+    throw fail("missing perturbation scale s<scale>");
+  try {
+    spec.n = decodeCount(countTok.substr(1));
+    spec.scale = decodeNumber(scaleTok.substr(1));
+  } catch (const std::exception &) {
+    throw fail("cannot decode count or scale");
+  }
+
+  size_t distEnd = tokens.size() - 2;
+  while (distEnd > 1) {
+    const std::string &t = tokens[distEnd - 1];
+    if (t.size() < 3 || t[0] != 'r' || t[1] < 'x' || t[1] > 'z')
+      break;
+    try {
+      spec.rotation[t[1] - 'x'] =
+          decodeNumber(t.substr(2)) * std::numbers::pi / 180.0;
+    } catch (const std::exception &) {
+      break;
+    }
+    --distEnd;
+  }
+
+  for (size_t i = 0; i < distEnd; ++i)
+    spec.dist += (i ? "_" : "") + tokens[i];
+  if (!distributionFromName(spec.dist, spec.kind))
+    throw fail("unknown distribution " + spec.dist);
+  return spec;
+}
+
+//! @brief initial position of particle drawn from @p rng, mirrors dist_helpers
+inline std::array<double, 3> drawInitial(Distribution dist, CounterRng &rng) {
+  constexpr double twoPi = 2 * std::numbers::pi;
+  switch (dist) {
+  case Distribution::uniform:
+    return {rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1)};
+  case Distribution::normal:
+    return {rng.normal(), rng.normal(), rng.normal()};
+  case Distribution::rectangular:
+    return {rng.uniform(-0.1, 0.1), rng.uniform(-0.1, 0.1), rng.uniform(-1, 1)};
+  case Distribution::pancake:
+  case Distribution::pancake_tilted: {
+    double r = std::sqrt(std::abs(std::clamp(rng.normal(0.3), -1.0, 1.0)));
+    double t = rng.uniform(0, twoPi);
+    double x = r * std::cos(t);
+    double y = r * std::sin(t);
+    double z = dist == Distribution::pancake ? rng.uniform(-0.05, 0.05) : x;
+    return {x, y, z};
+  }
+  case Distribution::spherical: {
+    // uniform in cos(phi); dist_helpers draws arccos(2u - 1) with u in
+    // [-1, 1], which is NaN for half of the particles
+    double r = std::cbrt(std::abs(std::clamp(rng.normal(0.3), -1.0, 1.0)));
+    double cosPhi = rng.uniform(-1, 1);
+    double sinPhi = std::sqrt(1 - cosPhi * cosPhi);
+    double theta = rng.uniform(0, twoPi);
+    return {r * sinPhi * std::cos(theta), r * sinPhi * std::sin(theta),
+            r * cosPhi};
+  }
+  default:
+    break;
+  }
+
+  double t = rng.uniform(-1, 1);
+  if (dist == Distribution::filament_z)
+    return {0, 0, t};
+  if (dist == Distribution::filament_yz)
+    return {0, t, t};
+  return {t, t, t}; // filament_xyz
+}
+
+/*! @brief generate the particles [start, end) of @p spec owned by @p rank
+ *
+ * Each particle only depends on (seed, global index), so the union of the
+ * slices of all ranks is the same group for any rank count and thread count.
+ * With OutOfBounds::remove, rotated particles leaving [-1, 1]^3 are dropped
+ * from the slice instead of being clipped. end and n then exclude the
+ * particles this rank dropped, so end - start is the slice size and a single
+ * rank's n is the group size. start and n do not know about the particles
+ * other ranks dropped; renumberSlice fixes them from the kept counts of all
+ * ranks.
+ */
+template <std::floating_point T>
+ParticleSlice<T> generateSlice(const DistributionSpec &spec, int rank,
+                               int numRanks, uint64_t seed,
+                               OutOfBounds oob = OutOfBounds::truncate) {
+  ParticleSlice<T> p;
+  p.n = spec.n;
+  p.start = rank * spec.n / numRanks;
+  p.end = (rank + 1) * spec.n / numRanks;
+  size_t count = p.end - p.start;
+  for (auto *v : {&p.ix, &p.iy, &p.iz, &p.px, &p.py, &p.pz})
+    v->resize(count);
+
+  auto [rx, ry, rz] = spec.rotation;
+  bool rotated = rx != 0 || ry != 0 || rz != 0;
+  double cx = std::cos(rx), sx = std::sin(rx);
+  double cy = std::cos(ry), sy = std::sin(ry);
+  double cz = std::cos(rz), sz = std::sin(rz);
+  // R = Rz * Ry * Rx
+  const double R[3][3] = {
+      {cz * cy, cz * sy * sx - sz * cx, cz * sy * cx + sz * sx},
+      {sz * cy, sz * sy * sx + cz * cx, sz * sy * cx - cz * sx},
+      {-sy, cy * sx, cy * cx}};
+
+  std::vector<char> keep(oob == OutOfBounds::remove ? count : 0, 1);
+
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < count; ++i) {
+    size_t gid = p.start + i;
+    CounterRng shape(seed, gid, 0);
+    auto x = drawInitial(spec.kind, shape);
+
+    if (rotated) {
+      std::array<double, 3> r;
+      for (int d = 0; d < 3; ++d)
+        r[d] = R[d][0] * x[0] + R[d][1] * x[1] + R[d][2] * x[2];
+      x = r;
+      for (int d = 0; d < 3; ++d) {
+        if (oob == OutOfBounds::remove && std::abs(x[d]) > 1)
+          keep[i] = 0;
+        x[d] = std::clamp(x[d], -1.0, 1.0);
+      }
+    }
+
+    CounterRng perturb(seed, gid, 1);
+    p.ix[i] = T(x[0]);
+    p.iy[i] = T(x[1]);
+    p.iz[i] = T(x[2]);
+    p.px[i] = T(perturb.uniform(-spec.scale, spec.scale));
+    p.py[i] = T(perturb.uniform(-spec.scale, spec.scale));
+    p.pz[i] = T(perturb.uniform(-spec.scale, spec.scale));
+  }
+
+  if (!keep.empty()) {
+    size_t j = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (!keep[i])
+        continue;
+      p.ix[j] = p.ix[i], p.iy[j] = p.iy[i], p.iz[j] = p.iz[i];
+      p.px[j] = p.px[i], p.py[j] = p.py[i], p.pz[j] = p.pz[i];
+      ++j;
+    }
+    for (auto *v : {&p.ix, &p.iy, &p.iz, &p.px, &p.py, &p.pz})
+      v->resize(j);
+    p.end = p.start + j;
+    p.n -= count - j;
+  }
+  return p;
+}
+
+/*! @brief set start, end and n of @p p after particles were dropped, from
+ *         the slice sizes of all ranks
+ *
+ * @p offset is the number of particles on lower ranks, @p total the number
+ * on all ranks, e.g. from an exclusive scan and a sum over the slice sizes.
+ */
+template <std::floating_point T>
+void renumberSlice(ParticleSlice<T> &p, size_t offset, size_t total) {
+  p.start = offset;
+  p.end = offset + p.ix.size();
+  p.n = total;
+}
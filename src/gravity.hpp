@@ -0,0 +1,272 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "cstone/focus/source_center.hpp"
+#include "tree_boxes.hpp"
+
+/*! @brief expansion centers and quadrupoles of every linked node, indexed
+ *         like the OctreeView
+ *
+ * centers holds cstone's SourceCenterType: the center of mass in [0, 3) and,
+ * after setMac, the squared mac radius in [3]. setMac overwrites the node
+ * mass, so it is kept in mass. quadrupole holds the independent entries xx,
+ * xy, xz, yy, yz, zz of the traceless sum m (3 s s^T - |s|^2 I), s relative
+ * to the center of mass.
+ */
+template <class T> struct SourceCenters {
+  std::vector<cstone::SourceCenterType<T>> centers;
+  std::vector<T> mass;
+  std::vector<std::array<T, 6>> quadrupole;
+};
+
+namespace detail {
+
+//! @brief add the quadrupole of mass m at offset (dx, dy, dz) to @p q
+template <class T>
+void addQuadrupole(std::array<T, 6> &q, double m, double dx, double dy,
+                   double dz) {
+  double r2 = dx * dx + dy * dy + dz * dz;
+  q[0] += T(m * (3 * dx * dx - r2));
+  q[1] += T(m * 3 * dx * dy);
+  q[2] += T(m * 3 * dx * dz);
+  q[3] += T(m * (3 * dy * dy - r2));
+  q[4] += T(m * 3 * dy * dz);
+  q[5] += T(m * (3 * dz * dz - r2));
+}
+
+} // namespace detail
+
+/*! @brief centers of mass, quadrupoles and mac radii of all nodes for
+ *         particles of mass @p m
+ *
+ * The centers come from cstone's leaf mass centers and upsweep. Leaves then
+ * sum the quadrupoles of their particles about the leaf center, and the
+ * levels are swept from the deepest up, each level in parallel, shifting the
+ * children's quadrupoles to the parent's center. setMac sets the mac radius
+ * l / theta + delta, with l the edge length of the node's SFC cell and delta
+ * the distance from the center of mass to the cell center, so that
+ * off-center masses are opened earlier.
+ */
+template <class T, class View>
+SourceCenters<T>
+computeSourceCenters(const View &tree,
+                     std::span<const cstone::LocalIndex> layout,
+                     const cstone::Box<T> &box, const T *x, const T *y,
+                     const T *z, T m, float theta) {
+  using cstone::TreeNodeIndex;
+  using KeyType =
+      std::remove_const_t<std::remove_pointer_t<decltype(tree.prefixes)>>;
+  size_t np = layout.back();
+  std::vector<T> masses(np, m);
+
+  SourceCenters<T> sc;
+  sc.centers.resize(tree.numNodes);
+  cstone::computeLeafMassCenter<T, T, T>(
+      {x, np}, {y, np}, {z, np}, masses,
+      {tree.leafToInternal + tree.numInternalNodes, size_t(tree.numLeafNodes)},
+      layout.data(), sc.centers.data());
+  cstone::upsweepMassCenter<T>(
+      {tree.levelRange, size_t(cstone::maxTreeLevel<KeyType>{} + 2)},
+      tree.childOffsets, sc.centers.data());
+
+  sc.mass.resize(tree.numNodes);
+  for (TreeNodeIndex i = 0; i < tree.numNodes; ++i)
+    sc.mass[i] = sc.centers[i][3];
+
+  sc.quadrupole.assign(tree.numNodes, {});
+#pragma omp parallel for schedule(dynamic, 256)
+  for (TreeNodeIndex i = 0; i < tree.numNodes; ++i) {
+    cstone::LocalIndex first, last;
+    if (!leafRange(tree, layout, i, first, last))
+      continue;
+    const auto &c = sc.centers[i];
+    for (cstone::LocalIndex j = first; j < last; ++j)
+      detail::addQuadrupole(sc.quadrupole[i], m, x[j] - c[0], y[j] - c[1],
+                            z[j] - c[2]);
+  }
+
+  constexpr int maxLevel = cstone::maxTreeLevel<KeyType>{};
+  for (int level = maxLevel - 1; level >= 0; --level) {
+#pragma omp parallel for schedule(static)
+    for (TreeNodeIndex i = tree.levelRange[level];
+         i < tree.levelRange[level + 1]; ++i) {
+      TreeNodeIndex child = tree.childOffsets[i];
+      if (child == 0 || sc.mass[i] == 0)
+        continue;
+      const auto &c = sc.centers[i];
+      for (TreeNodeIndex k = child; k < child + 8; ++k) {
+        const auto &ck = sc.centers[k];
+        for (int e = 0; e < 6; ++e)
+          sc.quadrupole[i][e] += sc.quadrupole[k][e];
+        detail::addQuadrupole(sc.quadrupole[i], sc.mass[k], ck[0] - c[0],
+                              ck[1] - c[1], ck[2] - c[2]);
+      }
+    }
+  }
+  cstone::setMac<T, KeyType>({tree.prefixes, size_t(tree.numNodes)},
+                             sc.centers, 1.0f / theta, box);
+  return sc;
+}
+
+//! @brief accelerations of all particles, with G = 1
+template <class T> struct GravityResult {
+  std::vector<T> ax, ay, az;
+  //! particle-particle and multipole-particle interactions evaluated
+  uint64_t p2p = 0, m2p = 0;
+
+  uint64_t interactions() const { return p2p + m2p; }
+};
+
+namespace detail {
+
+//! @brief softened accelerations on targets [first, last) by sources [sFirst, sLast)
+template <class T>
+void p2p(const T *x, const T *y, const T *z, T m, T eps2,
+         cstone::LocalIndex first, cstone::LocalIndex last,
+         cstone::LocalIndex sFirst, cstone::LocalIndex sLast, T *ax, T *ay,
+         T *az) {
+  for (cstone::LocalIndex i = first; i < last; ++i) {
+    T axi = 0, ayi = 0, azi = 0;
+#pragma omp simd reduction(+ : axi, ayi, azi)
+    for (cstone::LocalIndex j = sFirst; j < sLast; ++j) {
+      T dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+      T r2 = dx * dx + dy * dy + dz * dz + eps2;
+      // the self term has dx = 0 and contributes nothing unless eps = 0
+      T invR = r2 > 0 ? T(1) / std::sqrt(r2) : T(0);
+      T w = m * invR * invR * invR;
+      axi += w * dx, ayi += w * dy, azi += w * dz;
+    }
+    ax[i - first] += axi, ay[i - first] += ayi, az[i - first] += azi;
+  }
+}
+
+//! @brief monopole + quadrupole accelerations of mass @p mass at @p c with
+//!        quadrupole @p q on [first, last)
+template <class T>
+void m2p(const cstone::SourceCenterType<T> &c, T mass,
+         const std::array<T, 6> &q, const T *x, const T *y, const T *z,
+         cstone::LocalIndex first, cstone::LocalIndex last, T *ax, T *ay,
+         T *az) {
+#pragma omp simd
+  for (cstone::LocalIndex i = first; i < last; ++i) {
+    T dx = x[i] - c[0], dy = y[i] - c[1], dz = z[i] - c[2];
+    T r2 = dx * dx + dy * dy + dz * dz;
+    T invR = T(1) / std::sqrt(r2);
+    T invR2 = invR * invR;
+    T invR3 = invR * invR2;
+    T invR5 = invR3 * invR2;
+    T qx = q[0] * dx + q[1] * dy + q[2] * dz;
+    T qy = q[1] * dx + q[3] * dy + q[4] * dz;
+    T qz = q[2] * dx + q[4] * dy + q[5] * dz;
+    T dqd = dx * qx + dy * qy + dz * qz;
+    T radial = -mass * invR3 - T(2.5) * dqd * invR5 * invR2;
+    ax[i - first] += radial * dx + qx * invR5;
+    ay[i - first] += radial * dy + qy * invR5;
+    az[i - first] += radial * dz + qz * invR5;
+  }
+}
+
+} // namespace detail
+
+/*! @brief Barnes-Hut accelerations of all particles of mass @p m
+ *
+ * The particles of a leaf are one target group that walks the tree once. A
+ * node whose mac sphere does not reach the group's bounding box, cstone's
+ * evaluateMac test, is applied to the whole group as monopole and
+ * quadrupole, other leaves
+ * interact directly with Plummer softening @p eps.
+ */
+template <class T, class View, class IndexType>
+GravityResult<T> computeGravity(const T *x, const T *y, const T *z, T m,
+                                T eps, const View &tree,
+                                std::span<const IndexType> layout,
+                                std::span<const NodeBox<T>> boxes,
+                                const SourceCenters<T> &sources) {
+  using cstone::LocalIndex;
+  using cstone::TreeNodeIndex;
+  size_t np = layout.back();
+
+  GravityResult<T> result;
+  result.ax.assign(np, 0);
+  result.ay.assign(np, 0);
+  result.az.assign(np, 0);
+
+  std::vector<TreeNodeIndex> targets;
+  for (TreeNodeIndex i = 0; i < tree.numNodes; ++i) {
+    if (tree.childOffsets[i] == 0)
+      targets.push_back(i);
+  }
+
+  uint64_t numP2p = 0, numM2p = 0;
+#pragma omp parallel reduction(+ : numP2p, numM2p)
+  {
+    std::vector<TreeNodeIndex> stack;
+
+#pragma omp for schedule(dynamic)
+    for (size_t t = 0; t < targets.size(); ++t) {
+      IndexType gFirst, gLast;
+      leafRange(tree, layout, targets[t], gFirst, gLast);
+      if (gFirst == gLast)
+        continue;
+      const NodeBox<T> &groupBox = boxes[targets[t]];
+      T *ax = result.ax.data() + gFirst;
+      T *ay = result.ay.data() + gFirst;
+      T *az = result.az.data() + gFirst;
+
+      stack.assign(1, 0);
+      while (!stack.empty()) {
+        TreeNodeIndex node = stack.back();
+        stack.pop_back();
+        T mass = sources.mass[node];
+        if (mass == 0)
+          continue;
+
+        const cstone::SourceCenterType<T> &c = sources.centers[node];
+        if (groupBox.minDistSq(c[0], c[1], c[2]) >= c[3]) {
+          detail::m2p(c, mass, sources.quadrupole[node], x, y, z, gFirst,
+                      gLast, ax, ay, az);
+          numM2p += gLast - gFirst;
+          continue;
+        }
+        TreeNodeIndex child = tree.childOffsets[node];
+        if (child != 0) {
+          for (int k = 0; k < 8; ++k)
+            stack.push_back(child + k);
+          continue;
+        }
+        IndexType first, last;
+        leafRange(tree, layout, node, first, last);
+        detail::p2p(x, y, z, m, eps * eps, gFirst, gLast, first, last, ax, ay,
+                    az);
+        numP2p += uint64_t(gLast - gFirst) * (last - first);
+      }
+    }
+  }
+  result.p2p = numP2p;
+  result.m2p = numM2p;
+  return result;
+}
+
+/*! @brief direct-sum acceleration of particle @p i, the reference for the
+ *         multipole error at a given theta
+ */
+template <class T>
+void directAcceleration(size_t i, const T *x, const T *y, const T *z, T m,
+                        T eps, size_t np, double &ax, double &ay, double &az) {
+  ax = ay = az = 0;
+  for (size_t j = 0; j < np; ++j) {
+    double dx = double(x[j]) - x[i], dy = double(y[j]) - y[i],
+           dz = double(z[j]) - z[i];
+    double r2 = dx * dx + dy * dy + dz * dz + double(eps) * eps;
+    if (r2 == 0)
+      continue;
+    double w = m / (r2 * std::sqrt(r2));
+    ax += w * dx, ay += w * dy, az += w * dz;
+  }
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <mpi.h>
+
+#include "cstone/sfc/box.hpp"
+#include "cstone/sfc/sfc.hpp"
+#include "compress.hpp"
+#include "partition.hpp"
+#include "tree_boxes.hpp"
+
+/*! @brief split-phase exchange of halo coordinates between SFC rank domains
+ *
+ * Local particle i is sent to every rank that has a particle within
+ * @p radius, found by pruning pairs of chunk boxes: each rank cuts its
+ * SFC-sorted particles into @p numChunks chunks and the bounding boxes of all
+ * chunks are allgathered. With one search radius for all particles the sent
+ * particles are exactly the halos the other ranks' searches can reach, and
+ * the particles sent nowhere are interior, their searches need no halos.
+ *
+ * start() posts the nonblocking sends and receives and returns, so that the
+ * caller can search the interior while the messages are in flight; finish()
+ * waits and appends the halos. An optional @p codec compresses the messages.
+ */
+template <class KeyType, class T> class HaloExchange {
+public:
+  HaloExchange(const std::vector<T> &x, const std::vector<T> &y,
+               const std::vector<T> &z, T radius, MPI_Comm comm,
+               ExchangeCodec *codec = nullptr, int numChunks = 64)
+      : comm_(comm), numLocal_(x.size()), codec_(codec) {
+    int rank, numRanks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &numRanks);
+
+    cstone::Box<T> box = globalBox(x, y, z, comm);
+    std::vector<KeyType> keys(numLocal_);
+    cstone::computeSfcKeys(x.data(), y.data(), z.data(),
+                           cstone::sfcKindPointer(keys.data()), numLocal_, box);
+    std::vector<cstone::LocalIndex> order(numLocal_);
+    std::iota(order.begin(), order.end(), cstone::LocalIndex(0));
+    std::sort(order.begin(), order.end(),
+              [&](auto a, auto b) { return keys[a] < keys[b]; });
+
+    int localChunks = int(std::min<size_t>(numChunks, numLocal_));
+    std::vector<NodeBox<T>> chunks(localChunks);
+    auto chunkFirst = [&](int c) { return numLocal_ * c / localChunks; };
+#pragma omp parallel for schedule(static)
+    for (int c = 0; c < localChunks; ++c)
+      for (size_t k = chunkFirst(c); k < chunkFirst(c + 1); ++k)
+        chunks[c].add(x[order[k]], y[order[k]], z[order[k]]);
+
+    std::vector<int> counts(numRanks), displs(numRanks);
+    MPI_Allgather(&localChunks, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+    std::exclusive_scan(counts.begin(), counts.end(), displs.begin(), 0);
+    std::vector<NodeBox<T>> allChunks(displs.back() + counts.back());
+    std::vector<int> byteCounts(numRanks), byteDispls(numRanks);
+    for (int q = 0; q < numRanks; ++q) {
+      byteCounts[q] = counts[q] * int(sizeof(NodeBox<T>));
+      byteDispls[q] = displs[q] * int(sizeof(NodeBox<T>));
+    }
+    MPI_Allgatherv(chunks.data(), localChunks * int(sizeof(NodeBox<T>)),
+                   MPI_BYTE, allChunks.data(), byteCounts.data(),
+                   byteDispls.data(), MPI_BYTE, comm);
+
+    // (rank, particle) pairs per chunk, particles in SFC order
+    T r2 = radius * radius;
+    std::vector<std::vector<std::pair<int, cstone::LocalIndex>>> chunkSends(
+        localChunks);
+#pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < localChunks; ++c) {
+      std::vector<int> near;
+      for (int q = 0; q < numRanks; ++q) {
+        if (q == rank)
+          continue;
+        for (int d = displs[q]; d < displs[q] + counts[q]; ++d)
+          if (chunks[c].minDistSq(allChunks[d]) <= r2)
+            near.push_back(d);
+      }
+      if (near.empty())
+        continue;
+      for (size_t k = chunkFirst(c); k < chunkFirst(c + 1); ++k) {
+        cstone::LocalIndex i = order[k];
+        int lastRank = -1;
+        for (int d : near) {
+          int q = int(std::upper_bound(displs.begin(), displs.end(), d) -
+                      displs.begin()) - 1;
+          if (q != lastRank && allChunks[d].minDistSq(x[i], y[i], z[i]) <= r2) {
+            chunkSends[c].emplace_back(q, i);
+            lastRank = q;
+          }
+        }
+      }
+    }
+
+    sendLists_.resize(numRanks);
+    std::vector<char> sent(numLocal_, 0);
+    for (auto &pairs : chunkSends)
+      for (auto [q, i] : pairs) {
+        sendLists_[q].push_back(i);
+        sent[i] = 1;
+      }
+    for (cstone::LocalIndex i = 0; i < numLocal_; ++i)
+      (sent[i] ? boundary_ : interior_).push_back(i);
+
+    std::vector<int> sendCounts(numRanks);
+    recvCounts_.resize(numRanks);
+    for (int q = 0; q < numRanks; ++q)
+      sendCounts[q] = int(sendLists_[q].size());
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts_.data(), 1, MPI_INT,
+                 comm);
+    recvDispls_.resize(numRanks);
+    std::exclusive_scan(recvCounts_.begin(), recvCounts_.end(),
+                        recvDispls_.begin(), 0);
+    numHalos_ = recvDispls_.back() + recvCounts_.back();
+  }
+
+  size_t numHalos() const { return numHalos_; }
+
+  //! @brief local particles sent to no rank, and those sent to some
+  std::span<const cstone::LocalIndex> interior() const { return interior_; }
+  std::span<const cstone::LocalIndex> boundary() const { return boundary_; }
+
+  /*! @brief pack the halo coordinates and post all sends and receives
+   *
+   * Each message is a flag byte and the x, y, z columns, XOR-compressed if
+   * the codec decides so and the result is smaller, raw otherwise. Receive
+   * buffers are sized for the raw message.
+   */
+  void start(const T *x, const T *y, const T *z) {
+    int numRanks = int(sendLists_.size());
+    sendBufs_.resize(numRanks);
+    recvBufs_.resize(numRanks);
+    requests_.clear();
+    for (int q = 0; q < numRanks; ++q) {
+      if (recvCounts_[q] == 0)
+        continue;
+      recvBufs_[q].resize(1 + 3 * recvCounts_[q] * sizeof(T));
+      requests_.emplace_back();
+      MPI_Irecv(recvBufs_[q].data(), int(recvBufs_[q].size()), MPI_BYTE, q, 0,
+                comm_, &requests_.back());
+    }
+    auto tEncode = std::chrono::steady_clock::now();
+    std::vector<T> col;
+    for (int q = 0; q < numRanks; ++q) {
+      const auto &list = sendLists_[q];
+      if (list.empty())
+        continue;
+      size_t raw = 3 * list.size() * sizeof(T);
+      auto t = std::chrono::steady_clock::now();
+      bool encode = codec_ && codec_->floats && codec_->compress(raw);
+      auto &buf = sendBufs_[q];
+      for (int pass = 0; pass < 2; ++pass) {
+        buf.assign(1, encode ? ExchangeCodec::floatsFlag : 0);
+        col.resize(list.size());
+        for (const T *c : {x, y, z}) {
+          for (size_t k = 0; k < list.size(); ++k)
+            col[k] = c[list[k]];
+          appendColumn(col.data(), col.size(), encode, buf);
+        }
+        if (!encode || buf.size() <= 1 + raw)
+          break;
+        encode = false;
+      }
+      if (codec_) {
+        codec_->rawBytes += raw;
+        codec_->wireBytes += buf.size();
+        // decoding costs about as much as encoding
+        if (encode)
+          codec_->learn(raw, buf.size(),
+                        2 * std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count());
+      }
+      requests_.emplace_back();
+      MPI_Isend(buf.data(), int(buf.size()), MPI_BYTE, q, 0, comm_,
+                &requests_.back());
+    }
+    if (codec_)
+      codec_->encodeSeconds +=
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - tEncode).count();
+  }
+
+  /*! @brief wait for the exchange posted by start() and append the halos,
+   *         ordered by source rank, after the first numLocal elements
+   */
+  void finish(std::vector<T> &x, std::vector<T> &y, std::vector<T> &z) {
+    MPI_Waitall(int(requests_.size()), requests_.data(), MPI_STATUSES_IGNORE);
+    auto tDecode = std::chrono::steady_clock::now();
+    x.resize(numLocal_ + numHalos_);
+    y.resize(numLocal_ + numHalos_);
+    z.resize(numLocal_ + numHalos_);
+    for (size_t q = 0; q < recvBufs_.size(); ++q) {
+      if (recvCounts_[q] == 0)
+        continue;
+      const uint8_t *in = recvBufs_[q].data();
+      bool encoded = *in++ & ExchangeCodec::floatsFlag;
+      size_t first = numLocal_ + recvDispls_[q], n = recvCounts_[q];
+      for (std::vector<T> *c : {&x, &y, &z})
+        in = readColumn(in, n, encoded, c->data() + first);
+    }
+    if (codec_)
+      codec_->decodeSeconds +=
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - tDecode).count();
+  }
+
+private:
+  MPI_Comm comm_;
+  size_t numLocal_;
+  size_t numHalos_ = 0;
+  std::vector<std::vector<cstone::LocalIndex>> sendLists_;
+  std::vector<int> recvCounts_, recvDispls_;
+  std::vector<cstone::LocalIndex> interior_, boundary_;
+  ExchangeCodec *codec_;
+  std::vector<std::vector<uint8_t>> sendBufs_, recvBufs_;
+  std::vector<MPI_Request> requests_;
+};
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*! @brief minimal streaming JSON writer for the benchmark records
+ *
+ * Commas are inserted automatically; keys are only valid inside objects.
+ * Non-finite numbers are written as null.
+ */
+class JsonWriter {
+public:
+  explicit JsonWriter(std::ostream &out) : out_(out) {}
+
+  JsonWriter &beginObject() {
+    separate();
+    out_ << '{';
+    first_.push_back(true);
+    return *this;
+  }
+
+  JsonWriter &endObject() {
+    first_.pop_back();
+    out_ << '}';
+    return *this;
+  }
+
+  JsonWriter &beginArray() {
+    separate();
+    out_ << '[';
+    first_.push_back(true);
+    return *this;
+  }
+
+  JsonWriter &endArray() {
+    first_.pop_back();
+    out_ << ']';
+    return *this;
+  }
+
+  JsonWriter &key(const std::string &k) {
+    separate();
+    writeString(k);
+    out_ << ':';
+    afterKey_ = true;
+    return *this;
+  }
+
+  JsonWriter &value(const std::string &v) {
+    separate();
+    writeString(v);
+    return *this;
+  }
+
+  JsonWriter &value(const char *v) { return value(std::string(v)); }
+
+  JsonWriter &value(bool v) {
+    separate();
+    out_ << (v ? "true" : "false");
+    return *this;
+  }
+
+  template <class T>
+    requires std::is_arithmetic_v<T>
+  JsonWriter &value(T v) {
+    separate();
+    if constexpr (std::is_floating_point_v<T>) {
+      if (!std::isfinite(v)) {
+        out_ << "null";
+        return *this;
+      }
+      char buf[32];
+      std::snprintf(buf, sizeof(buf), "%.17g", double(v));
+      out_ << buf;
+    } else {
+      out_ << v;
+    }
+    return *this;
+  }
+
+  JsonWriter &null() {
+    separate();
+    out_ << "null";
+    return *this;
+  }
+
+  template <class T> JsonWriter &field(const std::string &k, const T &v) {
+    key(k);
+    return value(v);
+  }
+
+  template <class T>
+  JsonWriter &array(const std::string &k, const std::vector<T> &v) {
+    key(k);
+    beginArray();
+    for (const auto &x : v)
+      value(x);
+    return endArray();
+  }
+
+private:
+  void separate() {
+    if (afterKey_) {
+      afterKey_ = false;
+      return;
+    }
+    if (!first_.empty()) {
+      if (!first_.back())
+        out_ << ',';
+      first_.back() = false;
+    }
+  }
+
+  void writeString(const std::string &s) {
+    out_ << '"';
+    for (char c : s) {
+      switch (c) {
+      case '"':
+        out_ << "\\\"";
+        break;
+      case '\\':
+        out_ << "\\\\";
+        break;
+      case '\n':
+        out_ << "\\n";
+        break;
+      case '\t':
+        out_ << "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out_ << buf;
+        } else {
+          out_ << c;
+        }
+      }
+    }
+    out_ << '"';
+  }
+
+  std::ostream &out_;
+  std::vector<bool> first_;
+  bool afterKey_ = false;
+};
+
+/*! @brief parsed JSON document, enough to read back what JsonWriter wrote
+ *
+ * Objects keep their members in file order. Throws std::runtime_error on
+ * malformed input.
+ */
+struct JsonValue {
+  enum class Type { null, boolean, number, string, array, object };
+
+  Type type = Type::null;
+  bool boolean = false;
+  double number = 0;
+  std::string string;
+  std::vector<JsonValue> array;
+  std::vector<std::pair<std::string, JsonValue>> object;
+
+  bool isObject() const { return type == Type::object; }
+  bool isNumber() const { return type == Type::number; }
+
+  //! @brief member @p k of an object, nullptr if absent
+  const JsonValue *find(const std::string &k) const {
+    for (const auto &[name, v] : object) {
+      if (name == k)
+        return &v;
+    }
+    return nullptr;
+  }
+
+  //! @brief numeric member @p k, or @p fallback if absent or not a number
+  double numberOr(const std::string &k, double fallback) const {
+    const JsonValue *v = find(k);
+    return v && v->isNumber() ? v->number : fallback;
+  }
+};
+
+class JsonParser {
+public:
+  explicit JsonParser(const std::string &text) : s_(text) {}
+
+  JsonValue parse() {
+    JsonValue v = parseValue();
+    skipSpace();
+    if (pos_ != s_.size())
+      fail("trailing characters");
+    return v;
+  }
+
+private:
+  [[noreturn]] void fail(const std::string &why) const {
+    throw std::runtime_error("JSON parse error at offset " +
+                             std::to_string(pos_) + ": " + why);
+  }
+
+  void skipSpace() {
+    while (pos_ < s_.size() &&
+           std::isspace(static_cast<unsigned char>(s_[pos_])))
+      ++pos_;
+  }
+
+  bool consume(char c) {
+    skipSpace();
+    if (pos_ < s_.size() && s_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  void expect(char c) {
+    if (!consume(c))
+      fail(std::string("expected '") + c + "'");
+  }
+
+  bool literal(const char *word) {
+    size_t len = std::char_traits<char>::length(word);
+    if (s_.compare(pos_, len, word) == 0) {
+      pos_ += len;
+      return true;
+    }
+    return false;
+  }
+
+  std::string parseString() {
+    expect('"');
+    std::string out;
+    while (pos_ < s_.size() && s_[pos_] != '"') {
+      char c = s_[pos_++];
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
+      if (pos_ >= s_.size())
+        fail("unterminated escape");
+      char e = s_[pos_++];
+      switch (e) {
+      case 'n':
+        out += '\n';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'u': {
+        if (pos_ + 4 > s_.size())
+          fail("short \\u escape");
+        unsigned code = std::stoul(s_.substr(pos_, 4), nullptr, 16);
+        pos_ += 4;
+        // the records only escape control characters
+        out += code < 0x80 ? char(code) : '?';
+        break;
+      }
+      default:
+        out += e;
+      }
+    }
+    if (pos_ >= s_.size())
+      fail("unterminated string");
+    ++pos_;
+    return out;
+  }
+
+  JsonValue parseValue() {
+    skipSpace();
+    if (pos_ >= s_.size())
+      fail("unexpected end of input");
+
+    JsonValue v;
+    char c = s_[pos_];
+    if (c == '{') {
+      ++pos_;
+      v.type = JsonValue::Type::object;
+      if (consume('}'))
+        return v;
+      do {
+        skipSpace();
+        std::string k = parseString();
+        expect(':');
+        v.object.emplace_back(std::move(k), parseValue());
+      } while (consume(','));
+      expect('}');
+    } else if (c == '[') {
+      ++pos_;
+      v.type = JsonValue::Type::array;
+      if (consume(']'))
+        return v;
+      do {
+        v.array.push_back(parseValue());
+      } while (consume(','));
+      expect(']');
+    } else if (c == '"') {
+      v.type = JsonValue::Type::string;
+      v.string = parseString();
+    } else if (literal("true")) {
+      v.type = JsonValue::Type::boolean;
+      v.boolean = true;
+    } else if (literal("false")) {
+      v.type = JsonValue::Type::boolean;
+    } else if (literal("null")) {
+      v.type = JsonValue::Type::null;
+    } else {
+      size_t used = 0;
+      try {
+        v.number = std::stod(s_.substr(pos_, 32), &used);
+      } catch (const std::exception &) {
+        fail("invalid value");
+      }
+      v.type = JsonValue::Type::number;
+      pos_ += used;
+    }
+    return v;
+  }
+
+  const std::string &s_;
+  size_t pos_ = 0;
+};
+
+inline JsonValue parseJson(const std::string &text) {
+  return JsonParser(text).parse();
+}
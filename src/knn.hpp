@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "tree_boxes.hpp"
+
+/*! @brief the k nearest neighbors of every particle, excluding itself
+ *
+ * Row i holds indices[i * k, (i + 1) * k) sorted by ascending distance, with
+ * the squared distances alongside. Rows of groups with fewer than k other
+ * particles are padded with index ~0 at infinite distance.
+ */
+template <class T> struct KnnResult {
+  unsigned k = 0;
+  std::vector<cstone::LocalIndex> indices;
+  std::vector<T> distSq;
+  //! candidate distances evaluated, a measure of pruning efficiency
+  uint64_t distanceEvaluations = 0;
+};
+
+/*! @brief fixed-capacity max-heap on the squared distance
+ *
+ * Operates on one row of a KnnResult; the root is the current k-th nearest,
+ * the radius that all further candidates must beat.
+ */
+template <class T> class KnnHeap {
+public:
+  KnnHeap(T *dist, cstone::LocalIndex *idx, unsigned k)
+      : dist_(dist), idx_(idx), k_(k) {
+    std::fill(dist_, dist_ + k_, std::numeric_limits<T>::infinity());
+    std::fill(idx_, idx_ + k_, ~cstone::LocalIndex(0));
+  }
+
+  T top() const { return dist_[0]; }
+
+  //! @brief replace the root with a closer candidate and sift it down
+  void replaceTop(T d, cstone::LocalIndex j) {
+    unsigned i = 0;
+    while (true) {
+      unsigned l = 2 * i + 1, r = l + 1, m = i;
+      T dm = d;
+      if (l < k_ && dist_[l] > dm)
+        m = l, dm = dist_[l];
+      if (r < k_ && dist_[r] > dm)
+        m = r, dm = dist_[r];
+      if (m == i)
+        break;
+      dist_[i] = dist_[m];
+      idx_[i] = idx_[m];
+      i = m;
+    }
+    dist_[i] = d;
+    idx_[i] = j;
+  }
+
+  //! @brief sort the row by ascending distance, the heap is unusable after
+  void finish() {
+    std::vector<std::pair<T, cstone::LocalIndex>> row(k_);
+    for (unsigned i = 0; i < k_; ++i)
+      row[i] = {dist_[i], idx_[i]};
+    std::sort(row.begin(), row.end());
+    for (unsigned i = 0; i < k_; ++i)
+      std::tie(dist_[i], idx_[i]) = row[i];
+  }
+
+private:
+  T *dist_;
+  cstone::LocalIndex *idx_;
+  unsigned k_;
+};
+
+namespace detail {
+
+//! @brief squared distances from (qx, qy, qz) to particles [first, last)
+template <class T>
+void distancesSq(T qx, T qy, T qz, const T *x, const T *y, const T *z,
+                 cstone::LocalIndex first, cstone::LocalIndex last, T *out) {
+#pragma omp simd
+  for (cstone::LocalIndex j = first; j < last; ++j) {
+    T dx = x[j] - qx;
+    T dy = y[j] - qy;
+    T dz = z[j] - qz;
+    out[j - first] = dx * dx + dy * dy + dz * dz;
+  }
+}
+
+} // namespace detail
+
+/*! @brief k nearest neighbors of all particles, one leaf at a time
+ *
+ * The particles of a target leaf are one query group. The group walks the
+ * tree once, nearest child first, and a node is pruned when its bounding box
+ * is farther from the group's box than the largest k-th distance in the
+ * group. Inside a candidate leaf each query that cannot be pruned by its own
+ * k-th distance evaluates all distances in one SIMD pass over the SoA
+ * coordinates, then offers the closer ones to its heap.
+ */
+template <class T, class View, class IndexType>
+KnnResult<T> findKnn(const T *x, const T *y, const T *z, const View &tree,
+                     std::span<const IndexType> layout,
+                     std::span<const NodeBox<T>> boxes, unsigned k) {
+  using cstone::LocalIndex;
+  using cstone::TreeNodeIndex;
+  size_t np = layout.back();
+
+  KnnResult<T> result;
+  result.k = k;
+  result.indices.resize(np * k);
+  result.distSq.resize(np * k);
+
+  // targets are the tree leaves, in linked order
+  std::vector<TreeNodeIndex> targets;
+  for (TreeNodeIndex i = 0; i < tree.numNodes; ++i) {
+    if (tree.childOffsets[i] == 0)
+      targets.push_back(i);
+  }
+
+  uint64_t evaluations = 0;
+#pragma omp parallel reduction(+ : evaluations)
+  {
+    std::vector<T> d2;
+    std::vector<TreeNodeIndex> stack;
+    std::vector<KnnHeap<T>> heaps;
+
+#pragma omp for schedule(dynamic)
+    for (size_t t = 0; t < targets.size(); ++t) {
+      IndexType gFirst, gLast;
+      leafRange(tree, layout, targets[t], gFirst, gLast);
+      if (gFirst == gLast)
+        continue;
+      const NodeBox<T> &groupBox = boxes[targets[t]];
+
+      heaps.clear();
+      for (LocalIndex q = gFirst; q < gLast; ++q)
+        heaps.emplace_back(result.distSq.data() + size_t(q) * k,
+                           result.indices.data() + size_t(q) * k, k);
+      // largest k-th distance of the group, shrinks after each leaf
+      T groupRadius = std::numeric_limits<T>::infinity();
+
+      stack.assign(1, 0);
+      while (!stack.empty()) {
+        TreeNodeIndex node = stack.back();
+        stack.pop_back();
+        if (groupBox.minDistSq(boxes[node]) > groupRadius)
+          continue;
+
+        TreeNodeIndex child = tree.childOffsets[node];
+        if (child != 0) {
+          // push the farthest child first so that the nearest is popped next
+          std::pair<T, TreeNodeIndex> order[8];
+          for (int c = 0; c < 8; ++c)
+            order[c] = {groupBox.minDistSq(boxes[child + c]), child + c};
+          std::sort(order, order + 8);
+          for (int c = 7; c >= 0; --c) {
+            if (!boxes[order[c].second].empty())
+              stack.push_back(order[c].second);
+          }
+          continue;
+        }
+
+        IndexType first, last;
+        leafRange(tree, layout, node, first, last);
+        d2.resize(last - first);
+        for (LocalIndex q = gFirst; q < gLast; ++q) {
+          KnnHeap<T> &heap = heaps[q - gFirst];
+          if (boxes[node].minDistSq(x[q], y[q], z[q]) > heap.top())
+            continue;
+          detail::distancesSq(x[q], y[q], z[q], x, y, z, first, last,
+                              d2.data());
+          evaluations += last - first;
+          for (LocalIndex j = first; j < last; ++j) {
+            if (d2[j - first] < heap.top() && j != q)
+              heap.replaceTop(d2[j - first], j);
+          }
+        }
+        groupRadius = 0;
+        for (const auto &h : heaps)
+          groupRadius = std::max(groupRadius, h.top());
+      }
+
+      for (auto &h : heaps)
+        h.finish();
+    }
+  }
+  result.distanceEvaluations = evaluations;
+  return result;
+}
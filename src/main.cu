@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 
+#include "memory.hpp"
 #include "pcah5.hpp"
 #include "runner.hpp"
 
@@ -13,18 +14,109 @@ namespace fs = std::filesystem;
 int main(int argc, char *argv[]) {
   auto printUsage = [&]() {
     std::cerr << "Usage: " << argv[0]
-              << " [--gpu] [--theta <value>] [--bucket-size-global <value>] "
-                 "[--bucket-size-focus <value>] <dataset filepath> <group "
-                 "names ...>"
+              << " [--gpu] [--lets] [--save] [--perf-counters] [--memory] "
+                 "[--roofline] [--validate] [--neighbors <ng>] [--adapt-h <ng>] "
+                 "[--knn <k>] [--ranges <n>] [--gravity] [--locate <n>] "
+                 "[--adjacency] [--pair-bins <n>] [--quantized <ng>] "
+                 "[--sfc-partition] "
+                 "[--slice-cost-balance <ng>] [--halo-overlap <ng>] "
+                 "[--hysteresis <tolerance>] [--shared-exchange] "
+                 "[--ranks-per-node <n>] "
+                 "[--compress keys,floats,adaptive] [--sync-model] "
+                 "[--checkpoint <dir>] "
+                 "[--theta <value>] [--bucket-size <value>] "
+                 "[--bucket-size-focus <value>] [--warmup <n>] [--trials <n>] "
+                 "[--ci-target <fraction>] [--max-trials <n>] "
+                 "[--json <path>] [--scaling strong|weak] [--threads "
+                 "<n,n,...>] [--n-per-core <n>] <dataset filepath> "
+                 "<group names ...>\n"
+              << "       " << argv[0]
+              << " --generate [--seed <value>] [--out-of-bounds "
+                 "truncate|remove] [options] <distribution specs ...>\n"
+                 "  spec: <dist>[_rx<deg>][_ry<deg>][_rz<deg>]_s<scale>_n<count>,"
+                 " e.g. filament_xyz_s0p01_n10m\n"
+                 "  --checkpoint: restores the particles of the initial sync, "
+                 "which still runs in full from their sorted layout"
               << std::endl;
   };
 
-  bool gpu = false;
-  bool lets = false;
-  bool save = false;
-  double theta = 0.6;
-  int bucketSize = 1024;
-  int bucketSizeFocus = 64;
+  // parse the value of option argv[i] with conv into out, false on error
+  auto parseValue = [&](int &i, const std::string &opt, auto conv,
+                        auto &out) -> bool {
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << opt << std::endl;
+      printUsage();
+      return false;
+    }
+    try {
+      out = conv(argv[++i]);
+    } catch (const std::exception &) {
+      std::cerr << "Invalid value for " << opt << ": " << argv[i] << std::endl;
+      return false;
+    }
+    return true;
+  };
+  auto toInt = [](const char *v) { return std::stoi(v); };
+  auto toFloat = [](const char *v) { return std::stof(v); };
+  auto toDouble = [](const char *v) { return std::stod(v); };
+  auto toString = [](const char *v) { return std::string(v); };
+  auto toSeed = [](const char *v) { return uint64_t(std::stoull(v)); };
+  auto toOutOfBounds = [](const char *v) {
+    std::string s(v);
+    if (s == "truncate")
+      return OutOfBounds::truncate;
+    if (s == "remove")
+      return OutOfBounds::remove;
+    throw std::invalid_argument(s);
+  };
+  auto toScaling = [](const char *v) {
+    std::string s(v);
+    if (s == "strong")
+      return ScalingMode::strong;
+    if (s == "weak")
+      return ScalingMode::weak;
+    throw std::invalid_argument(s);
+  };
+  auto toIntList = [](const char *v) {
+    std::vector<int> list;
+    std::string s(v);
+    size_t pos = 0;
+    while (pos < s.size()) {
+      size_t comma = s.find(',', pos);
+      if (comma == std::string::npos)
+        comma = s.size();
+      list.push_back(std::stoi(s.substr(pos, comma - pos)));
+      if (list.back() < 1)
+        throw std::invalid_argument(s);
+      pos = comma + 1;
+    }
+    return list;
+  };
+  auto toSize = [](const char *v) { return size_t(std::stoull(v)); };
+  auto toUnsigned = [](const char *v) { return unsigned(std::stoul(v)); };
+  auto toCompress = [](const char *v) {
+    CompressOptions options;
+    std::string s(v);
+    size_t pos = 0;
+    while (pos < s.size()) {
+      size_t comma = s.find(',', pos);
+      if (comma == std::string::npos)
+        comma = s.size();
+      std::string item = s.substr(pos, comma - pos);
+      if (item == "keys")
+        options.keys = true;
+      else if (item == "floats")
+        options.floats = true;
+      else if (item == "adaptive")
+        options.adaptive = true;
+      else
+        throw std::invalid_argument(s);
+      pos = comma + 1;
+    }
+    return options;
+  };
+
+  BenchConfig cfg;
 
   int positionalStart = 1;
   for (int i = 1; i < argc; ++i) {
@@ -34,50 +126,85 @@ int main(int argc, char *argv[]) {
       return 0;
     }
 
+    bool ok = true;
     if (arg == "--gpu") {
-      gpu = true;
+      cfg.gpu = true;
     } else if (arg == "--lets") {
-      lets = true;
+      cfg.lets = true;
     } else if (arg == "--save") {
-      save = true;
+      cfg.save = true;
+    } else if (arg == "--perf-counters") {
+      cfg.perfCounters = true;
+    } else if (arg == "--memory") {
+      cfg.memory = true;
+    } else if (arg == "--roofline") {
+      cfg.roofline = true;
+    } else if (arg == "--validate") {
+      cfg.validate = true;
+    } else if (arg == "--neighbors") {
+      ok = parseValue(i, arg, toUnsigned, cfg.queries.neighbors);
+    } else if (arg == "--adapt-h") {
+      ok = parseValue(i, arg, toUnsigned, cfg.queries.adaptH);
+    } else if (arg == "--knn") {
+      ok = parseValue(i, arg, toUnsigned, cfg.queries.knn);
+    } else if (arg == "--ranges") {
+      ok = parseValue(i, arg, toUnsigned, cfg.queries.ranges);
+    } else if (arg == "--gravity") {
+      cfg.queries.gravity = true;
+    } else if (arg == "--locate") {
+      ok = parseValue(i, arg, toUnsigned, cfg.queries.locate);
+    } else if (arg == "--adjacency") {
+      cfg.queries.adjacency = true;
+    } else if (arg == "--pair-bins") {
+      ok = parseValue(i, arg, toUnsigned, cfg.queries.pairBins);
+    } else if (arg == "--quantized") {
+      ok = parseValue(i, arg, toUnsigned, cfg.queries.quantized);
+    } else if (arg == "--sfc-partition") {
+      cfg.sfcPartition = true;
+    } else if (arg == "--slice-cost-balance") {
+      ok = parseValue(i, arg, toUnsigned, cfg.sliceCostBalance);
+    } else if (arg == "--halo-overlap") {
+      ok = parseValue(i, arg, toUnsigned, cfg.haloOverlap);
+    } else if (arg == "--hysteresis") {
+      ok = parseValue(i, arg, toDouble, cfg.hysteresis);
+    } else if (arg == "--shared-exchange") {
+      cfg.sharedExchange = true;
+    } else if (arg == "--ranks-per-node") {
+      ok = parseValue(i, arg, toInt, cfg.ranksPerNode);
+    } else if (arg == "--checkpoint") {
+      ok = parseValue(i, arg, toString, cfg.checkpointDir);
+    } else if (arg == "--sync-model") {
+      cfg.syncModel = true;
+    } else if (arg == "--compress") {
+      ok = parseValue(i, arg, toCompress, cfg.compress);
     } else if (arg == "--theta") {
-      if (i + 1 >= argc) {
-        std::cerr << "Missing value for --theta" << std::endl;
-        printUsage();
-        return 1;
-      }
-      try {
-        theta = std::stod(argv[++i]);
-      } catch (const std::exception &) {
-        std::cerr << "Invalid value for --theta: " << argv[i] << std::endl;
-        return 1;
-      }
+      ok = parseValue(i, arg, toFloat, cfg.theta);
     } else if (arg == "--bucket-size") {
-      if (i + 1 >= argc) {
-        std::cerr << "Missing value for --bucket-size-global" << std::endl;
-        printUsage();
-        return 1;
-      }
-      try {
-        bucketSize = std::stoi(argv[++i]);
-      } catch (const std::exception &) {
-        std::cerr << "Invalid value for --bucket-size: " << argv[i]
-                  << std::endl;
-        return 1;
-      }
+      ok = parseValue(i, arg, toInt, cfg.bucketSize);
     } else if (arg == "--bucket-size-focus") {
-      if (i + 1 >= argc) {
-        std::cerr << "Missing value for --bucket-size-focus" << std::endl;
-        printUsage();
-        return 1;
-      }
-      try {
-        bucketSizeFocus = std::stoi(argv[++i]);
-      } catch (const std::exception &) {
-        std::cerr << "Invalid value for --bucket-size-focus: " << argv[i]
-                  << std::endl;
-        return 1;
-      }
+      ok = parseValue(i, arg, toInt, cfg.bucketSizeFocus);
+    } else if (arg == "--warmup") {
+      ok = parseValue(i, arg, toInt, cfg.warmup);
+    } else if (arg == "--trials") {
+      ok = parseValue(i, arg, toInt, cfg.trials);
+    } else if (arg == "--ci-target") {
+      ok = parseValue(i, arg, toDouble, cfg.ciTarget);
+    } else if (arg == "--max-trials") {
+      ok = parseValue(i, arg, toInt, cfg.maxTrials);
+    } else if (arg == "--json") {
+      ok = parseValue(i, arg, toString, cfg.jsonPath);
+    } else if (arg == "--generate") {
+      cfg.generate = true;
+    } else if (arg == "--seed") {
+      ok = parseValue(i, arg, toSeed, cfg.seed);
+    } else if (arg == "--out-of-bounds") {
+      ok = parseValue(i, arg, toOutOfBounds, cfg.outOfBounds);
+    } else if (arg == "--scaling") {
+      ok = parseValue(i, arg, toScaling, cfg.scaling);
+    } else if (arg == "--threads") {
+      ok = parseValue(i, arg, toIntList, cfg.threadCounts);
+    } else if (arg == "--n-per-core") {
+      ok = parseValue(i, arg, toSize, cfg.nPerCore);
     } else if (!arg.empty() && arg[0] == '-') {
       std::cerr << "Unknown option: " << arg << std::endl;
       printUsage();
@@ -86,13 +213,36 @@ int main(int argc, char *argv[]) {
       positionalStart = i;
       break;
     }
+    if (!ok)
+      return 1;
+  }
+
+  if (cfg.warmup < 0 || cfg.trials < 1) {
+    std::cerr << "--warmup must be >= 0 and --trials >= 1" << std::endl;
+    return 1;
   }
 
-  if (positionalStart >= argc || positionalStart + 1 >= argc) {
+  // generated runs take specs only, file runs the dataset and then groups
+  int groupStart = cfg.generate ? positionalStart : positionalStart + 1;
+  if (positionalStart >= argc || groupStart >= argc) {
     printUsage();
     return 1;
   }
 
+  if (cfg.generate) {
+    for (int i = groupStart; i < argc; ++i) {
+      try {
+        parseDistributionSpec(argv[i]);
+      } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // the counting allocator only pays for itself when --memory reports it
+  setHeapTracking(cfg.memory);
+
   MPI_Init(&argc, &argv);
 
   int rank = 0, numRanks = 0;
@@ -107,6 +257,14 @@ int main(int argc, char *argv[]) {
   cudaSetDevice(rank);
   std::cout << "Rank " << rank << " setting device" << std::endl;
 
+  if (cfg.generate) {
+    for (int i = groupStart; i < argc; ++i) {
+      runnerGenerated(argv[i], rank, numRanks, cfg);
+    }
+    MPI_Finalize();
+    return 0;
+  }
+
   fs::path dataset_path(argv[positionalStart]);
   if (!fs::exists(dataset_path))
     throw std::runtime_error("Dataset file does not exist: " +
@@ -117,10 +275,9 @@ int main(int argc, char *argv[]) {
 
   HighFive::File file(dataset_path.string(), HighFive::File::ReadOnly);
 
-  for (int i = positionalStart + 1; i < argc; ++i) {
+  for (int i = groupStart; i < argc; ++i) {
     std::string group_name(argv[i]);
-    runner(file, group_name, rank, numRanks, gpu, lets, bucketSize,
-           bucketSizeFocus, static_cast<float>(theta), save);
+    runner(file, group_name, rank, numRanks, cfg);
   }
 
   MPI_Finalize();
@@ -0,0 +1,64 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+// Replaces the global operator new/delete of pca to count live heap bytes.
+// The array, nothrow and sized forms of the standard library forward to
+// these two, so every std::vector in the runners and inside cstone::Domain
+// is accounted for. Counting only starts with setHeapTracking(true), until
+// then both cost one relaxed load on top of malloc/free.
+//
+// Blocks allocated before tracking started are subtracted when they are
+// freed, so the counters are signed, clamped at 0 when read, and only
+// their differences are meaningful.
+
+namespace {
+std::atomic<bool> tracking{false};
+std::atomic<long long> liveBytes{0};
+std::atomic<long long> peakBytes{0};
+
+void updatePeak(long long live) {
+  long long peak = peakBytes.load(std::memory_order_relaxed);
+  while (live > peak &&
+         !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+    ;
+}
+} // namespace
+
+void setHeapTracking(bool enable) {
+  tracking.store(enable, std::memory_order_relaxed);
+}
+
+HeapStats heapStats() {
+  long long live = liveBytes.load(std::memory_order_relaxed);
+  long long peak = peakBytes.load(std::memory_order_relaxed);
+  return {size_t(std::max(live, 0ll)), size_t(std::max(peak, 0ll))};
+}
+
+void resetHeapPeak() {
+  peakBytes.store(liveBytes.load(std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+}
+
+void *operator new(size_t size) {
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (!ptr)
+    throw std::bad_alloc();
+  if (!tracking.load(std::memory_order_relaxed))
+    return ptr;
+  long long bytes = malloc_usable_size(ptr);
+  updatePeak(liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (!ptr)
+    return;
+  if (tracking.load(std::memory_order_relaxed))
+    liveBytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+  std::free(ptr);
+}
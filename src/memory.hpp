@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+//! @brief heap bytes allocated through operator new, see memory.cpp
+struct HeapStats {
+  size_t live = 0;
+  size_t peak = 0;
+};
+
+HeapStats heapStats();
+
+//! @brief start or stop counting operator new/delete, off by default
+void setHeapTracking(bool enable);
+
+//! @brief restart peak tracking from the current live byte count
+void resetHeapPeak();
+
+//! @brief resident set size and its high-water mark, in bytes
+struct RssStats {
+  size_t rss = 0;
+  size_t hwm = 0;
+};
+
+inline RssStats readRss() {
+  RssStats s;
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmRSS:", 0) == 0)
+      s.rss = std::stoull(line.substr(6)) * 1024;
+    else if (line.rfind("VmHWM:", 0) == 0)
+      s.hwm = std::stoull(line.substr(6)) * 1024;
+  }
+  return s;
+}
+
+//! @brief reset VmHWM to the current RSS (Linux >= 4.0), false if refused
+inline bool resetRssPeak() {
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+  return bool(clearRefs.flush());
+}
+
+/*! @brief named buffers whose footprint is reported per run
+ *
+ * Buffers are sampled by capacity when bytes() is called, so vectors that
+ * grow or shrink between registration and reporting (the leaf array, the
+ * domain-managed particle arrays) are accounted at their current size.
+ */
+class BufferRegistry {
+public:
+  template <class T> void add(std::string name, const std::vector<T> &v) {
+    buffers_.emplace_back(std::move(name),
+                          [&v]() { return v.capacity() * sizeof(T); });
+  }
+
+  std::vector<std::pair<std::string, size_t>> bytes() const {
+    std::vector<std::pair<std::string, size_t>> ret;
+    for (const auto &[name, size] : buffers_)
+      ret.emplace_back(name, size());
+    return ret;
+  }
+
+  size_t total() const {
+    size_t sum = 0;
+    for (const auto &b : buffers_)
+      sum += b.second();
+    return sum;
+  }
+
+private:
+  std::vector<std::pair<std::string, std::function<size_t()>>> buffers_;
+};
+
+constexpr double toMiB(size_t bytes) { return double(bytes) / (1024 * 1024); }
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numbers>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include "cstone/findneighbors.hpp"
+#include "cstone/sfc/common.hpp"
+#include "cstone/tree/octree.hpp"
+
+/*! @brief neighbors of particle i are neighbors[offsets[i], offsets[i + 1])
+ *
+ * The offsets are 64-bit, as the total number of neighbors exceeds 2^32 at
+ * a few ten million particles with ~100 neighbors each.
+ */
+struct NeighborList {
+  std::vector<uint64_t> offsets;
+  std::vector<cstone::LocalIndex> neighbors;
+
+  size_t numParticles() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+  size_t count(size_t i) const { return offsets[i + 1] - offsets[i]; }
+};
+
+/*! @brief contiguous runs of leaves with about @p target particles each
+ *
+ * Returns leaf indices [groups[b], groups[b + 1]). A run never splits a leaf,
+ * so its particles are the target group a thread traverses for together.
+ */
+template <class IndexType>
+std::vector<size_t> leafBlocks(std::span<const IndexType> layout,
+                               size_t target) {
+  size_t numLeaves = layout.size() - 1;
+  std::vector<size_t> blocks{0};
+  for (size_t i = 0; i < numLeaves; ++i) {
+    if (layout[i + 1] - layout[blocks.back()] >= target)
+      blocks.push_back(i + 1);
+  }
+  if (blocks.back() != numLeaves)
+    blocks.push_back(numLeaves);
+  return blocks;
+}
+
+//! @brief particles per leaf block that keep every thread busy
+inline size_t blockTarget(size_t np) {
+#if defined(_OPENMP)
+  size_t threads = omp_get_max_threads();
+#else
+  size_t threads = 1;
+#endif
+  return std::max<size_t>(np / (16 * threads), 256);
+}
+
+/*! @brief initial smoothing lengths from the density of each leaf
+ *
+ * Particle i in a leaf of volume V holding c particles gets the h for which
+ * a sphere of radius 2h holds @p ngTarget particles at density c / V.
+ */
+template <class T, class KeyType, class IndexType>
+void leafSmoothingLengths(std::span<const KeyType> leaves,
+                          std::span<const IndexType> layout,
+                          const cstone::Box<T> &box, unsigned ngTarget,
+                          std::span<T> h) {
+  constexpr unsigned maxLevel = cstone::maxTreeLevel<KeyType>{};
+  double boxVolume = double(box.lx()) * box.ly() * box.lz();
+  size_t numLeaves = leaves.size() - 1;
+
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < numLeaves; ++i) {
+    IndexType first = layout[i], last = layout[i + 1];
+    if (first == last)
+      continue;
+    unsigned level = maxLevel - std::countr_zero(leaves[i + 1] - leaves[i]) / 3;
+    double volume = boxVolume / std::exp2(3.0 * level);
+    double density = (last - first) / volume;
+    T hi = T(0.5 * std::cbrt(3.0 * ngTarget / (4 * std::numbers::pi * density)));
+    std::fill(h.begin() + first, h.begin() + last, hi);
+  }
+}
+
+/*! @brief all neighbors within 2h of every particle, in CSR layout
+ *
+ * Coordinates and h are in the SFC order of @p layout. Threads take blocks of
+ * consecutive leaves, so each block's neighbors are already in particle
+ * order and the blocks are concatenated after one scan over the counts.
+ * @p ngmax is the per-particle scratch size of cstone::findNeighbors;
+ * particles with more neighbors are searched again with a larger buffer.
+ */
+template <class T, class KeyType, class IndexType>
+NeighborList findNeighborsCsr(const T *x, const T *y, const T *z, const T *h,
+                              const cstone::OctreeNsView<T, KeyType> &tree,
+                              std::span<const IndexType> layout,
+                              const cstone::Box<T> &box, unsigned ngmax) {
+  using cstone::LocalIndex;
+  size_t np = layout.back();
+  std::vector<size_t> blocks = leafBlocks(layout, blockTarget(np));
+  size_t numBlocks = blocks.size() - 1;
+
+  NeighborList list;
+  list.offsets.assign(np + 1, 0);
+  std::vector<std::vector<LocalIndex>> blockNeighbors(numBlocks);
+
+#pragma omp parallel
+  {
+    std::vector<LocalIndex> scratch(ngmax);
+#pragma omp for schedule(dynamic)
+    for (size_t b = 0; b < numBlocks; ++b) {
+      auto &out = blockNeighbors[b];
+      for (LocalIndex i = layout[blocks[b]]; i < layout[blocks[b + 1]]; ++i) {
+        unsigned n = cstone::findNeighbors(i, x, y, z, h, tree, box, ngmax,
+                                           scratch.data());
+        if (n > ngmax) {
+          std::vector<LocalIndex> all(n);
+          cstone::findNeighbors(i, x, y, z, h, tree, box, n, all.data());
+          out.insert(out.end(), all.begin(), all.end());
+        } else {
+          out.insert(out.end(), scratch.begin(), scratch.begin() + n);
+        }
+        list.offsets[i + 1] = n;
+      }
+    }
+  }
+
+  std::inclusive_scan(list.offsets.begin(), list.offsets.end(),
+                      list.offsets.begin());
+  list.neighbors.resize(list.offsets.back());
+
+#pragma omp parallel for schedule(static)
+  for (size_t b = 0; b < numBlocks; ++b) {
+    std::copy(blockNeighbors[b].begin(), blockNeighbors[b].end(),
+              list.neighbors.begin() + list.offsets[layout[blocks[b]]]);
+  }
+  return list;
+}
+
+/*! @brief number of neighbors within 2h of the sorted particles
+ *         @p particles, without storing them, e.g. as a per-particle cost
+ *
+ * counts[k] is the count of particles[k].
+ */
+template <class T, class KeyType>
+void countNeighbors(const T *x, const T *y, const T *z, const T *h,
+                    const cstone::OctreeNsView<T, KeyType> &tree,
+                    const cstone::Box<T> &box,
+                    std::span<const cstone::LocalIndex> particles,
+                    std::span<unsigned> counts) {
+  using cstone::LocalIndex;
+  constexpr unsigned ngmax = 64;
+#pragma omp parallel
+  {
+    // only the counts are needed, indices past the scratch are dropped
+    std::vector<LocalIndex> scratch(ngmax);
+#pragma omp for schedule(dynamic, 256)
+    for (size_t k = 0; k < particles.size(); ++k)
+      counts[k] = cstone::findNeighbors(particles[k], x, y, z, h, tree, box,
+                                        ngmax, scratch.data());
+  }
+}
+
+//! @brief convergence history of adaptSmoothingLengths, one entry per iteration
+struct HAdaptStats {
+  //! particles searched in each iteration, the unconverged ones
+  std::vector<size_t> active;
+  std::vector<double> seconds;
+  //! particles still outside the tolerance after the last iteration
+  size_t unconverged = 0;
+
+  unsigned iterations() const { return unsigned(active.size()); }
+};
+
+/*! @brief iterate h of every particle until its 2h neighbor count is within
+ *         @p tolerance of @p ngTarget
+ *
+ * Each iteration counts the neighbors of the unconverged particles over the
+ * same tree, then applies a Newton step for n proportional to h^d,
+ * h' = h (ngTarget / n)^(1/d). d starts at 3 and is then the slope of log n
+ * over log h between the last two iterates, which converges quickly on
+ * filaments and sheets too. Each particle keeps a bracket of h values with
+ * too few and too many neighbors, and a step leaving the bracket is replaced
+ * by bisection, so oscillating particles still converge. @p h holds the
+ * initial guess on input.
+ */
+template <class T, class KeyType, class IndexType>
+HAdaptStats adaptSmoothingLengths(const T *x, const T *y, const T *z,
+                                  std::span<T> h,
+                                  const cstone::OctreeNsView<T, KeyType> &tree,
+                                  std::span<const IndexType> layout,
+                                  const cstone::Box<T> &box, unsigned ngTarget,
+                                  double tolerance, unsigned maxIterations) {
+  using cstone::LocalIndex;
+  size_t np = layout.back();
+  unsigned lo = unsigned(std::ceil(ngTarget * (1 - tolerance)));
+  unsigned hi = unsigned(std::floor(ngTarget * (1 + tolerance)));
+
+  std::vector<T> hLow(np, 0), hHigh(np, std::numeric_limits<T>::infinity());
+  std::vector<T> hPrev(np, 0);
+  std::vector<unsigned> nPrev(np, 0);
+  std::vector<LocalIndex> active(np);
+  std::iota(active.begin(), active.end(), LocalIndex(0));
+  std::vector<char> done(np, 0);
+
+  HAdaptStats stats;
+  while (!active.empty() && stats.iterations() < maxIterations) {
+    auto t0 = std::chrono::steady_clock::now();
+
+#pragma omp parallel
+    {
+      // only the counts are needed, indices past the scratch are dropped
+      std::vector<LocalIndex> scratch(ngTarget);
+#pragma omp for schedule(dynamic, 256)
+      for (size_t a = 0; a < active.size(); ++a) {
+        LocalIndex i = active[a];
+        unsigned n = cstone::findNeighbors(i, x, y, z, h.data(), tree, box,
+                                           ngTarget, scratch.data());
+        if (n >= lo && n <= hi) {
+          done[i] = 1;
+          continue;
+        }
+        if (n < ngTarget)
+          hLow[i] = h[i];
+        else
+          hHigh[i] = h[i];
+        // local dimension of n(h) from the previous iterate, 3 until known
+        T dim = 3;
+        if (n > 0 && nPrev[i] > 0 && nPrev[i] != n && hPrev[i] != h[i])
+          dim = std::clamp(
+              T(std::log(T(n) / nPrev[i]) / std::log(h[i] / hPrev[i])),
+              T(0.5), T(3));
+        hPrev[i] = h[i];
+        nPrev[i] = n;
+        T next =
+            n == 0 ? 2 * h[i] : h[i] * std::pow(T(ngTarget) / n, 1 / dim);
+        if (next <= hLow[i] || next >= hHigh[i])
+          next = (hLow[i] + hHigh[i]) / 2;
+        h[i] = next;
+      }
+    }
+    stats.active.push_back(active.size());
+    std::erase_if(active, [&](LocalIndex i) { return done[i]; });
+
+    auto t1 = std::chrono::steady_clock::now();
+    stats.seconds.push_back(std::chrono::duration<double>(t1 - t0).count());
+  }
+  stats.unconverged = active.size();
+  return stats;
+}
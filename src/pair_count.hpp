@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include "range_query.hpp"
+#include "tree_boxes.hpp"
+
+//! @brief distinct particle pairs per distance bin [edges[k], edges[k + 1])
+struct PairCounts {
+  std::vector<uint64_t> counts;
+  //! node pairs visited and particle distances evaluated by the traversal
+  uint64_t nodePairs = 0;
+  uint64_t distanceEvaluations = 0;
+
+  uint64_t total() const {
+    return std::accumulate(counts.begin(), counts.end(), uint64_t(0));
+  }
+};
+
+namespace detail {
+
+template <class T, class View> class DualTreeCounter {
+public:
+  DualTreeCounter(const RangeTree<T, View> &rt, std::span<const T> edges,
+                  uint64_t taskCutoff)
+      : rt_(rt), taskCutoff_(taskCutoff), numBins_(edges.size() - 1) {
+    for (T e : edges)
+      edges2_.push_back(e * e);
+#if defined(_OPENMP)
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    // bins plus two counters per thread, padded apart to avoid false sharing
+    stride_ = (numBins_ + 2 + 7) / 8 * 8;
+    local_.assign(size_t(threads) * stride_, 0);
+  }
+
+  //! @brief count the pairs of subtrees @p a and @p b, a == b for self pairs
+  void count(cstone::TreeNodeIndex a, cstone::TreeNodeIndex b) {
+    uint64_t *hist = threadHistogram();
+    ++hist[numBins_];
+
+    const NodeBox<T> &boxA = rt_.boxes[a], &boxB = rt_.boxes[b];
+    T dmin2 = boxA.minDistSq(boxB), dmax2 = boxA.maxDistSq(boxB);
+    if (dmin2 >= edges2_.back() || dmax2 < edges2_.front())
+      return;
+
+    uint64_t nA = rt_.particles[a].count, nB = rt_.particles[b].count;
+    int kMin = bin(dmin2), kMax = bin(dmax2);
+    if (kMin >= 0 && kMin == kMax) {
+      hist[kMin] += a == b ? nA * (nA - 1) / 2 : nA * nB;
+      return;
+    }
+
+    cstone::TreeNodeIndex ca = rt_.tree.childOffsets[a];
+    cstone::TreeNodeIndex cb = rt_.tree.childOffsets[b];
+    if (a == b) {
+      if (ca == 0) {
+        leafPairs(a, a);
+        return;
+      }
+      for (int i = 0; i < 8; ++i)
+        for (int j = i; j < 8; ++j)
+          spawn(ca + i, ca + j);
+      return;
+    }
+    if (ca == 0 && cb == 0) {
+      leafPairs(a, b);
+      return;
+    }
+    // split the larger node, or the only internal one
+    bool splitA = cb == 0 || (ca != 0 && boxA.maxDistSq(boxA) >= boxB.maxDistSq(boxB));
+    for (int i = 0; i < 8; ++i) {
+      if (splitA)
+        spawn(ca + i, b);
+      else
+        spawn(a, cb + i);
+    }
+  }
+
+  PairCounts result() const {
+    PairCounts pc;
+    pc.counts.assign(numBins_, 0);
+    for (size_t t = 0; t < local_.size() / stride_; ++t) {
+      const uint64_t *hist = local_.data() + t * stride_;
+      for (size_t k = 0; k < numBins_; ++k)
+        pc.counts[k] += hist[k];
+      pc.nodePairs += hist[numBins_];
+      pc.distanceEvaluations += hist[numBins_ + 1];
+    }
+    return pc;
+  }
+
+private:
+  uint64_t *threadHistogram() {
+#if defined(_OPENMP)
+    return local_.data() + size_t(omp_get_thread_num()) * stride_;
+#else
+    return local_.data();
+#endif
+  }
+
+  //! @brief bin of squared distance @p d2, -1 outside all bins
+  int bin(T d2) const {
+    if (d2 < edges2_.front() || d2 >= edges2_.back())
+      return -1;
+    return int(std::upper_bound(edges2_.begin(), edges2_.end(), d2) -
+               edges2_.begin()) - 1;
+  }
+
+  //! @brief large pairs become tasks, small ones recurse in this task
+  void spawn(cstone::TreeNodeIndex a, cstone::TreeNodeIndex b) {
+    uint64_t work = uint64_t(rt_.particles[a].count) * rt_.particles[b].count;
+    if (work == 0)
+      return;
+    if (work >= taskCutoff_) {
+#pragma omp task firstprivate(a, b)
+      count(a, b);
+    } else {
+      count(a, b);
+    }
+  }
+
+  void leafPairs(cstone::TreeNodeIndex a, cstone::TreeNodeIndex b) {
+    uint64_t *hist = threadHistogram();
+    const NodeParticles &pa = rt_.particles[a], &pb = rt_.particles[b];
+    const T *x = rt_.x, *y = rt_.y, *z = rt_.z;
+    for (cstone::LocalIndex i = pa.first; i < pa.first + pa.count; ++i) {
+      cstone::LocalIndex j0 = a == b ? i + 1 : pb.first;
+      for (cstone::LocalIndex j = j0; j < pb.first + pb.count; ++j) {
+        T dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+        int k = bin(dx * dx + dy * dy + dz * dz);
+        if (k >= 0)
+          ++hist[k];
+      }
+      hist[numBins_ + 1] += pb.first + pb.count - j0;
+    }
+  }
+
+  const RangeTree<T, View> &rt_;
+  uint64_t taskCutoff_;
+  size_t numBins_;
+  std::vector<T> edges2_;
+  size_t stride_;
+  std::vector<uint64_t> local_;
+};
+
+} // namespace detail
+
+/*! @brief dual-tree pair counts of all particles in the bins given by
+ *         ascending @p edges
+ *
+ * Node pairs are pruned when their bounding boxes are entirely closer than
+ * the first edge or farther than the last, and counted in O(1) from the node
+ * counts when the box distance interval falls inside one bin. Otherwise the
+ * larger node is split, and two leaves are counted directly. Node pairs with
+ * at least @p taskCutoff particle pairs are OpenMP tasks.
+ */
+template <class T, class View>
+PairCounts countPairs(const RangeTree<T, View> &rt, std::span<const T> edges,
+                      uint64_t taskCutoff = uint64_t(1) << 20) {
+  detail::DualTreeCounter<T, View> counter(rt, edges, taskCutoff);
+#pragma omp parallel
+#pragma omp single
+  counter.count(0, 0);
+  return counter.result();
+}
+
+//! @brief @p numBins logarithmic bins from @p rmin to @p rmax
+template <class T>
+std::vector<T> logBinEdges(T rmin, T rmax, unsigned numBins) {
+  std::vector<T> edges(numBins + 1);
+  for (unsigned k = 0; k <= numBins; ++k)
+    edges[k] = rmin * std::pow(rmax / rmin, T(k) / numBins);
+  return edges;
+}
@@ -0,0 +1,374 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include <mpi.h>
+
+#include "cstone/sfc/box.hpp"
+#include "cstone/sfc/sfc.hpp"
+#include "compress.hpp"
+
+//! @brief MPI datatype of the arithmetic type @p T
+template <class T> MPI_Datatype mpiType() {
+  if constexpr (std::is_same_v<T, float>)
+    return MPI_FLOAT;
+  else if constexpr (std::is_same_v<T, double>)
+    return MPI_DOUBLE;
+  else if constexpr (std::is_same_v<T, uint64_t>)
+    return MPI_UINT64_T;
+  else if constexpr (std::is_same_v<T, uint32_t>)
+    return MPI_UINT32_T;
+  else
+    return MPI_BYTE;
+}
+
+/*! @brief SFC key splitters of a rank partition
+ *
+ * Rank r owns the keys [splitters[r], splitters[r + 1]); the first splitter
+ * is 0 and the last is the end of the key range.
+ */
+template <class KeyType> struct SfcSplitters {
+  std::vector<KeyType> keys;
+
+  int numRanks() const { return int(keys.size()) - 1; }
+
+  int owner(KeyType key) const {
+    return int(std::upper_bound(keys.begin() + 1, keys.end() - 1, key) -
+               keys.begin()) - 1;
+  }
+};
+
+/*! @brief splitters for equal work from a regular sample of the keys
+ *
+ * Every rank sorts its keys and contributes @p oversample samples per rank,
+ * each standing for the same local weight. The allgathered samples form a
+ * weighted global histogram in key order, and splitter r is the first sample
+ * key past r / numRanks of the total weight. With @p weights, a sample stands
+ * for the summed weight of the keys it represents instead of their count.
+ * Collective over @p comm.
+ */
+template <class KeyType>
+SfcSplitters<KeyType> sampleSplitters(std::span<const KeyType> keys,
+                                      std::span<const double> weights,
+                                      MPI_Comm comm, int oversample = 64) {
+  int rank, numRanks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &numRanks);
+
+  std::vector<size_t> order(keys.size());
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+  // sample s stands for the sorted local keys [first, last) below
+  size_t numSamples = std::min<size_t>(keys.size(), size_t(oversample) * numRanks);
+  std::vector<KeyType> sampleKeys(numSamples);
+  std::vector<double> sampleWeights(numSamples, 0);
+  for (size_t s = 0; s < numSamples; ++s) {
+    size_t first = keys.size() * s / numSamples;
+    size_t last = keys.size() * (s + 1) / numSamples;
+    sampleKeys[s] = keys[order[first]];
+    for (size_t i = first; i < last; ++i)
+      sampleWeights[s] += weights.empty() ? 1.0 : weights[order[i]];
+  }
+
+  int localSamples = int(numSamples);
+  std::vector<int> counts(numRanks), displs(numRanks);
+  MPI_Allgather(&localSamples, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+  std::exclusive_scan(counts.begin(), counts.end(), displs.begin(), 0);
+  int totalSamples = displs.back() + counts.back();
+
+  std::vector<KeyType> allKeys(totalSamples);
+  std::vector<double> allWeights(totalSamples);
+  MPI_Allgatherv(sampleKeys.data(), localSamples, mpiType<KeyType>(),
+                 allKeys.data(), counts.data(), displs.data(),
+                 mpiType<KeyType>(), comm);
+  MPI_Allgatherv(sampleWeights.data(), localSamples, MPI_DOUBLE,
+                 allWeights.data(), counts.data(), displs.data(), MPI_DOUBLE,
+                 comm);
+
+  std::vector<int> byKey(totalSamples);
+  std::iota(byKey.begin(), byKey.end(), 0);
+  std::sort(byKey.begin(), byKey.end(),
+            [&](int a, int b) { return allKeys[a] < allKeys[b]; });
+  double total = std::accumulate(allWeights.begin(), allWeights.end(), 0.0);
+
+  SfcSplitters<KeyType> splitters;
+  splitters.keys.assign(numRanks + 1, 0);
+  splitters.keys.back() = cstone::nodeRange<KeyType>(0);
+  double acc = 0;
+  int r = 1;
+  for (int s : byKey) {
+    while (r < numRanks && acc >= total * r / numRanks)
+      splitters.keys[r++] = allKeys[s];
+    acc += allWeights[s];
+  }
+  while (r < numRanks)
+    splitters.keys[r++] = splitters.keys.back();
+  return splitters;
+}
+
+/*! @brief max / mean over the ranks of the particle counts @p splitters
+ *         assign to @p keys. Collective over @p comm.
+ */
+template <class KeyType>
+double splitterImbalance(std::span<const KeyType> keys,
+                         const SfcSplitters<KeyType> &splitters, MPI_Comm comm) {
+  std::vector<unsigned long long> counts(splitters.numRanks(), 0);
+  for (KeyType k : keys)
+    ++counts[splitters.owner(k)];
+  MPI_Allreduce(MPI_IN_PLACE, counts.data(), int(counts.size()),
+                MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+  unsigned long long total = std::accumulate(counts.begin(), counts.end(), 0ull);
+  unsigned long long max = *std::max_element(counts.begin(), counts.end());
+  return total > 0 ? double(max) * counts.size() / total : 1;
+}
+
+/*! @brief SFC splitters kept across steps until the imbalance they produce
+ *         exceeds a tolerance
+ *
+ * update() measures the imbalance the current splitters give on the new
+ * keys. Up to 1 + tolerance the splitters stay, and an exchange by them only
+ * moves the particles that crossed one. Past it, or on the first update, the
+ * splitters are resampled for equal counts. A negative tolerance resamples
+ * on every update.
+ */
+template <class KeyType> struct HysteresisSplitters {
+  double tolerance = 0;
+  SfcSplitters<KeyType> splitters;
+  //! imbalance of the last update under the splitters it kept or sampled
+  double imbalance = 1;
+
+  //! @brief true if the splitters were resampled. Collective over @p comm.
+  bool update(std::span<const KeyType> keys, MPI_Comm comm) {
+    if (!splitters.keys.empty() && tolerance >= 0) {
+      imbalance = splitterImbalance(keys, splitters, comm);
+      if (imbalance <= 1 + tolerance)
+        return false;
+    }
+    splitters = sampleSplitters(keys, std::span<const double>{}, comm);
+    imbalance = splitterImbalance(keys, splitters, comm);
+    return true;
+  }
+};
+
+//! @brief what one particle exchange sent, for comparing partitioning paths
+struct ExchangeStats {
+  //! particles and bytes sent to other ranks, local particles excluded
+  size_t particlesSent = 0;
+  size_t bytesSent = 0;
+  double seconds = 0;
+};
+
+/*! @brief send every particle with its key to the owner of the key
+ *
+ * @p keys and @p arrays are per-particle arrays of equal length, all resized
+ * to the received particle count and ordered by source rank. With an enabled
+ * @p codec each message holds the keys and then every array as one byte
+ * column, SFC-sorted per destination and compressed as the codec decides.
+ * Collective over @p comm.
+ */
+template <class KeyType, class T>
+ExchangeStats exchangeByKey(std::vector<KeyType> &keys,
+                            const SfcSplitters<KeyType> &splitters,
+                            std::span<std::vector<T> *const> arrays,
+                            MPI_Comm comm, ExchangeCodec *codec = nullptr) {
+  auto t0 = std::chrono::steady_clock::now();
+  int rank, numRanks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &numRanks);
+
+  std::vector<int> dest(keys.size());
+  std::vector<int> sendCounts(numRanks, 0), recvCounts(numRanks);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    dest[i] = splitters.owner(keys[i]);
+    ++sendCounts[dest[i]];
+  }
+  MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT,
+               comm);
+
+  std::vector<int> sendDispls(numRanks), recvDispls(numRanks);
+  std::exclusive_scan(sendCounts.begin(), sendCounts.end(), sendDispls.begin(), 0);
+  std::exclusive_scan(recvCounts.begin(), recvCounts.end(), recvDispls.begin(), 0);
+  size_t numRecv = recvDispls.back() + recvCounts.back();
+
+  // stable bucket order, so each rank's particles stay in their input order
+  std::vector<size_t> perm(keys.size());
+  std::vector<int> fill(sendDispls);
+  for (size_t i = 0; i < keys.size(); ++i)
+    perm[fill[dest[i]]++] = i;
+
+  ExchangeStats stats;
+  stats.particlesSent = keys.size() - sendCounts[rank];
+  size_t rawBytes = sizeof(KeyType) + arrays.size() * sizeof(T);
+
+  if (!codec || !codec->enabled()) {
+    std::vector<KeyType> sendKeys(keys.size()), recvKeys(numRecv);
+    for (size_t i = 0; i < perm.size(); ++i)
+      sendKeys[i] = keys[perm[i]];
+    MPI_Alltoallv(sendKeys.data(), sendCounts.data(), sendDispls.data(),
+                  mpiType<KeyType>(), recvKeys.data(), recvCounts.data(),
+                  recvDispls.data(), mpiType<KeyType>(), comm);
+    keys.swap(recvKeys);
+
+    std::vector<T> sendBuf(perm.size()), recvBuf(numRecv);
+    for (std::vector<T> *a : arrays) {
+      for (size_t i = 0; i < perm.size(); ++i)
+        sendBuf[i] = (*a)[perm[i]];
+      MPI_Alltoallv(sendBuf.data(), sendCounts.data(), sendDispls.data(),
+                    mpiType<T>(), recvBuf.data(), recvCounts.data(),
+                    recvDispls.data(), mpiType<T>(), comm);
+      a->assign(recvBuf.begin(), recvBuf.end());
+    }
+    stats.bytesSent = stats.particlesSent * rawBytes;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return stats;
+  }
+
+  // SFC order within each message is what makes the columns compressible
+  for (int q = 0; q < numRanks; ++q)
+    std::sort(perm.begin() + sendDispls[q],
+              perm.begin() + sendDispls[q] + sendCounts[q],
+              [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+  auto tEncode = std::chrono::steady_clock::now();
+  std::vector<std::vector<uint8_t>> messages(numRanks);
+  std::vector<KeyType> colKeys;
+  std::vector<T> col;
+  for (int q = 0; q < numRanks; ++q) {
+    size_t first = sendDispls[q], n = sendCounts[q];
+    auto t = std::chrono::steady_clock::now();
+    bool encode = q != rank && codec->compress(n * rawBytes);
+    uint8_t flags = encode ? (codec->keys ? ExchangeCodec::keysFlag : 0) |
+                                 (codec->floats ? ExchangeCodec::floatsFlag : 0)
+                           : 0;
+    auto &msg = messages[q];
+    msg.push_back(flags);
+    colKeys.resize(n);
+    for (size_t k = 0; k < n; ++k)
+      colKeys[k] = keys[perm[first + k]];
+    appendColumn(colKeys.data(), n, flags & ExchangeCodec::keysFlag, msg);
+    col.resize(n);
+    for (std::vector<T> *a : arrays) {
+      for (size_t k = 0; k < n; ++k)
+        col[k] = (*a)[perm[first + k]];
+      appendColumn(col.data(), n, flags & ExchangeCodec::floatsFlag, msg);
+    }
+    if (q != rank) {
+      codec->rawBytes += n * rawBytes;
+      codec->wireBytes += msg.size();
+      stats.bytesSent += msg.size();
+      // decoding costs about as much as encoding
+      if (encode)
+        codec->learn(n * rawBytes, msg.size(),
+                     2 * std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count());
+    }
+  }
+  codec->encodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tEncode).count();
+
+  std::vector<int> sendBytes(numRanks), recvBytes(numRanks);
+  for (int q = 0; q < numRanks; ++q)
+    sendBytes[q] = int(messages[q].size());
+  MPI_Alltoall(sendBytes.data(), 1, MPI_INT, recvBytes.data(), 1, MPI_INT, comm);
+  std::vector<int> sendByteDispls(numRanks), recvByteDispls(numRanks);
+  std::exclusive_scan(sendBytes.begin(), sendBytes.end(), sendByteDispls.begin(), 0);
+  std::exclusive_scan(recvBytes.begin(), recvBytes.end(), recvByteDispls.begin(), 0);
+  std::vector<uint8_t> sendBuf(sendByteDispls.back() + sendBytes.back());
+  std::vector<uint8_t> recvBuf(recvByteDispls.back() + recvBytes.back());
+  for (int q = 0; q < numRanks; ++q)
+    std::copy(messages[q].begin(), messages[q].end(), sendBuf.begin() + sendByteDispls[q]);
+  MPI_Alltoallv(sendBuf.data(), sendBytes.data(), sendByteDispls.data(), MPI_BYTE, recvBuf.data(),
+                recvBytes.data(), recvByteDispls.data(), MPI_BYTE, comm);
+
+  auto tDecode = std::chrono::steady_clock::now();
+  keys.resize(numRecv);
+  for (std::vector<T> *a : arrays)
+    a->resize(numRecv);
+  for (int q = 0; q < numRanks; ++q) {
+    const uint8_t *in = recvBuf.data() + recvByteDispls[q];
+    uint8_t flags = *in++;
+    size_t first = recvDispls[q], n = recvCounts[q];
+    in = readColumn(in, n, flags & ExchangeCodec::keysFlag, keys.data() + first);
+    for (std::vector<T> *a : arrays)
+      in = readColumn(in, n, flags & ExchangeCodec::floatsFlag, a->data() + first);
+  }
+  codec->decodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tDecode).count();
+
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return stats;
+}
+
+/*! @brief slowest point-to-point bandwidth in bytes/s of a ring exchange of
+ *         @p bytes per rank, 0 on a single rank. Collective over @p comm.
+ */
+inline double measureBandwidth(MPI_Comm comm, size_t bytes = size_t(1) << 22) {
+  int rank, numRanks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &numRanks);
+  if (numRanks == 1)
+    return 0;
+  std::vector<char> send(bytes, 1), recv(bytes);
+  int next = (rank + 1) % numRanks, prev = (rank + numRanks - 1) % numRanks;
+  MPI_Barrier(comm);
+  auto t0 = std::chrono::steady_clock::now();
+  MPI_Sendrecv(send.data(), int(bytes), MPI_BYTE, next, 0, recv.data(),
+               int(bytes), MPI_BYTE, prev, 0, comm, MPI_STATUS_IGNORE);
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  MPI_Allreduce(MPI_IN_PLACE, &seconds, 1, MPI_DOUBLE, MPI_MAX, comm);
+  return seconds > 0 ? bytes / seconds : 0;
+}
+
+//! @brief bounding box of @p x, @p y, @p z over all ranks of @p comm
+template <class T>
+cstone::Box<T> globalBox(const std::vector<T> &x, const std::vector<T> &y,
+                         const std::vector<T> &z, MPI_Comm comm) {
+  T lo[3] = {std::numeric_limits<T>::max(), std::numeric_limits<T>::max(),
+             std::numeric_limits<T>::max()};
+  T hi[3] = {std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest(),
+             std::numeric_limits<T>::lowest()};
+  const std::vector<T> *coords[3] = {&x, &y, &z};
+  for (int d = 0; d < 3; ++d) {
+    auto [mn, mx] = std::minmax_element(coords[d]->begin(), coords[d]->end());
+    if (mn != coords[d]->end()) {
+      lo[d] = *mn;
+      hi[d] = *mx;
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, lo, 3, mpiType<T>(), MPI_MIN, comm);
+  MPI_Allreduce(MPI_IN_PLACE, hi, 3, mpiType<T>(), MPI_MAX, comm);
+  return cstone::Box<T>(lo[0], hi[0], lo[1], hi[1], lo[2], hi[2]);
+}
+
+/*! @brief move the particles of a contiguous index slice to SFC-contiguous
+ *         ranks before the Domain sees them
+ *
+ * @p arrays start with x, y, z. Keys are computed in the global bounding box,
+ * the same box an open-boundary Domain derives, and the splitters from a
+ * regular sample, so that the first Domain::sync finds almost every particle
+ * on its final rank. All arrays are exchanged together. Collective over
+ * @p comm.
+ */
+template <class KeyType, class T>
+ExchangeStats sfcPrePartition(std::span<std::vector<T> *const> arrays,
+                              MPI_Comm comm, ExchangeCodec *codec = nullptr) {
+  auto t0 = std::chrono::steady_clock::now();
+  const std::vector<T> &x = *arrays[0], &y = *arrays[1], &z = *arrays[2];
+  cstone::Box<T> box = globalBox(x, y, z, comm);
+  std::vector<KeyType> keys(x.size());
+  cstone::computeSfcKeys(x.data(), y.data(), z.data(),
+                         cstone::sfcKindPointer(keys.data()), keys.size(), box);
+
+  auto splitters = sampleSplitters(std::span<const KeyType>(keys),
+                                   std::span<const double>{}, comm);
+  ExchangeStats stats = exchangeByKey(keys, splitters, arrays, comm, codec);
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return stats;
+}
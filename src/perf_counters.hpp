@@ -0,0 +1,265 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+//! @brief hardware events collected per OpenMP thread, plus uncore memory
+//! traffic when the node exposes it
+enum PerfEvent {
+  kCycles = 0,
+  kInstructions,
+  kLlcMisses,
+  kDtlbMisses,
+  kMemBytes,
+  kNumPerfEvents
+};
+
+inline const char *perfEventName(int e) {
+  static constexpr const char *names[kNumPerfEvents] = {
+      "cycles", "instructions", "llc_misses", "dtlb_misses", "mem_bytes"};
+  return names[e];
+}
+
+//! @brief counter deltas over one measured region, summed over all threads
+struct PerfSample {
+  std::array<double, kNumPerfEvents> value{};
+  std::array<bool, kNumPerfEvents> present{};
+
+  double ipc() const {
+    return present[kCycles] && present[kInstructions] && value[kCycles] > 0
+               ? value[kInstructions] / value[kCycles]
+               : 0.0;
+  }
+
+  PerfSample &operator+=(const PerfSample &other) {
+    for (int e = 0; e < kNumPerfEvents; ++e) {
+      value[e] += other.value[e];
+      present[e] = present[e] || other.present[e];
+    }
+    return *this;
+  }
+};
+
+//! @brief raw (value, time enabled, time running) triples of all open fds
+using PerfSnapshot = std::vector<std::array<uint64_t, 3>>;
+
+/*! @brief perf_event_open based counter group
+ *
+ * Core events are opened once per OpenMP thread so that the work done inside
+ * parallel regions is attributed correctly. Counters run continuously after
+ * open(); regions are measured as the difference of two snapshots, which
+ * allows nesting (a trial around its pipeline stages). Any event the kernel
+ * or the hardware refuses is simply left out, so on machines without a PMU
+ * (VMs, perf_event_paranoid > 2) every sample comes back empty.
+ */
+class PerfCounters {
+public:
+  PerfCounters() = default;
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+  ~PerfCounters() { close(); }
+
+  //! @brief open all available counters, returns false if none could be
+  bool open() {
+    close();
+#if defined(__linux__)
+    int numThreads = 1;
+#if defined(_OPENMP)
+    numThreads = omp_get_max_threads();
+#endif
+    std::vector<std::array<int, kMemBytes>> threadFds(numThreads);
+
+#pragma omp parallel num_threads(numThreads)
+    {
+      int tid = 0;
+#if defined(_OPENMP)
+      tid = omp_get_thread_num();
+#endif
+      for (int e = 0; e < kMemBytes; ++e) {
+        threadFds[tid][e] = openCoreEvent(e);
+      }
+    }
+
+    for (const auto &fds : threadFds) {
+      for (int e = 0; e < kMemBytes; ++e) {
+        if (fds[e] >= 0) {
+          fds_.push_back(fds[e]);
+          events_.push_back(e);
+        }
+      }
+    }
+    openUncoreImc();
+#endif
+    return available();
+  }
+
+  bool available() const { return !fds_.empty(); }
+
+  //! @brief whether event @p e is counted by at least one fd
+  bool has(int e) const {
+    for (int ev : events_) {
+      if (ev == e)
+        return true;
+    }
+    return false;
+  }
+
+  PerfSnapshot snapshot() const {
+    PerfSnapshot snap(fds_.size(), {0, 0, 0});
+#if defined(__linux__)
+    for (size_t i = 0; i < fds_.size(); ++i) {
+      uint64_t buf[3];
+      if (::read(fds_[i], buf, sizeof(buf)) == sizeof(buf)) {
+        snap[i] = {buf[0], buf[1], buf[2]};
+      }
+    }
+#endif
+    return snap;
+  }
+
+  //! @brief aggregate counts between two snapshots, scaled for multiplexing
+  PerfSample delta(const PerfSnapshot &begin, const PerfSnapshot &end) const {
+    PerfSample sample;
+    for (size_t i = 0; i < fds_.size() && i < begin.size() && i < end.size();
+         ++i) {
+      double count = double(end[i][0] - begin[i][0]);
+      double enabled = double(end[i][1] - begin[i][1]);
+      double running = double(end[i][2] - begin[i][2]);
+      if (running > 0 && running < enabled) {
+        count *= enabled / running;
+      }
+      int e = events_[i];
+      sample.value[e] += (e == kMemBytes) ? count * imcBytesPerCount_ : count;
+      sample.present[e] = true;
+    }
+    return sample;
+  }
+
+  void close() {
+#if defined(__linux__)
+    for (int fd : fds_) {
+      ::close(fd);
+    }
+#endif
+    fds_.clear();
+    events_.clear();
+  }
+
+private:
+#if defined(__linux__)
+  static int perfEventOpen(perf_event_attr &attr, pid_t pid, int cpu) {
+    return int(syscall(SYS_perf_event_open, &attr, pid, cpu, -1, 0));
+  }
+
+  static perf_event_attr baseAttr(uint32_t type, uint64_t config) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return attr;
+  }
+
+  //! @brief open event @p e for the calling thread on any cpu
+  static int openCoreEvent(int e) {
+    constexpr uint64_t readMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    perf_event_attr attr{};
+    switch (e) {
+    case kCycles:
+      attr = baseAttr(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+      break;
+    case kInstructions:
+      attr = baseAttr(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+      break;
+    case kLlcMisses:
+      attr = baseAttr(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | readMiss);
+      break;
+    case kDtlbMisses:
+      attr = baseAttr(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | readMiss);
+      break;
+    default:
+      return -1;
+    }
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return perfEventOpen(attr, 0, -1);
+  }
+
+  static bool readSysfs(const std::string &path, std::string &out) {
+    std::ifstream in(path);
+    return bool(std::getline(in, out));
+  }
+
+  /*! @brief open the Intel uncore IMC read/write CAS counters
+   *
+   * These are socket-wide and usually need CAP_PERFMON or
+   * perf_event_paranoid <= 0, so they are the first thing to go missing.
+   * Traffic from other processes on the node is included.
+   */
+  void openUncoreImc() {
+    for (int imc = 0; imc < 64; ++imc) {
+      std::string dev = "/sys/bus/event_source/devices/uncore_imc_" +
+                        std::to_string(imc) + "/";
+      std::string typeStr, cpumask;
+      if (!readSysfs(dev + "type", typeStr))
+        continue;
+      if (!readSysfs(dev + "cpumask", cpumask))
+        continue;
+
+      std::string scaleStr;
+      if (readSysfs(dev + "events/cas_count_read.scale", scaleStr)) {
+        // scale converts counts to MiB
+        imcBytesPerCount_ = std::stod(scaleStr) * 1024 * 1024;
+      }
+
+      for (const char *name : {"cas_count_read", "cas_count_write"}) {
+        std::string spec;
+        if (!readSysfs(dev + "events/" + name, spec))
+          continue;
+        unsigned event = 0, umask = 0;
+        if (std::sscanf(spec.c_str(), "event=%x,umask=%x", &event, &umask) <
+            1)
+          continue;
+
+        // one fd per socket: the first cpu listed in each cpumask entry
+        size_t pos = 0;
+        while (pos < cpumask.size()) {
+          int cpu = std::stoi(cpumask.substr(pos));
+          perf_event_attr attr =
+              baseAttr(std::stoul(typeStr), event | (uint64_t(umask) << 8));
+          int fd = perfEventOpen(attr, -1, cpu);
+          if (fd >= 0) {
+            fds_.push_back(fd);
+            events_.push_back(kMemBytes);
+          }
+          size_t comma = cpumask.find(',', pos);
+          if (comma == std::string::npos)
+            break;
+          pos = comma + 1;
+        }
+      }
+    }
+  }
+#endif
+
+  std::vector<int> fds_;
+  std::vector<int> events_;
+  double imcBytesPerCount_ = 64.0;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include "cstone/sfc/box.hpp"
+#include "cstone/sfc/sfc.hpp"
+#include "cstone/tree/octree.hpp"
+
+/*! @brief leaf index lookup for SFC keys over a cornerstone leaf array
+ *
+ * The leaf boundaries are stored in Eytzinger (BFS) order, so the first
+ * levels of every search share the same few cache lines and each step's
+ * grandchildren sit in one line that can be prefetched ahead. Sorted batches
+ * skip the search for runs of keys in the same or a nearby leaf.
+ */
+template <class KeyType> class LeafLocator {
+public:
+  explicit LeafLocator(std::span<const KeyType> leaves)
+      : leaves_(leaves), eyt_(leaves.size() + 1), pos_(leaves.size() + 1) {
+    fill(0, 1);
+  }
+
+  size_t numLeaves() const { return leaves_.size() - 1; }
+
+  //! @brief the leaf i with leaves[i] <= key < leaves[i + 1]
+  cstone::TreeNodeIndex find(KeyType key) const {
+    size_t n = leaves_.size(), k = 1;
+    while (k <= n) {
+#if defined(__GNUC__)
+      // the 8 great-grandchildren of k share one cache line for 64-bit keys
+      __builtin_prefetch(eyt_.data() + std::min(8 * k, n));
+#endif
+      k = 2 * k + (eyt_[k] <= key);
+    }
+    // undo the right turns taken after the last left turn
+    k >>= std::countr_one(k) + 1;
+    return cstone::TreeNodeIndex(pos_[k]) - 1;
+  }
+
+  /*! @brief leaf index of each key
+   *
+   * If @p keys is sorted each thread searches only for its first key and then
+   * follows its contiguous chunk forward, staying in a leaf while the keys
+   * do and galloping over the leaves it skips.
+   */
+  void find(std::span<const KeyType> keys,
+            std::span<cstone::TreeNodeIndex> out) const {
+    bool sorted = true;
+#pragma omp parallel for schedule(static) reduction(&& : sorted)
+    for (size_t i = 1; i < keys.size(); ++i)
+      sorted = sorted && keys[i - 1] <= keys[i];
+    if (!sorted) {
+      // interleaved searches overlap their cache misses
+      constexpr size_t lanes = 8;
+      size_t numGroups = keys.size() / lanes;
+#pragma omp parallel for schedule(static)
+      for (size_t g = 0; g < numGroups; ++g)
+        findInterleaved<lanes>(keys.data() + g * lanes, out.data() + g * lanes);
+      for (size_t i = numGroups * lanes; i < keys.size(); ++i)
+        out[i] = find(keys[i]);
+      return;
+    }
+
+#pragma omp parallel
+    {
+#if defined(_OPENMP)
+      size_t nt = omp_get_num_threads(), t = omp_get_thread_num();
+#else
+      size_t nt = 1, t = 0;
+#endif
+      size_t first = keys.size() * t / nt, last = keys.size() * (t + 1) / nt;
+      cstone::TreeNodeIndex leaf = first < last ? find(keys[first]) : 0;
+      for (size_t i = first; i < last; ++i) {
+        if (keys[i] >= leaves_[leaf + 1])
+          leaf = gallop(leaf, keys[i]);
+        out[i] = leaf;
+      }
+    }
+  }
+
+private:
+  //! @brief find() of @p L keys in lockstep, the tree depth is the same for all
+  template <size_t L>
+  void findInterleaved(const KeyType *keys, cstone::TreeNodeIndex *out) const {
+    size_t n = leaves_.size(), k[L];
+    std::fill(k, k + L, 1);
+    for (int level = std::bit_width(n); level > 0; --level) {
+      for (size_t j = 0; j < L; ++j) {
+        // finished lanes read the unused slot 0 and keep their k
+        bool active = k[j] <= n;
+        bool right = eyt_[active ? k[j] : 0] <= keys[j];
+        k[j] = active ? 2 * k[j] + right : k[j];
+      }
+    }
+    for (size_t j = 0; j < L; ++j)
+      out[j] = cstone::TreeNodeIndex(pos_[k[j] >> (std::countr_one(k[j]) + 1)]) - 1;
+  }
+
+  //! @brief in-order fill of the Eytzinger tree rooted at @p k
+  size_t fill(size_t i, size_t k) {
+    if (k < eyt_.size()) {
+      i = fill(i, 2 * k);
+      eyt_[k] = leaves_[i];
+      pos_[k] = i++;
+      i = fill(i, 2 * k + 1);
+    }
+    return i;
+  }
+
+  //! @brief the leaf of @p key, which lies beyond leaf @p from
+  cstone::TreeNodeIndex gallop(cstone::TreeNodeIndex from, KeyType key) const {
+    size_t lo = from + 1, step = 1, n = leaves_.size();
+    while (lo + step < n && leaves_[lo + step] <= key) {
+      lo += step;
+      step *= 2;
+    }
+    auto it = std::upper_bound(leaves_.begin() + lo,
+                               leaves_.begin() + std::min(lo + step, n), key);
+    return cstone::TreeNodeIndex(it - leaves_.begin()) - 1;
+  }
+
+  std::span<const KeyType> leaves_;
+  std::vector<KeyType> eyt_;
+  std::vector<uint32_t> pos_;
+};
+
+/*! @brief containing leaf of arbitrary points, e.g. tracers not in the tree
+ *
+ * Keys are computed with the same kernel as the tree's particles, so points
+ * outside @p box land in the boundary leaves like the particles do.
+ */
+template <class T, class KeyType>
+void locatePoints(const T *x, const T *y, const T *z, size_t n,
+                  const cstone::Box<T> &box, const LeafLocator<KeyType> &locator,
+                  std::span<cstone::TreeNodeIndex> out) {
+  std::vector<KeyType> keys(n);
+  cstone::computeSfcKeys(x, y, z, cstone::sfcKindPointer(keys.data()), n, box);
+  locator.find(std::span<const KeyType>(keys), out);
+}
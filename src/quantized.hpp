@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "cstone/sfc/box.hpp"
+#include "range_query.hpp"
+#include "tree_boxes.hpp"
+
+/*! @brief positions quantized to 21 bits per axis relative to a box, packed
+ *         into one 64-bit word
+ *
+ * x takes bits [0, 21), y [21, 42) and z [42, 63). 21 bits are the
+ * resolution of a 64-bit SFC key, so the integer coordinates are exactly
+ * what the key is computed from. A word decodes to the center of its cell,
+ * half a cell of box / 2^21 per axis from the original position plus the
+ * rounding of T.
+ */
+template <class T> struct CoordQuantizer {
+  static constexpr unsigned bits = 21;
+  static constexpr uint64_t mask = (uint64_t(1) << bits) - 1;
+
+  T lo[3];
+  //! cells per unit length and cell size per axis
+  T scale[3];
+  T cell[3];
+
+  explicit CoordQuantizer(const cstone::Box<T> &box)
+      : lo{box.xmin(), box.ymin(), box.zmin()} {
+    T length[3] = {box.lx(), box.ly(), box.lz()};
+    for (int d = 0; d < 3; ++d) {
+      scale[d] = T(mask + 1) / length[d];
+      cell[d] = length[d] / T(mask + 1);
+    }
+  }
+
+  //! @brief the cell of @p v along axis @p d, clamped to the box
+  unsigned quantize(T v, int d) const {
+    // in double, a float offset from lo carries only 24 bits
+    double c = std::floor((double(v) - lo[d]) * scale[d]);
+    return unsigned(std::clamp(c, 0.0, double(mask)));
+  }
+
+  uint64_t encode(T x, T y, T z) const {
+    return uint64_t(quantize(x, 0)) | uint64_t(quantize(y, 1)) << bits |
+           uint64_t(quantize(z, 2)) << 2 * bits;
+  }
+
+  static unsigned ix(uint64_t q) { return unsigned(q & mask); }
+  static unsigned iy(uint64_t q) { return unsigned(q >> bits & mask); }
+  static unsigned iz(uint64_t q) { return unsigned(q >> 2 * bits & mask); }
+
+  std::array<T, 3> decode(uint64_t q) const {
+    return {lo[0] + (T(ix(q)) + T(0.5)) * cell[0],
+            lo[1] + (T(iy(q)) + T(0.5)) * cell[1],
+            lo[2] + (T(iz(q)) + T(0.5)) * cell[2]};
+  }
+};
+
+//! @brief pack @p n positions with @p quantizer into @p out
+template <class T>
+void quantizeCoords(const T *x, const T *y, const T *z, size_t n,
+                    const CoordQuantizer<T> &quantizer, uint64_t *out) {
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < n; ++i)
+    out[i] = quantizer.encode(x[i], y[i], z[i]);
+}
+
+//! @brief particle positions from separate coordinate arrays
+template <class T> struct SoaCoords {
+  const T *x, *y, *z;
+
+  std::array<T, 3> operator()(size_t i) const { return {x[i], y[i], z[i]}; }
+};
+
+//! @brief particle positions decoded on the fly from packed words
+template <class T> struct PackedCoords {
+  const uint64_t *packed;
+  CoordQuantizer<T> quantizer;
+
+  std::array<T, 3> operator()(size_t i) const {
+    return quantizer.decode(packed[i]);
+  }
+};
+
+/*! @brief number of particles within @p radius[i] of every particle i,
+ *         itself included
+ *
+ * The same walk as rangeQuery with a sphere per particle, over positions
+ * read through @p coords, so that stored and decoded coordinates are
+ * compared on identical work. @p boxes must bound the positions @p coords
+ * returns.
+ */
+template <class T, class View, class Coords>
+std::vector<unsigned> countWithin(const View &tree,
+                                  std::span<const NodeBox<T>> boxes,
+                                  std::span<const NodeParticles> nodes,
+                                  const Coords &coords,
+                                  std::span<const T> radius) {
+  using cstone::LocalIndex;
+  using cstone::TreeNodeIndex;
+  std::vector<unsigned> counts(radius.size());
+
+#pragma omp parallel for schedule(dynamic, 256)
+  for (size_t i = 0; i < radius.size(); ++i) {
+    auto [cx, cy, cz] = coords(i);
+    T r2 = radius[i] * radius[i];
+    unsigned count = 0;
+    TreeNodeIndex stack[8 * 32];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      TreeNodeIndex node = stack[--top];
+      const NodeParticles &p = nodes[node];
+      if (p.count == 0 || boxes[node].minDistSq(cx, cy, cz) > r2)
+        continue;
+      if (boxes[node].maxDistSq(cx, cy, cz) <= r2) {
+        count += p.count;
+        continue;
+      }
+      TreeNodeIndex child = tree.childOffsets[node];
+      if (child != 0) {
+        for (int k = 0; k < 8; ++k)
+          stack[top++] = child + k;
+        continue;
+      }
+      for (LocalIndex j = p.first; j < p.first + p.count; ++j) {
+        auto [px, py, pz] = coords(j);
+        T dx = px - cx, dy = py - cy, dz = pz - cz;
+        count += dx * dx + dy * dy + dz * dz <= r2;
+      }
+    }
+    counts[i] = count;
+  }
+  return counts;
+}
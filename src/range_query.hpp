@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "tree_boxes.hpp"
+
+//! @brief the particles [first, first + count) under one linked node
+struct NodeParticles {
+  cstone::LocalIndex first = 0;
+  cstone::LocalIndex count = 0;
+};
+
+/*! @brief particle range of every linked node, indexed like the OctreeView
+ *
+ * The particles of a subtree are contiguous in SFC order, so an internal
+ * node's range starts at its first child and its count is the children's sum.
+ */
+template <class View, class IndexType>
+std::vector<NodeParticles> computeNodeParticles(
+    const View &tree, std::span<const IndexType> layout) {
+  using cstone::TreeNodeIndex;
+  std::vector<NodeParticles> nodes(tree.numNodes);
+
+#pragma omp parallel for schedule(static)
+  for (TreeNodeIndex i = 0; i < tree.numNodes; ++i) {
+    IndexType first, last;
+    if (leafRange(tree, layout, i, first, last))
+      nodes[i] = {first, last - first};
+  }
+
+  constexpr int maxLevel = cstone::maxTreeLevel<
+      std::remove_const_t<std::remove_pointer_t<decltype(tree.prefixes)>>>{};
+  for (int level = maxLevel - 1; level >= 0; --level) {
+#pragma omp parallel for schedule(static)
+    for (TreeNodeIndex i = tree.levelRange[level];
+         i < tree.levelRange[level + 1]; ++i) {
+      TreeNodeIndex c = tree.childOffsets[i];
+      if (c == 0)
+        continue;
+      nodes[i] = {nodes[c].first, 0};
+      for (int k = 0; k < 8; ++k)
+        nodes[i].count += nodes[c + k].count;
+    }
+  }
+  return nodes;
+}
+
+//! @brief sphere query shape, the box query shape is NodeBox itself
+template <class T> struct Sphere {
+  T x, y, z, r;
+
+  bool contains(T px, T py, T pz) const {
+    T dx = px - x, dy = py - y, dz = pz - z;
+    return dx * dx + dy * dy + dz * dz <= r * r;
+  }
+  bool contains(const NodeBox<T> &b) const {
+    return b.maxDistSq(x, y, z) <= r * r;
+  }
+  bool disjoint(const NodeBox<T> &b) const {
+    return b.minDistSq(x, y, z) > r * r;
+  }
+};
+
+template <class T> bool disjoint(const NodeBox<T> &q, const NodeBox<T> &b) {
+  return q.minDistSq(b) > 0;
+}
+template <class T> bool disjoint(const Sphere<T> &q, const NodeBox<T> &b) {
+  return q.disjoint(b);
+}
+
+//! @brief the octree and its per-node data a range query walks
+template <class T, class View> struct RangeTree {
+  View tree;
+  std::span<const NodeBox<T>> boxes;
+  std::span<const NodeParticles> particles;
+  const T *x, *y, *z;
+};
+
+/*! @brief particles inside @p shape as half-open index ranges
+ *
+ * Subtrees whose bounding box lies inside the shape are counted from
+ * @p particles in O(1) and contribute their whole range; only leaves that
+ * straddle the boundary test their particles. Adjacent ranges are merged, so
+ * the output is sorted, disjoint and at most one range per gap. With
+ * @p ranges null only the count is computed.
+ */
+template <class Shape, class T, class View>
+uint64_t rangeQuery(const Shape &shape, const RangeTree<T, View> &rt,
+                    std::vector<NodeParticles> *ranges = nullptr,
+                    uint64_t *particleTests = nullptr) {
+  using cstone::LocalIndex;
+  using cstone::TreeNodeIndex;
+
+  auto emit = [ranges](LocalIndex first, LocalIndex count) {
+    if (!ranges)
+      return;
+    if (!ranges->empty() &&
+        ranges->back().first + ranges->back().count == first)
+      ranges->back().count += count;
+    else
+      ranges->push_back({first, count});
+  };
+
+  uint64_t total = 0, tests = 0;
+  // at most 7 siblings per level are waiting on the stack
+  TreeNodeIndex stack[8 * 32];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    TreeNodeIndex node = stack[--top];
+    const NodeParticles &p = rt.particles[node];
+    if (p.count == 0 || disjoint(shape, rt.boxes[node]))
+      continue;
+    if (shape.contains(rt.boxes[node])) {
+      total += p.count;
+      emit(p.first, p.count);
+      continue;
+    }
+
+    TreeNodeIndex child = rt.tree.childOffsets[node];
+    if (child != 0) {
+      // reversed so that ranges are emitted in ascending order
+      for (int k = 7; k >= 0; --k)
+        stack[top++] = child + k;
+      continue;
+    }
+    for (LocalIndex j = p.first; j < p.first + p.count; ++j) {
+      if (shape.contains(rt.x[j], rt.y[j], rt.z[j])) {
+        ++total;
+        emit(j, 1);
+      }
+    }
+    tests += p.count;
+  }
+  if (particleTests)
+    *particleTests += tests;
+  return total;
+}
+
+/*! @brief many range queries in parallel, results in CSR layout
+ *
+ * Query q matched counts[q] particles in the index ranges
+ * [offsets[q], offsets[q + 1]) of @p ranges.
+ */
+struct RangeQueryResult {
+  std::vector<uint64_t> counts;
+  std::vector<size_t> offsets;
+  std::vector<NodeParticles> ranges;
+  //! particles tested individually, the rest came from contained subtrees
+  uint64_t particleTests = 0;
+};
+
+//! @brief one query per thread at a time, without ranges when not collected
+template <class Shape, class T, class View>
+RangeQueryResult rangeQueryBatch(std::span<const Shape> queries,
+                                 const RangeTree<T, View> &rt,
+                                 bool collectRanges = true) {
+  size_t nq = queries.size();
+  RangeQueryResult result;
+  result.counts.resize(nq);
+  result.offsets.assign(nq + 1, 0);
+  std::vector<std::vector<NodeParticles>> perQuery(collectRanges ? nq : 0);
+
+  uint64_t tests = 0;
+#pragma omp parallel for schedule(dynamic, 16) reduction(+ : tests)
+  for (size_t q = 0; q < nq; ++q) {
+    auto *out = collectRanges ? &perQuery[q] : nullptr;
+    result.counts[q] = rangeQuery(queries[q], rt, out, &tests);
+    result.offsets[q + 1] = out ? out->size() : 0;
+  }
+  result.particleTests = tests;
+
+  std::inclusive_scan(result.offsets.begin(), result.offsets.end(),
+                      result.offsets.begin());
+  result.ranges.resize(result.offsets.back());
+
+#pragma omp parallel for schedule(static)
+  for (size_t q = 0; q < perQuery.size(); ++q)
+    std::copy(perQuery[q].begin(), perQuery[q].end(),
+              result.ranges.begin() + result.offsets[q]);
+  return result;
+}
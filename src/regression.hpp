@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "json.hpp"
+#include "utils.hpp"
+
+//! @brief median of one suite entry, e.g. "cpu/uniform_s0p01_n1m/b64/Initial/SortKeys"
+struct BaselineEntry {
+  std::string key;
+  double median = 0;
+  double mad = 0;
+  size_t n = 0;
+};
+
+//! @brief the stored reference a pca-bench run is compared against
+struct Baseline {
+  std::string gitHash;
+  std::string host;
+  std::string timestamp;
+  int ranks = 0;
+  int threads = 0;
+  std::vector<BaselineEntry> entries;
+
+  const BaselineEntry *find(const std::string &key) const {
+    for (const auto &e : entries) {
+      if (e.key == key)
+        return &e;
+    }
+    return nullptr;
+  }
+};
+
+inline BaselineEntry baselineEntry(const std::string &key, const Summary &s) {
+  return {key, s.median, s.mad, s.n};
+}
+
+inline void writeBaseline(std::ostream &out, const Baseline &b) {
+  JsonWriter json(out);
+  json.beginObject();
+  json.field("git_hash", b.gitHash)
+      .field("host", b.host)
+      .field("timestamp", b.timestamp)
+      .field("ranks", b.ranks)
+      .field("threads", b.threads);
+  json.key("entries").beginObject();
+  for (const auto &e : b.entries) {
+    json.key(e.key).beginObject();
+    json.field("median", e.median).field("mad", e.mad).field("n", e.n);
+    json.endObject();
+  }
+  json.endObject();
+  json.endObject();
+  out << "\n";
+}
+
+//! @brief throws std::runtime_error if the file is missing or malformed
+inline Baseline readBaseline(const std::string &path) {
+  std::ifstream in(path);
+  if (!in)
+    throw std::runtime_error("Cannot open baseline " + path);
+  std::stringstream text;
+  text << in.rdbuf();
+  JsonValue doc = parseJson(text.str());
+
+  const JsonValue *entries = doc.find("entries");
+  if (!doc.isObject() || !entries || !entries->isObject())
+    throw std::runtime_error("Baseline " + path + " has no entries object");
+
+  auto str = [&](const char *k) {
+    const JsonValue *v = doc.find(k);
+    return v ? v->string : std::string();
+  };
+
+  Baseline b;
+  b.gitHash = str("git_hash");
+  b.host = str("host");
+  b.timestamp = str("timestamp");
+  b.ranks = int(doc.numberOr("ranks", 0));
+  b.threads = int(doc.numberOr("threads", 0));
+  for (const auto &[key, v] : entries->object) {
+    b.entries.push_back({key, v.numberOr("median", 0), v.numberOr("mad", 0),
+                         size_t(v.numberOr("n", 0))});
+  }
+  return b;
+}
+
+//! @brief how far a stage may drift before it counts as a change
+struct RegressionThreshold {
+  //! relative change of the median that is always tolerated
+  double relative = 0.05;
+  //! multiples of the combined standard error of both medians
+  double sigmas = 3;
+  //! absolute change in microseconds below which timings are never flagged
+  double minDeltaUs = 10;
+};
+
+/*! @brief outcome of one entry; added entries have no baseline yet, missing
+ *         entries are in the baseline but were not produced by this run
+ */
+enum class DiffStatus { ok, regression, improvement, added, missing };
+
+struct StageDiff {
+  std::string key;
+  double baseline = 0;
+  double current = 0;
+  //! change the threshold allows for this entry, in microseconds
+  double allowed = 0;
+  DiffStatus status = DiffStatus::ok;
+
+  double delta() const { return current - baseline; }
+  double relDelta() const { return baseline > 0 ? delta() / baseline : 0; }
+  //! change in units of the allowed change, the ranking of the diff
+  double score() const { return allowed > 0 ? delta() / allowed : 0; }
+};
+
+//! @brief whether an entry with status @p s fails the gate
+inline bool diffFails(DiffStatus s) {
+  return s == DiffStatus::regression || s == DiffStatus::missing;
+}
+
+inline const char *diffStatusName(DiffStatus s) {
+  switch (s) {
+  case DiffStatus::regression:
+    return "REGRESSION";
+  case DiffStatus::improvement:
+    return "improved";
+  case DiffStatus::added:
+    return "new";
+  case DiffStatus::missing:
+    return "MISSING";
+  default:
+    return "ok";
+  }
+}
+
+/*! @brief standard error of a median estimated from its MAD
+ *
+ * For normal noise sigma ~ 1.4826 * MAD and the median of n samples has a
+ * standard error of ~1.2533 * sigma / sqrt(n).
+ */
+inline double medianStdError(double mad, size_t n) {
+  return n > 0 ? 1.2533 * 1.4826 * mad / std::sqrt(double(n)) : 0;
+}
+
+/*! @brief compare @p current against @p base, most regressed entries first
+ *
+ * An entry regresses when its median grows by more than
+ * max(relative * base, sigmas * combined standard error, minDeltaUs), so
+ * noisy stages need a larger change before they are flagged. Entries without
+ * a baseline are reported as added and never fail the gate. Baseline entries
+ * the current run did not produce are reported as missing and fail it, so a
+ * renamed or dropped stage cannot pass unnoticed. Missing entries come first,
+ * added entries last.
+ */
+inline std::vector<StageDiff> compareToBaseline(
+    const Baseline &base, const std::vector<BaselineEntry> &current,
+    const RegressionThreshold &threshold) {
+  std::vector<StageDiff> diffs;
+  for (const auto &c : current) {
+    StageDiff d;
+    d.key = c.key;
+    d.current = c.median;
+
+    const BaselineEntry *b = base.find(c.key);
+    if (!b) {
+      d.status = DiffStatus::added;
+      diffs.push_back(d);
+      continue;
+    }
+
+    d.baseline = b->median;
+    double noise = std::hypot(medianStdError(b->mad, b->n),
+                              medianStdError(c.mad, c.n));
+    d.allowed = std::max({threshold.relative * b->median,
+                          threshold.sigmas * noise, threshold.minDeltaUs});
+    if (d.delta() > d.allowed)
+      d.status = DiffStatus::regression;
+    else if (-d.delta() > d.allowed)
+      d.status = DiffStatus::improvement;
+    diffs.push_back(d);
+  }
+
+  for (const auto &b : base.entries) {
+    bool produced =
+        std::any_of(current.begin(), current.end(),
+                    [&](const BaselineEntry &c) { return c.key == b.key; });
+    if (!produced) {
+      StageDiff d;
+      d.key = b.key;
+      d.baseline = b.median;
+      d.status = DiffStatus::missing;
+      diffs.push_back(d);
+    }
+  }
+
+  auto rank = [](DiffStatus s) {
+    return s == DiffStatus::missing ? 0 : s == DiffStatus::added ? 2 : 1;
+  };
+  std::stable_sort(diffs.begin(), diffs.end(),
+                   [&](const StageDiff &a, const StageDiff &b) {
+                     if (rank(a.status) != rank(b.status))
+                       return rank(a.status) < rank(b.status);
+                     return a.score() > b.score();
+                   });
+  return diffs;
+}
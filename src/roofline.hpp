@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <vector>
+
+#include <mpi.h>
+
+#include "bench.hpp"
+
+/*! @brief sustainable node-local peaks measured at startup
+ *
+ * Bandwidths follow the STREAM conventions (copy and scale count 2 words per
+ * element, add and triad 3) and are the best of several repetitions. All
+ * ranks run the probe at the same time, so with several ranks per node every
+ * rank measures its share of the node bandwidth, the same share its pipeline
+ * stages get.
+ */
+struct RooflinePeaks {
+  double copyGBs = 0;
+  double scaleGBs = 0;
+  double addGBs = 0;
+  double triadGBs = 0;
+  double gflops = 0;
+
+  //! @brief the bandwidth ceiling of the roofline
+  double bandwidth() const {
+    return std::max({copyGBs, scaleGBs, addGBs, triadGBs});
+  }
+
+  //! @brief attainable GFLOP/s at @p intensity flop per byte
+  double attainable(double intensity) const {
+    return std::min(gflops, intensity * bandwidth());
+  }
+};
+
+namespace detail {
+
+template <class F> double bestSeconds(int reps, F &&f) {
+  double best = 1e30;
+  for (int r = 0; r < reps; ++r) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+  }
+  return best;
+}
+
+} // namespace detail
+
+/*! @brief STREAM copy/scale/add/triad and an FMA-chain throughput probe
+ *
+ * @p arrayBytes per array should be well above the last level cache. The flop
+ * probe keeps 64 independent multiply-add chains per thread in registers and
+ * L1, so it measures what this binary's vectorization achieves rather than
+ * the datasheet peak.
+ */
+inline RooflinePeaks measurePeaks(size_t arrayBytes = size_t(64) << 20,
+                                  int reps = 5) {
+  size_t n = arrayBytes / sizeof(double);
+  std::vector<double> a(n), b(n), c(n);
+  const double s = 3.0;
+
+  // first touch in parallel, matching the static schedule of the kernels
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = 1.0;
+    b[i] = 2.0;
+    c[i] = 0.0;
+  }
+
+  double words = double(n) * sizeof(double) * 1e-9;
+  RooflinePeaks p;
+  p.copyGBs = 2 * words / detail::bestSeconds(reps, [&] {
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; ++i)
+      c[i] = a[i];
+  });
+  p.scaleGBs = 2 * words / detail::bestSeconds(reps, [&] {
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; ++i)
+      b[i] = s * c[i];
+  });
+  p.addGBs = 3 * words / detail::bestSeconds(reps, [&] {
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; ++i)
+      c[i] = a[i] + b[i];
+  });
+  p.triadGBs = 3 * words / detail::bestSeconds(reps, [&] {
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; ++i)
+      a[i] = b[i] + s * c[i];
+  });
+
+  constexpr int lanes = 64;
+  constexpr int iters = 1 << 20;
+  volatile float sink = 0;
+  double seconds = detail::bestSeconds(reps, [&] {
+    float total = 0;
+#pragma omp parallel reduction(+ : total)
+    {
+      float acc[lanes];
+      for (int j = 0; j < lanes; ++j)
+        acc[j] = float(j) * 1e-3f;
+      const float m = 0.999999f, add = 1e-7f;
+      for (int it = 0; it < iters; ++it) {
+#pragma omp simd
+        for (int j = 0; j < lanes; ++j)
+          acc[j] = acc[j] * m + add;
+      }
+      for (int j = 0; j < lanes; ++j)
+        total += acc[j];
+    }
+    sink = total;
+  });
+  (void)sink;
+  p.gflops = 2.0 * lanes * iters * numThreads() * 1e-9 / seconds;
+  return p;
+}
+
+/*! @brief measure once per OpenMP thread count, all ranks together
+ *
+ * Collective over MPI_COMM_WORLD on the first call for a thread count.
+ */
+inline const RooflinePeaks &rooflinePeaks() {
+  static std::map<int, RooflinePeaks> cache;
+  int threads = numThreads();
+  auto it = cache.find(threads);
+  if (it == cache.end()) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    it = cache.emplace(threads, measurePeaks()).first;
+  }
+  return it->second;
+}
@@ -1,97 +1,824 @@
 #include "runner.hpp"
+#include "adjacency.hpp"
+#include "bench.hpp"
+#include "checkpoint.hpp"
 #include "cstone/domain/domain.hpp"
+#include "gravity.hpp"
+#include "halo.hpp"
+#include "knn.hpp"
+#include "memory.hpp"
+#include "neighbors.hpp"
+#include "pair_count.hpp"
+#include "partition.hpp"
+#include "perf_counters.hpp"
+#include "point_location.hpp"
+#include "quantized.hpp"
+#include "range_query.hpp"
+#include "roofline.hpp"
 #include "save_octree.hpp"
+#include "shared_exchange.hpp"
+#include "stages.hpp"
 #include "utils.hpp"
+#include "validate.hpp"
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <mpi.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include <tuple>
 #include <vector>
 #include <numeric>
+#include <optional>
+#include <random>
 #include <span>
 #include <fstream>
+#include <numbers>
+#include <sstream>
+
+//! @brief the codec of @p options, with the bandwidth measured if it adapts
+static ExchangeCodec makeCodec(const CompressOptions &options) {
+  ExchangeCodec codec;
+  codec.keys = options.keys;
+  codec.floats = options.floats;
+  codec.adaptive = options.adaptive;
+  if (codec.enabled() && codec.adaptive)
+    codec.bandwidth = measureBandwidth(MPI_COMM_WORLD);
+  return codec;
+}
+
+//! @brief bytes saved by @p codec over all ranks, and the slowest rank's codec time
+static void reportCodec(const ExchangeCodec &codec, int rank) {
+  if (!codec.enabled())
+    return;
+  unsigned long long bytes[2] = {codec.rawBytes, codec.wireBytes};
+  double seconds[2] = {codec.encodeSeconds, codec.decodeSeconds};
+  MPI_Allreduce(MPI_IN_PLACE, bytes, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, seconds, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  if (rank == 0)
+    std::cout << "\tcompression" << (codec.keys ? " keys" : "") << (codec.floats ? " floats" : "")
+              << (codec.adaptive ? " adaptive" : "") << ": " << bytes[0] / 1048576.0 << " -> "
+              << bytes[1] / 1048576.0 << " MiB (" << 100.0 * (1 - double(bytes[1]) / std::max(bytes[0], 1ull))
+              << "% saved), encode " << seconds[0] * 1e3 << " ms, decode " << seconds[1] * 1e3 << " ms"
+              << (codec.bandwidth > 0 ? ", measured bandwidth " + std::to_string(codec.bandwidth / 1e9) + " GB/s"
+                                      : std::string())
+              << std::endl;
+}
+
+void sfcPartitionSlice(ParticleSlice<Real> &particles, int rank, int numRanks, const CompressOptions &compress) {
+  ExchangeCodec codec = makeCodec(compress);
+  std::vector<Real> *arrays[] = {&particles.ix, &particles.iy, &particles.iz,
+                                 &particles.px, &particles.py, &particles.pz};
+  ExchangeStats stats =
+      sfcPrePartition<KeyType, Real>(std::span<std::vector<Real> *const>(arrays), MPI_COMM_WORLD, &codec);
+
+  // the slice is no longer an index range, keep start/end as offsets of the
+  // rank's share in SFC order
+  unsigned long long count = particles.ix.size(), offset = 0, sent[2] = {stats.particlesSent, stats.bytesSent};
+  MPI_Exscan(&count, &offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, sent, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  double seconds = stats.seconds;
+  MPI_Allreduce(MPI_IN_PLACE, &seconds, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  particles.start = rank == 0 ? 0 : offset;
+  particles.end = particles.start + count;
+
+  if (rank == 0)
+    std::cout << "SFC pre-partition over " << numRanks << " ranks: " << sent[0] << " particles ("
+              << 100.0 * sent[0] / std::max<size_t>(particles.n, 1) << "% off-rank in the index slices), "
+              << sent[1] / 1048576.0 << " MiB in " << seconds * 1e3 << " ms" << std::endl;
+  reportCodec(codec, rank);
+}
+
+void hysteresisBench(const ParticleSlice<Real> &particles, int rank, int numRanks, double tolerance, int steps,
+                     const CompressOptions &compress) {
+  // the particles drift by their perturbation every step, the box spans the
+  // start and the end of the drift so that the splitters stay valid keys
+  std::vector<Real> ex(particles.ix), ey(particles.iy), ez(particles.iz);
+  for (size_t i = 0; i < ex.size(); ++i) {
+    ex[i] += steps * particles.px[i];
+    ey[i] += steps * particles.py[i];
+    ez[i] += steps * particles.pz[i];
+  }
+  cstone::Box<Real> b0 = globalBox(particles.ix, particles.iy, particles.iz, MPI_COMM_WORLD);
+  cstone::Box<Real> b1 = globalBox(ex, ey, ez, MPI_COMM_WORLD);
+  cstone::Box<Real> box(std::min(b0.xmin(), b1.xmin()), std::max(b0.xmax(), b1.xmax()), std::min(b0.ymin(), b1.ymin()),
+                        std::max(b0.ymax(), b1.ymax()), std::min(b0.zmin(), b1.zmin()),
+                        std::max(b0.zmax(), b1.zmax()));
+
+  struct Step {
+    double ms, imbalance;
+    unsigned long long moved;
+    bool resampled;
+  };
+  // full resampling every step, then with hysteresis, from the same start
+  auto run = [&](double tol, ExchangeCodec &codec) {
+    ParticleSlice<Real> p = particles;
+    std::vector<Real> *arrays[] = {&p.ix, &p.iy, &p.iz, &p.px, &p.py, &p.pz};
+    HysteresisSplitters<KeyType> hysteresis{tol};
+    std::vector<KeyType> keys;
+    std::vector<Step> log;
+    for (int s = 0; s < steps; ++s) {
+      MPI_Barrier(MPI_COMM_WORLD);
+      auto t0 = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < p.ix.size(); ++i) {
+        p.ix[i] += p.px[i];
+        p.iy[i] += p.py[i];
+        p.iz[i] += p.pz[i];
+      }
+      keys.resize(p.ix.size());
+      cstone::computeSfcKeys(p.ix.data(), p.iy.data(), p.iz.data(), cstone::sfcKindPointer(keys.data()),
+                             keys.size(), box);
+      bool resampled = hysteresis.update(keys, MPI_COMM_WORLD);
+      ExchangeStats stats = exchangeByKey(keys, hysteresis.splitters, std::span<std::vector<Real> *const>(arrays),
+                                          MPI_COMM_WORLD, &codec);
+      double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e3;
+      unsigned long long moved = stats.particlesSent;
+      MPI_Allreduce(MPI_IN_PLACE, &ms, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      MPI_Allreduce(MPI_IN_PLACE, &moved, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+      log.push_back({ms, hysteresis.imbalance, moved, resampled});
+    }
+    return log;
+  };
+
+  ExchangeCodec codec = makeCodec(compress);
+  std::vector<Step> full = run(-1, codec);
+  std::vector<Step> kept = run(tolerance, codec);
+
+  if (rank == 0) {
+    std::cout << "Rebalance hysteresis over " << numRanks << " ranks and " << steps << " steps, tolerance "
+              << tolerance << "\n";
+    for (int s = 0; s < steps; ++s)
+      std::cout << "\tstep " << s << ": full " << full[s].ms << " ms, imbalance " << full[s].imbalance << ", moved "
+                << full[s].moved << " | hysteresis " << kept[s].ms << " ms, imbalance " << kept[s].imbalance
+                << ", moved " << kept[s].moved << (kept[s].resampled ? ", resampled" : "") << "\n";
+    for (auto *log : {&full, &kept}) {
+      double ms = 0, maxImbalance = 0, meanImbalance = 0;
+      unsigned long long moved = 0;
+      int resamples = 0;
+      for (const Step &st : *log) {
+        ms += st.ms;
+        maxImbalance = std::max(maxImbalance, st.imbalance);
+        meanImbalance += st.imbalance / steps;
+        moved += st.moved;
+        resamples += st.resampled;
+      }
+      std::cout << (log == &full ? "\tfull:       " : "\thysteresis: ") << ms << " ms, " << moved
+                << " particles moved, " << resamples << " resamples, imbalance mean " << meanImbalance << " max "
+                << maxImbalance << "\n";
+    }
+    std::cout << std::flush;
+  }
+  reportCodec(codec, rank);
+}
+
+void sharedExchangeBench(const ParticleSlice<Real> &particles, int rank, int numRanks, int ranksPerNode,
+                         int trials) {
+  // the exchange of the index slices into SFC order, the largest one of a run
+  cstone::Box<Real> box = globalBox(particles.ix, particles.iy, particles.iz, MPI_COMM_WORLD);
+  std::vector<KeyType> keys(particles.ix.size());
+  cstone::computeSfcKeys(particles.ix.data(), particles.iy.data(), particles.iz.data(),
+                         cstone::sfcKindPointer(keys.data()), keys.size(), box);
+  auto splitters = sampleSplitters(std::span<const KeyType>(keys), std::span<const double>{}, MPI_COMM_WORLD);
+  SharedWindowExchange<KeyType, Real> shared(MPI_COMM_WORLD, ranksPerNode);
+
+  // per trial, the max over ranks of the message and the shared window exchange
+  std::vector<double> t[2];
+  ExchangeStats stats[2];
+  for (int trial = 0; trial < trials; ++trial) {
+    std::vector<KeyType> k[2] = {keys, keys};
+    ParticleSlice<Real> p[2] = {particles, particles};
+    for (int mode = 0; mode < 2; ++mode) {
+      std::vector<Real> *arrays[] = {&p[mode].ix, &p[mode].iy, &p[mode].iz,
+                                     &p[mode].px, &p[mode].py, &p[mode].pz};
+      std::span<std::vector<Real> *const> columns(arrays);
+      MPI_Barrier(MPI_COMM_WORLD);
+      stats[mode] = mode == 0 ? exchangeByKey(k[mode], splitters, columns, MPI_COMM_WORLD)
+                              : shared.exchange(k[mode], splitters, columns);
+      double seconds = stats[mode].seconds;
+      MPI_Allreduce(MPI_IN_PLACE, &seconds, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      t[mode].push_back(seconds * 1e3);
+    }
+    if (k[0] != k[1] || p[0].ix != p[1].ix || p[0].iy != p[1].iy || p[0].iz != p[1].iz || p[0].px != p[1].px ||
+        p[0].py != p[1].py || p[0].pz != p[1].pz)
+      throw std::runtime_error("Shared window exchange differs from the message exchange on rank " +
+                               std::to_string(rank));
+  }
+
+  unsigned long long sums[3] = {stats[0].particlesSent, stats[0].bytesSent, stats[1].bytesSent};
+  MPI_Allreduce(MPI_IN_PLACE, sums, 3, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  int nodeSize = shared.nodeSize(), minNode = nodeSize, maxNode = nodeSize;
+  MPI_Allreduce(MPI_IN_PLACE, &minNode, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &maxNode, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  if (rank == 0)
+    std::cout << "Shared window exchange over " << numRanks << " ranks, " << minNode << "-" << maxNode
+              << " ranks per node: " << sums[0] << " particles off-rank\n"
+              << "\tmessages: " << percentile(t[0], 50) << " ms, " << sums[1] / 1048576.0 << " MiB\n"
+              << "\tshared window: " << percentile(t[1], 50) << " ms, " << sums[2] / 1048576.0
+              << " MiB between nodes" << std::endl;
+}
+
+//! @brief the multi-rank options that repartition or exercise the loaded slice before the trials
+static void distributeSlice(ParticleSlice<Real> &particles, int rank, int numRanks, const BenchConfig &cfg) {
+  if (cfg.sharedExchange)
+    sharedExchangeBench(particles, rank, numRanks, cfg.ranksPerNode, cfg.trials);
+  if (cfg.sfcPartition || cfg.sliceCostBalance > 0 || cfg.haloOverlap > 0 || cfg.hysteresis > 0)
+    sfcPartitionSlice(particles, rank, numRanks, cfg.compress);
+  if (cfg.sliceCostBalance > 0)
+    costBalanceSlice(particles, rank, numRanks, cfg.sliceCostBalance, cfg.bucketSize, cfg.bucketSizeFocus, cfg.theta,
+                     cfg.compress);
+  if (cfg.haloOverlap > 0)
+    haloOverlapBench(particles, rank, numRanks, cfg.haloOverlap, cfg.bucketSize, cfg.trials, cfg.compress);
+  if (cfg.hysteresis > 0)
+    hysteresisBench(particles, rank, numRanks, cfg.hysteresis, cfg.trials, cfg.compress);
+}
 
 void runner(HighFive::File &file, std::string group_name, int rank,
-            int numRanks, bool gpu, bool lets, int bucketSize, int bucketSizeFocus,
-            float theta, bool save) {
+            int numRanks, const BenchConfig &cfg) {
   if (!file.exist(group_name))
     throw std::runtime_error("Group does not exist in the dataset file: " +
                              group_name);
 
   auto [ix, iy, iz, px, py, pz] = read_dataset<Real>(file, group_name);
 
-  size_t start = rank * ix.size() / numRanks;
-  size_t end = (rank + 1) * ix.size() / numRanks;
+  ParticleSlice<Real> particles;
+  particles.n = ix.size();
+  particles.start = rank * ix.size() / numRanks;
+  particles.end = (rank + 1) * ix.size() / numRanks;
+
+  size_t start = particles.start;
+  size_t end = particles.end;
 
   std::cout << "Dataset loaded [" << group_name << "] -> n = " << ix.size()
             << ", rank = " << rank << ", subdomain [" << start << ", " << end
             << ")" << std::endl;
 
-  std::vector<Real> ix_local(ix.begin() + start, ix.begin() + end);
-  std::vector<Real> iy_local(iy.begin() + start, iy.begin() + end);
-  std::vector<Real> iz_local(iz.begin() + start, iz.begin() + end);
-  std::vector<Real> px_local(px.begin() + start, px.begin() + end);
-  std::vector<Real> py_local(py.begin() + start, py.begin() + end);
-  std::vector<Real> pz_local(pz.begin() + start, pz.begin() + end);
+  particles.ix.assign(ix.begin() + start, ix.begin() + end);
+  particles.iy.assign(iy.begin() + start, iy.begin() + end);
+  particles.iz.assign(iz.begin() + start, iz.begin() + end);
+  particles.px.assign(px.begin() + start, px.begin() + end);
+  particles.py.assign(py.begin() + start, py.begin() + end);
+  particles.pz.assign(pz.begin() + start, pz.begin() + end);
+
+  distributeSlice(particles, rank, numRanks, cfg);
+
+  if (cfg.scaling != ScalingMode::none)
+    runnerScaling(particles, group_name, rank, numRanks, cfg);
+  else
+    runner(particles, group_name, rank, numRanks, cfg);
+}
+
+void runnerGenerated(std::string spec_name, int rank, int numRanks,
+                     const BenchConfig &cfg) {
+  DistributionSpec spec = parseDistributionSpec(spec_name);
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  ParticleSlice<Real> particles =
+      generateSlice<Real>(spec, rank, numRanks, cfg.seed, cfg.outOfBounds);
+  if (cfg.outOfBounds == OutOfBounds::remove) {
+    // every rank dropped a different number of particles
+    unsigned long long count = particles.ix.size(), offset = 0, total = count;
+    MPI_Exscan(&count, &offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    renumberSlice(particles, rank == 0 ? 0 : offset, total);
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+
+  std::cout << "Generated [" << spec_name << "] -> n = " << particles.n
+            << ", rank = " << rank << ", subdomain [" << particles.start
+            << ", " << particles.end << "), "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count()
+            << "ms" << std::endl;
+
+  distributeSlice(particles, rank, numRanks, cfg);
+
+  if (cfg.scaling != ScalingMode::none)
+    runnerScaling(particles, spec_name, rank, numRanks, cfg);
+  else
+    runner(particles, spec_name, rank, numRanks, cfg);
+}
+
+void runnerScaling(const ParticleSlice<Real> &particles, std::string group_name,
+                   int rank, int numRanks, const BenchConfig &cfg) {
+  std::vector<int> threadCounts = cfg.threadCounts;
+  if (threadCounts.empty())
+    threadCounts.push_back(numThreads());
+  int maxThreads = *std::max_element(threadCounts.begin(), threadCounts.end());
+  int initialThreads = numThreads();
+
+  size_t nPerCore = cfg.nPerCore ? cfg.nPerCore : particles.n / (size_t(maxThreads) * numRanks);
+  if (cfg.scaling == ScalingMode::weak && nPerCore * maxThreads * numRanks > particles.n)
+    throw std::runtime_error("Weak scaling needs " + std::to_string(nPerCore * maxThreads * numRanks) +
+                             " particles, group " + group_name + " has " + std::to_string(particles.n));
+
+  std::vector<int> cores;
+  std::vector<BenchResult> results;
+  for (int threads : threadCounts) {
+#if defined(_OPENMP)
+    omp_set_num_threads(threads);
+#endif
+    if (rank == 0)
+      std::cout << "Scaling (" << scalingName(cfg.scaling) << ") [" << group_name << "] threads = " << threads
+                << ", ranks = " << numRanks << std::endl;
+
+    if (cfg.scaling == ScalingMode::weak) {
+      // every rank keeps its share of nPerCore * cores particles, a random
+      // subsample since the group order is random in space
+      size_t nUsed = nPerCore * threads * numRanks;
+      size_t count = (rank + 1) * nUsed / numRanks - rank * nUsed / numRanks;
+      count = std::min(count, particles.ix.size());
+      ParticleSlice<Real> sub;
+      sub.n = nUsed;
+      sub.start = particles.start;
+      sub.end = particles.start + count;
+      sub.ix.assign(particles.ix.begin(), particles.ix.begin() + count);
+      sub.iy.assign(particles.iy.begin(), particles.iy.begin() + count);
+      sub.iz.assign(particles.iz.begin(), particles.iz.begin() + count);
+      sub.px.assign(particles.px.begin(), particles.px.begin() + count);
+      sub.py.assign(particles.py.begin(), particles.py.begin() + count);
+      sub.pz.assign(particles.pz.begin(), particles.pz.begin() + count);
+      results.push_back(runner(sub, group_name, rank, numRanks, cfg));
+    } else {
+      results.push_back(runner(particles, group_name, rank, numRanks, cfg));
+    }
+    cores.push_back(threads * numRanks);
+  }
+#if defined(_OPENMP)
+  omp_set_num_threads(initialThreads);
+#endif
+
+  // one table per phase and stage, in pipeline order
+  std::vector<std::pair<std::string, std::vector<double>>> series;
+  series.emplace_back("Initial", std::vector<double>{});
+  series.emplace_back("Perturb", std::vector<double>{});
+  for (const auto &[name, stat] : results.front().stages)
+    series.emplace_back(name, std::vector<double>{});
+  for (const auto &r : results) {
+    series[0].second.push_back(r.initial.median);
+    series[1].second.push_back(r.perturb.median);
+    for (size_t i = 2; i < series.size(); ++i) {
+      double median = 0;
+      for (const auto &[name, stat] : r.stages) {
+        if (name == series[i].first)
+          median = stat.median;
+      }
+      series[i].second.push_back(median);
+    }
+  }
+
+  std::ofstream out;
+  if (rank == 0 && cfg.save) {
+    out.open(group_name + "_scaling.csv");
+    out << "scaling,stage,threads,ranks,cores,median_us,speedup,efficiency\n";
+  }
+
+  if (rank == 0) {
+    std::cout << (cfg.scaling == ScalingMode::weak ? "Weak" : "Strong") << " scaling [" << group_name << "]";
+    if (cfg.scaling == ScalingMode::weak)
+      std::cout << ", " << nPerCore << " particles per core";
+    std::cout << std::endl;
+    for (const auto &[name, medians] : series) {
+      std::cout << "\t" << name << std::endl;
+      std::cout << "\t\tthreads\tranks\tmedian(us)\tspeedup\tefficiency" << std::endl;
+      auto rows = scalingTable(cores, medians, cfg.scaling);
+      for (size_t i = 0; i < rows.size(); ++i) {
+        std::cout << "\t\t" << threadCounts[i] << "\t" << numRanks << "\t" << rows[i].median << "\t"
+                  << rows[i].speedup << "\t" << rows[i].efficiency << std::endl;
+        if (out.is_open())
+          out << scalingName(cfg.scaling) << "," << name << "," << threadCounts[i] << "," << numRanks << ","
+              << rows[i].cores << "," << rows[i].median << "," << rows[i].speedup << "," << rows[i].efficiency
+              << "\n";
+      }
+    }
+  }
+}
 
-  std::vector<Real> h(end - start, 0.1);
-  std::vector<KeyType> keys(end - start);
+BenchResult runner(const ParticleSlice<Real> &particles, std::string group_name,
+                   int rank, int numRanks, const BenchConfig &cfg) {
+  const std::vector<Real> &ix_local = particles.ix;
+  const std::vector<Real> &iy_local = particles.iy;
+  const std::vector<Real> &iz_local = particles.iz;
+  const std::vector<Real> &px_local = particles.px;
+  const std::vector<Real> &py_local = particles.py;
+  const std::vector<Real> &pz_local = particles.pz;
 
-  int trials = 10;
+  std::vector<Real> h(ix_local.size(), 0.1);
+  std::vector<KeyType> keys(ix_local.size());
 
-  std::vector<double> t_no_pt (9);
-  std::vector<double> t_pt (9);
+  std::vector<double> t_no_pt;
+  std::vector<double> t_pt;
+
+  PerfCounters counters;
+  if (cfg.perfCounters && !counters.open() && rank == 0)
+    std::cout << "Hardware performance counters unavailable, reporting "
+                 "wall-clock timings only"
+              << std::endl;
+
+  RooflinePeaks peaks;
+  if (cfg.roofline) {
+    peaks = rooflinePeaks();
+    if (rank == 0)
+      std::cout << "Roofline peaks (per rank): copy " << peaks.copyGBs << " GB/s, scale " << peaks.scaleGBs
+                << " GB/s, add " << peaks.addGBs << " GB/s, triad " << peaks.triadGBs << " GB/s, "
+                << peaks.gflops << " GFLOP/s" << std::endl;
+  }
 
-  for (int i = 0; i < trials; i++) {
+  StageRecorder stages(&counters);
+  stages.setMemoryTracking(cfg.memory);
+  std::vector<PerfSample> trialCounters;
+
+  int bucketSize = cfg.bucketSize;
+  int bucketSizeFocus = cfg.bucketSizeFocus;
+  float theta = cfg.theta;
+
+  // validation is untimed but disturbs the caches, only check the first trial
+  bool validateNext = cfg.validate;
+  if (cfg.validate && cfg.gpu && rank == 0)
+    std::cout << "--validate only checks the CPU pipelines" << std::endl;
+
+  // restore the initial sync of an earlier run if every rank has a matching
+  // checkpoint, otherwise the first trial writes one
+  std::optional<DomainCheckpoint<KeyType, Real>> restore;
+  std::string checkpointOut;
+  CheckpointHeader checkpointHeader;
+  double loadMs = 0;
+  if (!cfg.checkpointDir.empty() && (cfg.gpu || !cfg.lets)) {
+    if (rank == 0)
+      std::cout << "--checkpoint only applies to the CPU --lets pipeline" << std::endl;
+  } else if (!cfg.checkpointDir.empty()) {
+    std::string name = group_name;
+    std::replace(name.begin(), name.end(), '/', '_');
+    std::string path = cfg.checkpointDir + "/" + name + "_rank" + std::to_string(rank) + "of" +
+                       std::to_string(numRanks) + ".ckpt";
+    checkpointHeader.rank = rank;
+    checkpointHeader.numRanks = numRanks;
+    unsigned long long numGlobal = ix_local.size();
+    MPI_Allreduce(MPI_IN_PLACE, &numGlobal, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    checkpointHeader.numGlobal = numGlobal;
+    checkpointHeader.bucketSize = bucketSize;
+    checkpointHeader.bucketSizeFocus = bucketSizeFocus;
+    checkpointHeader.theta = theta;
+    checkpointHeader.generator = generatorHash(group_name, cfg.generate, cfg.seed, int(cfg.outOfBounds));
+
+    auto t0 = std::chrono::steady_clock::now();
+    DomainCheckpoint<KeyType, Real> ckpt;
+    int found = readCheckpoint(path, checkpointHeader, ckpt);
+    loadMs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e3;
+    MPI_Allreduce(MPI_IN_PLACE, &found, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &loadMs, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    if (found)
+      restore = std::move(ckpt);
+    else
+      checkpointOut = path;
+    if (rank == 0)
+      std::cout << (found ? "Restoring the particles of the initial sync from " : "Writing the initial sync to ")
+                << cfg.checkpointDir
+                << (found ? ", loaded in " + std::to_string(loadMs) + " ms, the initial sync still runs" : std::string())
+                << std::endl;
+  }
+  // the first restored trial is compared against the run that wrote the
+  // checkpoint, both up to the end of the first perturbed sync
+  bool reportRestore = restore.has_value();
+
+  auto runTrial = [&]() {
     std::pair<double, double> t;
-    if (!gpu && !lets) {
+    if (!cfg.gpu && !cfg.lets) {
       t = runnerCpu(keys, ix_local, iy_local, iz_local, h, px_local, py_local,
                 pz_local, rank, numRanks, bucketSize, bucketSizeFocus, theta,
-                group_name, false);
-    } else if (!gpu && lets) {
+                group_name, false, validateNext, cfg.queries, stages);
+    } else if (!cfg.gpu && cfg.lets) {
       t = runnerCpuMulti(keys, ix_local, iy_local, iz_local, h, px_local, py_local,
                 pz_local, rank, numRanks, bucketSize, bucketSizeFocus, theta,
-                group_name, false);
-    } else if (gpu && !lets) {
+                group_name, false, validateNext, cfg.syncModel, restore ? &*restore : nullptr, checkpointOut,
+                checkpointHeader, stages);
+      checkpointOut.clear();
+      if (reportRestore) {
+        double us[2] = {loadMs * 1e3 + t.first + t.second,
+                        double(restore->header.freshInitialUs) + restore->header.freshPerturbUs};
+        MPI_Allreduce(MPI_IN_PLACE, us, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        if (rank == 0)
+          std::cout << "\tTime to the first perturbed sync, slowest rank: restored " << us[0]
+                    << "us (load, initial and perturbed sync), fresh " << us[1] << "us (initial and perturbed sync)"
+                    << std::endl;
+        reportRestore = false;
+      }
+    } else if (cfg.gpu && !cfg.lets) {
       t = runnerGpu(keys, ix_local, iy_local, iz_local, h, px_local, py_local,
                 pz_local, rank, numRanks, bucketSize, bucketSizeFocus, theta,
                 group_name, false);
-    } else if (gpu && lets) {
+    } else if (cfg.gpu && cfg.lets) {
       t = runnerGpuMulti(keys, ix_local, iy_local, iz_local, h, px_local, py_local,
                 pz_local, rank, numRanks, bucketSize, bucketSizeFocus, theta,
                 group_name, false);
     } else {
       throw std::runtime_error("Invalid combination of gpu and lets flags");
     }
+    validateNext = false;
+    return t;
+  };
+
+  for (int i = 0; i < cfg.warmup; i++) {
+    runTrial();
+  }
+  stages.clear();
+
+  int maxTrials = cfg.ciTarget > 0 ? std::max(cfg.trials, cfg.maxTrials) : cfg.trials;
+  for (int i = 0; i < maxTrials; i++) {
+    PerfSnapshot c0 = counters.snapshot();
+    auto t = runTrial();
+    trialCounters.push_back(counters.delta(c0, counters.snapshot()));
+    t_no_pt.push_back(t.first);
+    t_pt.push_back(t.second);
 
-    if (i != 0) { // skip first trial for warmup
-      t_no_pt[i-1] = t.first;
-      t_pt[i-1] = t.second;
+    if (cfg.ciTarget > 0 && i + 1 >= std::max(cfg.trials, 2)) {
+      // all ranks have to agree, every trial is a collective under --lets
+      double relCi = std::max(summarize(t_no_pt).relCi95(), summarize(t_pt).relCi95());
+      MPI_Allreduce(MPI_IN_PLACE, &relCi, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      if (relCi <= cfg.ciTarget)
+        break;
     }
   }
 
-  double avg_no_pt = std::accumulate(t_no_pt.begin(), t_no_pt.end(), 0.0) / t_no_pt.size();
-  double avg_pt = std::accumulate(t_pt.begin(), t_pt.end(), 0.0) / t_pt.size();
-  double min_no_pt = *std::min_element(t_no_pt.begin(), t_no_pt.end());
-  double min_pt = *std::min_element(t_pt.begin(), t_pt.end());
-  double max_no_pt = *std::max_element(t_no_pt.begin(), t_no_pt.end());
-  double max_pt = *std::max_element(t_pt.begin(), t_pt.end());
-  double stddev_no_pt = std::sqrt(std::accumulate(t_no_pt.begin(), t_no_pt.end(), 0.0, 
-    [avg_no_pt](double acc, double x) { return acc + (x - avg_no_pt) * (x - avg_no_pt); }) / t_no_pt.size());
-  double stddev_pt = std::sqrt(std::accumulate(t_pt.begin(), t_pt.end(), 0.0, 
-    [avg_pt](double acc, double x) { return acc + (x - avg_pt) * (x - avg_pt); }) / t_pt.size());
+  Summary no_pt = summarize(t_no_pt);
+  Summary pt = summarize(t_pt);
 
   if (rank == 0) {
-    std::cout << "No Perturbations: Average time: " << avg_no_pt << "us, Min: " << min_no_pt << "us, Max: " << max_no_pt << "us, StdDev: " << stddev_no_pt << "us" << std::endl;
-    std::cout << "With Perturbations: Average time: " << avg_pt << " us, Min: " << min_pt << "us, Max: " << max_pt << "us, StdDev: " << stddev_pt << "us" << std::endl;
+    std::cout << "No Perturbations: Average time: " << no_pt.avg << "us, Min: " << no_pt.min << "us, Max: " << no_pt.max << "us, StdDev: " << no_pt.stddev
+              << "us, Median: " << no_pt.median << "us, MAD: " << no_pt.mad << "us, CI95: +-" << no_pt.ci95 << "us (" << no_pt.n << " trials)" << std::endl;
+    std::cout << "With Perturbations: Average time: " << pt.avg << " us, Min: " << pt.min << "us, Max: " << pt.max << "us, StdDev: " << pt.stddev
+              << "us, Median: " << pt.median << "us, MAD: " << pt.mad << "us, CI95: +-" << pt.ci95 << "us (" << pt.n << " trials)" << std::endl;
+  }
+
+  // per-stage summary, counters are averaged over the same trials
+  struct StageSummary {
+    Summary time;
+    PerfSample counters;
+    size_t heapPeak = 0;
+    size_t rssPeak = 0;
+    double bytes = 0;
+    double flops = 0;
+    double items = 0;
+    //! min, mean and max of the per-rank medians
+    double rankMin = 0, rankMean = 0, rankMax = 0;
+
+    //! @brief completed work items per second, in millions
+    double mItemsPerS() const { return time.median > 0 ? items / time.median : 0; }
+    double gbs() const { return time.median > 0 ? bytes / (time.median * 1e3) : 0; }
+    double gflops() const { return time.median > 0 ? flops / (time.median * 1e3) : 0; }
+  };
+  // every rank records the same stages in the same order unless a stage was
+  // skipped for lack of particles, reduce across ranks only if they agree
+  unsigned long long stageHash = stages.stages().size();
+  for (const auto &[name, samples] : stages.stages())
+    stageHash = stageHash * 1000003 + std::hash<std::string>{}(name);
+  unsigned long long hashRange[2] = {stageHash, ~stageHash};
+  MPI_Allreduce(MPI_IN_PLACE, hashRange, 2, MPI_UNSIGNED_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+  bool reduceStages = numRanks > 1 && hashRange[0] == stageHash && hashRange[1] == ~stageHash;
+
+  std::vector<StageSummary> stageSummaries;
+  // the harness sync model is not part of Domain::sync, its lines are held
+  // back and printed as a separate block after the measured stages
+  std::vector<std::string> syncModelLines;
+  for (const auto &[name, samples] : stages.stages()) {
+    std::vector<double> us;
+    StageSummary st;
+    for (const auto &sample : samples) {
+      us.push_back(sample.us);
+      st.counters += sample.counters;
+      st.heapPeak = std::max(st.heapPeak, sample.heapPeak);
+      st.rssPeak = std::max(st.rssPeak, sample.rssPeak);
+      st.bytes += sample.bytes;
+      st.flops += sample.flops;
+      st.items += sample.items;
+    }
+    for (auto &v : st.counters.value)
+      v /= samples.size();
+    st.bytes /= samples.size();
+    st.flops /= samples.size();
+    st.items /= samples.size();
+    st.time = summarize(us);
+    if (reduceStages) {
+      MPI_Allreduce(&st.time.median, &st.rankMin, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+      MPI_Allreduce(&st.time.median, &st.rankMax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      MPI_Allreduce(&st.time.median, &st.rankMean, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+      st.rankMean /= numRanks;
+    }
+    stageSummaries.push_back(st);
+
+    if (rank == 0) {
+      const PerfSample &mean = st.counters;
+      std::ostringstream line;
+      line << "\t" << name << ": Average time: " << st.time.avg << "us, Min: " << st.time.min << "us, Max: " << st.time.max << "us, StdDev: " << st.time.stddev
+                << "us, Median: " << st.time.median << "us";
+      if (mean.present[kCycles])
+        line << ", IPC: " << mean.ipc();
+      if (mean.present[kLlcMisses])
+        line << ", LLC misses: " << mean.value[kLlcMisses];
+      if (mean.present[kDtlbMisses])
+        line << ", dTLB misses: " << mean.value[kDtlbMisses];
+      if (mean.present[kMemBytes])
+        line << ", DRAM GB/s: " << mean.value[kMemBytes] / (st.time.avg * 1e3);
+      if (cfg.memory)
+        line << ", Peak heap: " << toMiB(st.heapPeak) << "Mb, Peak RSS: " << toMiB(st.rssPeak) << "Mb";
+      if (st.items > 0)
+        line << ", Rate: " << st.mItemsPerS() << " M/s";
+      if (reduceStages)
+        line << ", Ranks min/mean/max: " << st.rankMin << "/" << st.rankMean << "/" << st.rankMax << "us";
+      if (name.find("/SyncModel/") != std::string::npos)
+        syncModelLines.push_back(line.str());
+      else
+        std::cout << line.str() << std::endl;
+    }
+  }
+  if (rank == 0 && !syncModelLines.empty()) {
+    std::cout << "\tHarness sync model (not phases of cstone::Domain::sync):" << std::endl;
+    for (const auto &line : syncModelLines)
+      std::cout << "\t" << line << std::endl;
+  }
+
+  if (rank == 0 && cfg.roofline) {
+    // the roofline uses medians, bytes and flops are the per-trial model
+    std::cout << "\tRoofline (peak BW " << peaks.bandwidth() << " GB/s, " << peaks.gflops << " GFLOP/s)" << std::endl;
+    for (size_t i = 0; i < stageSummaries.size(); i++) {
+      const auto &st = stageSummaries[i];
+      if (st.bytes == 0)
+        continue;
+      double intensity = st.flops / st.bytes;
+      std::cout << "\t\t" << stages.stages()[i].first << " at " << 100 * st.gbs() / peaks.bandwidth()
+                << "% of peak BW (" << st.gbs() << " GB/s, " << st.bytes * 1e-6 << " MB)";
+      if (st.flops > 0)
+        std::cout << ", " << st.gflops() << " GFLOP/s at " << intensity << " flop/B, "
+                  << 100 * st.gflops() / peaks.attainable(intensity) << "% of roofline";
+      std::cout << std::endl;
+    }
+  }
+
+  if (rank == 0 && !stages.buffers().empty()) {
+    std::cout << "\tBuffers:";
+    for (const auto &[name, bytes] : stages.buffers())
+      std::cout << " " << name << "=" << toMiB(bytes) << "Mb";
+    std::cout << std::endl;
   }
 
-  if (save) {
+  auto writeCounters = [](std::ofstream &out, const PerfSample &sample) {
+    for (int e = 0; e < kNumPerfEvents; ++e) {
+      out << ",";
+      if (sample.present[e])
+        out << sample.value[e];
+    }
+    out << ",";
+    if (sample.present[kCycles] && sample.present[kInstructions])
+      out << sample.ipc();
+  };
+
+  if (cfg.save) {
     std::ofstream out(group_name + "_timings.csv");
-    out << "trial,no_pt_us,pt_us\n";
-    for (size_t i = 0; i < t_no_pt.size(); i++)      out << (i+1) << "," << t_no_pt[i] << "," << t_pt[i] << "\n";
+    out << "trial,no_pt_us,pt_us";
+    for (int e = 0; e < kNumPerfEvents; ++e)
+      out << "," << perfEventName(e);
+    out << ",ipc\n";
+    for (size_t i = 0; i < t_no_pt.size(); i++) {
+      out << (i+1) << "," << t_no_pt[i] << "," << t_pt[i];
+      writeCounters(out, trialCounters[i]);
+      out << "\n";
+    }
     out.close();
+
+    std::ofstream stageOut(group_name + "_stages.csv");
+    stageOut << "stage,avg_us,min_us,max_us,stddev_us,median_us,mad_us";
+    for (int e = 0; e < kNumPerfEvents; ++e)
+      stageOut << "," << perfEventName(e);
+    stageOut << ",ipc,heap_peak_bytes,rss_peak_bytes,model_bytes,model_flops,gb_per_s,pct_peak_bw,items,"
+                "mitems_per_s,rank_min_us,rank_mean_us,rank_max_us\n";
+    for (size_t i = 0; i < stageSummaries.size(); i++) {
+      const auto &st = stageSummaries[i];
+      stageOut << stages.stages()[i].first << "," << st.time.avg << "," << st.time.min
+               << "," << st.time.max << "," << st.time.stddev << "," << st.time.median
+               << "," << st.time.mad;
+      writeCounters(stageOut, st.counters);
+      stageOut << ",";
+      if (cfg.memory)
+        stageOut << st.heapPeak << "," << st.rssPeak;
+      else
+        stageOut << ",";
+      stageOut << ",";
+      if (st.bytes > 0) {
+        stageOut << st.bytes << "," << st.flops << "," << st.gbs() << ",";
+        if (cfg.roofline)
+          stageOut << 100 * st.gbs() / peaks.bandwidth();
+      } else {
+        stageOut << ",,,";
+      }
+      stageOut << ",";
+      if (st.items > 0)
+        stageOut << st.items << "," << st.mItemsPerS();
+      else
+        stageOut << ",";
+      stageOut << ",";
+      if (reduceStages)
+        stageOut << st.rankMin << "," << st.rankMean << "," << st.rankMax;
+      else
+        stageOut << ",,";
+      stageOut << "\n";
+    }
+
+    if (!stages.buffers().empty()) {
+      std::ofstream memOut(group_name + "_memory.csv");
+      memOut << "buffer,bytes\n";
+      for (const auto &[name, bytes] : stages.buffers())
+        memOut << name << "," << bytes << "\n";
+    }
+  }
+
+  if (rank == 0 && !cfg.jsonPath.empty()) {
+    std::ofstream out(cfg.jsonPath, std::ios::app);
+    JsonWriter json(out);
+    json.beginObject();
+    json.field("group", group_name)
+        .field("timestamp", timestamp())
+        .field("git_hash", PCA_GIT_HASH)
+        .field("host", hostName())
+        .field("mode", std::string(cfg.gpu ? "gpu" : "cpu") + (cfg.lets ? "_multi" : ""))
+        .field("source", cfg.generate ? "generated" : "hdf5")
+        .field("seed", cfg.seed)
+        .field("n", particles.n)
+        .field("n_local", ix_local.size())
+        .field("ranks", numRanks)
+        .field("threads", numThreads())
+        .field("bucket_size", cfg.bucketSize)
+        .field("bucket_size_focus", cfg.bucketSizeFocus)
+        .field("theta", cfg.theta)
+        .field("warmup", cfg.warmup)
+        .field("ci_target", cfg.ciTarget)
+        .field("scaling", scalingName(cfg.scaling));
+
+    if (cfg.roofline) {
+      json.key("roofline").beginObject();
+      json.field("copy_gb_per_s", peaks.copyGBs)
+          .field("scale_gb_per_s", peaks.scaleGBs)
+          .field("add_gb_per_s", peaks.addGBs)
+          .field("triad_gb_per_s", peaks.triadGBs)
+          .field("gflops", peaks.gflops);
+      json.endObject();
+    }
+
+    json.key("phases").beginObject();
+    json.key("Initial").beginObject();
+    writeSummary(json, no_pt);
+    json.array("samples_us", t_no_pt).endObject();
+    json.key("Perturb").beginObject();
+    writeSummary(json, pt);
+    json.array("samples_us", t_pt).endObject();
+    json.endObject();
+
+    json.key("stages").beginObject();
+    for (size_t i = 0; i < stageSummaries.size(); i++) {
+      const auto &st = stageSummaries[i];
+      json.key(stages.stages()[i].first).beginObject();
+      writeSummary(json, st.time);
+      for (int e = 0; e < kNumPerfEvents; ++e) {
+        if (st.counters.present[e])
+          json.field(perfEventName(e), st.counters.value[e]);
+      }
+      if (cfg.memory)
+        json.field("heap_peak_bytes", st.heapPeak).field("rss_peak_bytes", st.rssPeak);
+      if (st.bytes > 0) {
+        json.field("model_bytes", st.bytes).field("model_flops", st.flops).field("gb_per_s", st.gbs());
+        if (cfg.roofline)
+          json.field("pct_peak_bw", 100 * st.gbs() / peaks.bandwidth());
+      }
+      if (st.items > 0)
+        json.field("items", st.items).field("mitems_per_s", st.mItemsPerS());
+      if (reduceStages)
+        json.field("rank_min_us", st.rankMin).field("rank_mean_us", st.rankMean).field("rank_max_us", st.rankMax);
+      json.endObject();
+    }
+    json.endObject();
+
+    if (!stages.buffers().empty()) {
+      json.key("buffers").beginObject();
+      for (const auto &[name, bytes] : stages.buffers())
+        json.field(name, bytes);
+      json.endObject();
+    }
+    json.endObject();
+    out << "\n";
   }
+
+  BenchResult result{no_pt, pt, {}};
+  for (size_t i = 0; i < stageSummaries.size(); i++)
+    result.stages.emplace_back(stages.stages()[i].first, stageSummaries[i].time);
+  return result;
+}
+
+//! @brief print the --validate result of one phase, throw if an invariant is violated
+static void reportValidation(const std::string &phase, int rank, const ValidationReport &report) {
+  if (!report.ok())
+    throw std::runtime_error("Tree validation failed after " + phase + " on rank " + std::to_string(rank) + ":\n" +
+                             report.summary());
+  if (rank == 0)
+    std::cout << "\tValidation " << phase << ": " << report.summary() << std::endl;
 }
 
 void processCpu(cstone::Box<Real> &box, 
@@ -106,34 +833,622 @@ void processCpu(cstone::Box<Real> &box,
   std::vector<KeyType> &d_tree, std::vector<KeyType> &tmpTree, 
   cstone::OctreeData<KeyType, cstone::CpuTag> &octreeData, 
   std::vector<Real> &d_x, std::vector<Real> &d_y, std::vector<Real> &d_z, 
-  int bucketSize, size_t np) {
+  int bucketSize, size_t np, StageRecorder &stages) {
 
-  cstone::computeSfcKeys(rawPtr(d_x), rawPtr(d_y), rawPtr(d_z), cstone::sfcKindPointer(rawPtr(d_keys)), np, box);
-  std::iota(d_ordering.begin(), d_ordering.end(), 0);
-  cstone::sort_by_key(d_keys.begin(), d_keys.end(), d_ordering.begin());
+  // addWork() records the compulsory memory traffic of each stage for the
+  // roofline report: every array is read or written once, random gathers
+  // count the element and not the cache line. Real traffic is higher where a
+  // stage makes several passes, a low fraction of peak points there.
+  stages.time("ComputeKeys", [&]() {
+    cstone::computeSfcKeys(rawPtr(d_x), rawPtr(d_y), rawPtr(d_z), cstone::sfcKindPointer(rawPtr(d_keys)), np, box);
+  });
+  // read x, y, z and write the key; normalize and scale each coordinate
+  stages.addWork("ComputeKeys", np * (3 * sizeof(Real) + sizeof(KeyType)), 9.0 * np);
 
-  cstone::gatherCpu(std::span(d_ordering.data(), np), d_x.data(), tmp.data());
-  std::swap(d_x, tmp);
-  cstone::gatherCpu(std::span(d_ordering.data(), np), d_y.data(), tmp.data());
-  std::swap(d_x, tmp);
-  cstone::gatherCpu(std::span(d_ordering.data(), np), d_z.data(), tmp.data());
-  std::swap(d_x, tmp);
+  stages.time("SortKeys", [&]() {
+    std::iota(d_ordering.begin(), d_ordering.end(), 0);
+    cstone::sort_by_key(d_keys.begin(), d_keys.end(), d_ordering.begin());
+  });
+  // write the ordering, then read and write each key/value pair once
+  stages.addWork("SortKeys", np * (sizeof(unsigned) + 2 * (sizeof(KeyType) + sizeof(unsigned))), 0);
 
-  if (d_tree.size() == 0)
-  {
-      // initial guess on first call. use previous tree as guess on subsequent calls
-      d_tree = std::vector<KeyType>{0, cstone::nodeRange<KeyType>(0)};
-      d_counts = std::vector<unsigned>{unsigned(np)};
+  stages.time("ReorderXYZK", [&]() {
+    cstone::gatherCpu(std::span(d_ordering.data(), np), d_x.data(), tmp.data());
+    std::swap(d_x, tmp);
+    cstone::gatherCpu(std::span(d_ordering.data(), np), d_y.data(), tmp.data());
+    std::swap(d_y, tmp);
+    cstone::gatherCpu(std::span(d_ordering.data(), np), d_z.data(), tmp.data());
+    std::swap(d_z, tmp);
+  });
+  // per coordinate: read the ordering and the source, write the destination
+  stages.addWork("ReorderXYZK", 3.0 * np * (sizeof(unsigned) + 2 * sizeof(Real)), 0);
+
+  double leafPassBytes = 0;
+  stages.time("UpdateLeaves", [&]() {
+    if (d_tree.size() == 0)
+    {
+        // initial guess on first call. use previous tree as guess on subsequent calls
+        d_tree = std::vector<KeyType>{0, cstone::nodeRange<KeyType>(0)};
+        d_counts = std::vector<unsigned>{unsigned(np)};
+    }
+
+    bool converged = false;
+    while (!converged) {
+      // per leaf: tree key, two key probes, count, rebalance op and its scan, new tree key
+      leafPassBytes += double(d_tree.size()) * (4 * sizeof(KeyType) + 4 * sizeof(unsigned));
+      converged = cstone::updateOctree<KeyType>({rawPtr(d_keys), d_keys.size()}, bucketSize, d_tree, d_counts);
+    }
+  });
+  stages.addWork("UpdateLeaves", leafPassBytes, 0);
+
+  stages.time("UpdateInternal", [&]() {
+    octreeData.resize(cstone::nNodes(d_tree));
+    cstone::updateInternalTree({d_tree.data(), d_tree.size()}, octreeData.data());
+
+    d_layout.resize(d_counts.size() + 1);
+    d_layout[0] = cstone::LocalIndex(0);
+    std::inclusive_scan(d_counts.begin(), d_counts.end(), d_layout.begin() + 1);
+  });
+  // per node: sort prefixes with their index, write the four link arrays;
+  // per leaf: read the count and write the layout
+  double nodeBytes = 2 * (sizeof(KeyType) + sizeof(cstone::TreeNodeIndex)) + 4 * sizeof(cstone::TreeNodeIndex);
+  double leafBytes = sizeof(unsigned) + sizeof(cstone::LocalIndex);
+  stages.addWork("UpdateInternal", octreeData.numNodes * nodeBytes + d_counts.size() * leafBytes, 0);
+}
+
+//! @brief processCpu's buffers and tree for a neighbor search outside the timed pipeline
+struct SearchTree {
+  std::vector<KeyType> keys, keysTmp, leaves, tmpTree;
+  std::vector<unsigned> ordering, valuesTmp, counts;
+  std::vector<Real> x, y, z, tmp;
+  std::vector<char> cubTmpStorage;
+  std::vector<cstone::TreeNodeIndex> workArray;
+  std::vector<cstone::LocalIndex> layout;
+  cstone::OctreeData<KeyType, cstone::CpuTag> octreeData;
+  std::vector<cstone::Vec3<Real>> centers, sizes;
+  //! sorted position of each input particle, the inverse of ordering
+  std::vector<cstone::LocalIndex> position;
+
+  //! @brief sort the first @p np of @p ix, @p iy, @p iz into x, y, z and build the tree over them
+  void build(std::span<const Real> ix, std::span<const Real> iy, std::span<const Real> iz, size_t np,
+             cstone::Box<Real> box, int bucketSize) {
+    keys.resize(np), keysTmp.resize(np), ordering.resize(np), valuesTmp.resize(np), tmp.resize(np);
+    x.assign(ix.begin(), ix.begin() + np), y.assign(iy.begin(), iy.begin() + np), z.assign(iz.begin(), iz.begin() + np);
+    uint64_t tempStorageEle = cstone::sortByKeyTempStorage<KeyType, cstone::LocalIndex>(np);
+    cubTmpStorage.resize(tempStorageEle);
+    StageRecorder untimed;
+    processCpu(box, keys, keysTmp, ordering, valuesTmp, tmp, cubTmpStorage, tempStorageEle, counts, workArray, layout,
+               leaves, tmpTree, octreeData, x, y, z, bucketSize, np, untimed);
+
+    auto octree = octreeData.data();
+    centers.resize(octree.numNodes), sizes.resize(octree.numNodes);
+    cstone::nodeFpCenters<KeyType>({octree.prefixes, size_t(octree.numNodes)}, centers.data(), sizes.data(), box);
+    position.resize(np);
+    for (size_t i = 0; i < np; ++i)
+      position[ordering[i]] = cstone::LocalIndex(i);
+  }
+
+  cstone::OctreeNsView<Real, KeyType> nsView() {
+    auto octree = octreeData.data();
+    return {.prefixes = octree.prefixes,
+            .childOffsets = octree.childOffsets,
+            .internalToLeaf = octree.internalToLeaf,
+            .levelRange = octree.levelRange,
+            .layout = layout.data(),
+            .centers = centers.data(),
+            .sizes = sizes.data()};
   }
 
-  while (!cstone::updateOctree<KeyType>({rawPtr(d_keys), d_keys.size()}, bucketSize, d_tree, d_counts));
+  //! @brief neighbor counts within 2h of the input particles @p which, in their order
+  std::vector<unsigned> countNeighbors(std::span<const cstone::LocalIndex> which, Real h, const cstone::Box<Real> &box) {
+    std::vector<cstone::LocalIndex> sorted(which.size());
+    for (size_t k = 0; k < which.size(); ++k)
+      sorted[k] = position[which[k]];
+    std::vector<Real> hh(x.size(), h);
+    std::vector<unsigned> result(which.size());
+    ::countNeighbors(x.data(), y.data(), z.data(), hh.data(), nsView(), box,
+                     std::span<const cstone::LocalIndex>(sorted), std::span<unsigned>(result));
+    return result;
+  }
+};
+
+//! @brief the h at which a particle at the mean density of @p n particles in @p box has @p ngTarget neighbors in 2h
+static Real meanDensityH(const cstone::Box<Real> &box, size_t n, unsigned ngTarget) {
+  double volume = double(box.lx()) * box.ly() * box.lz();
+  return Real(0.5 * std::cbrt(3.0 * ngTarget * volume / (4 * std::numbers::pi * std::max<size_t>(n, 1))));
+}
+
+/*! @brief per-particle neighbor counts within 2h of the local particles, in
+ *         their input order, and the seconds spent counting
+ *
+ * One h for all particles makes the count, and the time, grow with the local
+ * density like an SPH step before h has adapted. The halos within 2h are
+ * exchanged first, so that particles near a rank boundary count their
+ * neighbors on other ranks too.
+ */
+static double neighborCost(const std::vector<Real> &x, const std::vector<Real> &y, const std::vector<Real> &z,
+                           cstone::Box<Real> box, Real h, int bucketSize, std::vector<double> &cost) {
+  size_t np = x.size();
+  HaloExchange<KeyType, Real> halos(x, y, z, 2 * h, MPI_COMM_WORLD);
+  std::vector<Real> hx(x), hy(y), hz(z);
+  halos.start(hx.data(), hy.data(), hz.data());
+  halos.finish(hx, hy, hz);
+  SearchTree tree;
+  tree.build(hx, hy, hz, hx.size(), box, bucketSize);
+  std::vector<cstone::LocalIndex> all(np);
+  std::iota(all.begin(), all.end(), cstone::LocalIndex(0));
+
+  auto t0 = std::chrono::steady_clock::now();
+  std::vector<unsigned> neighbors = tree.countNeighbors(all, h, box);
+  auto t1 = std::chrono::steady_clock::now();
+
+  cost.assign(neighbors.begin(), neighbors.end());
+  return std::chrono::duration<double>(t1 - t0).count();
+}
+
+void costBalanceSlice(ParticleSlice<Real> &particles, int rank, int numRanks, unsigned ngTarget, int bucketSize,
+                      int bucketSizeFocus, float theta, const CompressOptions &compress) {
+  cstone::Box<Real> box = globalBox(particles.ix, particles.iy, particles.iz, MPI_COMM_WORLD);
+  Real h = meanDensityH(box, particles.n, ngTarget);
+
+  // max / mean over the ranks of the count time, the neighbor sum and the
+  // particle count
+  auto imbalance = [&](double seconds, const std::vector<double> &cost) {
+    double local[3] = {seconds, std::accumulate(cost.begin(), cost.end(), 0.0), double(cost.size())};
+    double max[3], sum[3];
+    MPI_Allreduce(local, max, 3, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(local, sum, 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    std::array<double, 3> ratio;
+    for (int k = 0; k < 3; ++k)
+      ratio[k] = sum[k] > 0 ? max[k] * numRanks / sum[k] : 1;
+    return ratio;
+  };
+
+  std::vector<double> cost;
+  auto before = imbalance(neighborCost(particles.ix, particles.iy, particles.iz, box, h, bucketSize, cost), cost);
+
+  std::vector<KeyType> keys(particles.ix.size());
+  cstone::computeSfcKeys(particles.ix.data(), particles.iy.data(), particles.iz.data(),
+                         cstone::sfcKindPointer(keys.data()), keys.size(), box);
+  auto splitters = sampleSplitters(std::span<const KeyType>(keys), std::span<const double>(cost), MPI_COMM_WORLD);
+  std::vector<Real> *arrays[] = {&particles.ix, &particles.iy, &particles.iz,
+                                 &particles.px, &particles.py, &particles.pz};
+  ExchangeCodec codec = makeCodec(compress);
+  exchangeByKey(keys, splitters, std::span<std::vector<Real> *const>(arrays), MPI_COMM_WORLD, &codec);
+
+  unsigned long long count = particles.ix.size(), offset = 0;
+  MPI_Exscan(&count, &offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  particles.start = rank == 0 ? 0 : offset;
+  particles.end = particles.start + count;
+
+  auto after = imbalance(neighborCost(particles.ix, particles.iy, particles.iz, box, h, bucketSize, cost), cost);
+
+  // the weighted splitters only partition the harness slice, the Domain
+  // assigns by particle count in its own sync; measure what it keeps
+  cstone::Domain<KeyType, Real, cstone::CpuTag> domain(rank, numRanks, bucketSize, bucketSizeFocus, theta);
+  std::vector<KeyType> dk(particles.ix.size());
+  std::vector<Real> dx(particles.ix), dy(particles.iy), dz(particles.iz), dh(dx.size(), h), s1, s2, s3;
+  domain.sync(dk, dx, dy, dz, dh, std::tuple{}, std::tie(s1, s2, s3));
+  auto assigned = [&](const std::vector<Real> &v) {
+    return std::vector<Real>(v.begin() + domain.startIndex(), v.begin() + domain.endIndex());
+  };
+  std::vector<Real> ax = assigned(dx), ay = assigned(dy), az = assigned(dz);
+  auto synced = imbalance(neighborCost(ax, ay, az, box, h, bucketSize, cost), cost);
 
-  octreeData.resize(cstone::nNodes(d_tree));
-  cstone::updateInternalTree({d_tree.data(), d_tree.size()}, octreeData.data());
+  if (rank == 0) {
+    auto line = [](const char *label, const std::array<double, 3> &r) {
+      std::cout << "\t" << label << ": time " << r[0] << ", neighbors " << r[1] << ", particles " << r[2] << "\n";
+    };
+    std::cout << "Cost balance of the harness slice at h = " << h << " (" << ngTarget
+              << " neighbors on average, one global h, halos within 2h included), max/mean over " << numRanks
+              << " ranks:\n";
+    line("count splitters", before);
+    line("cost splitters", after);
+    line("after Domain::sync", synced);
+    std::cout << std::flush;
+  }
+  reportCodec(codec, rank);
+}
+
+void haloOverlapBench(const ParticleSlice<Real> &particles, int rank, int numRanks, unsigned ngTarget, int bucketSize,
+                      int trials, const CompressOptions &compress) {
+  cstone::Box<Real> box = globalBox(particles.ix, particles.iy, particles.iz, MPI_COMM_WORLD);
+  Real h = meanDensityH(box, particles.n, ngTarget);
+  size_t np = particles.ix.size();
+  ExchangeCodec codec = makeCodec(compress);
+  HaloExchange<KeyType, Real> halos(particles.ix, particles.iy, particles.iz, 2 * h, MPI_COMM_WORLD, &codec);
+
+  std::vector<cstone::LocalIndex> all(np);
+  std::iota(all.begin(), all.end(), cstone::LocalIndex(0));
+  std::vector<Real> x, y, z;
+  SearchTree localTree, fullTree;
+  std::vector<unsigned> reference, overlapped(np);
+
+  // per trial, the max over ranks of: blocking exchange, blocking total,
+  // exchange left after the interior search, overlapped total
+  std::vector<double> t[4];
+  auto seconds = [](auto a, auto b) { return std::chrono::duration<double>(b - a).count(); };
+  for (int trial = 0; trial < trials; ++trial) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto t0 = std::chrono::steady_clock::now();
+    x = particles.ix, y = particles.iy, z = particles.iz;
+    halos.start(x.data(), y.data(), z.data());
+    halos.finish(x, y, z);
+    auto t1 = std::chrono::steady_clock::now();
+    fullTree.build(x, y, z, x.size(), box, bucketSize);
+    reference = fullTree.countNeighbors(all, h, box);
+    auto t2 = std::chrono::steady_clock::now();
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto t3 = std::chrono::steady_clock::now();
+    x = particles.ix, y = particles.iy, z = particles.iz;
+    halos.start(x.data(), y.data(), z.data());
+    localTree.build(x, y, z, np, box, bucketSize);
+    std::vector<unsigned> inner = localTree.countNeighbors(halos.interior(), h, box);
+    auto t4 = std::chrono::steady_clock::now();
+    halos.finish(x, y, z);
+    auto t5 = std::chrono::steady_clock::now();
+    fullTree.build(x, y, z, x.size(), box, bucketSize);
+    std::vector<unsigned> outer = fullTree.countNeighbors(halos.boundary(), h, box);
+    auto t6 = std::chrono::steady_clock::now();
+
+    for (size_t k = 0; k < inner.size(); ++k)
+      overlapped[halos.interior()[k]] = inner[k];
+    for (size_t k = 0; k < outer.size(); ++k)
+      overlapped[halos.boundary()[k]] = outer[k];
+    if (overlapped != reference)
+      throw std::runtime_error("Overlapped halo search differs from the blocking one on rank " +
+                               std::to_string(rank));
 
-  d_layout.resize(d_counts.size() + 1);
-  d_layout[0] = cstone::LocalIndex(0);
-  std::inclusive_scan(d_counts.begin(), d_counts.end(), d_layout.begin() + 1);
+    double local[4] = {seconds(t0, t1), seconds(t0, t2), seconds(t4, t5), seconds(t3, t6)};
+    MPI_Allreduce(MPI_IN_PLACE, local, 4, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    for (int k = 0; k < 4; ++k)
+      t[k].push_back(local[k] * 1e3);
+  }
+
+  unsigned long long counts[3] = {np, halos.interior().size(), halos.numHalos()};
+  MPI_Allreduce(MPI_IN_PLACE, counts, 3, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (rank == 0) {
+    double exchange = percentile(t[0], 50), exposed = percentile(t[2], 50);
+    std::cout << "Halo overlap over " << numRanks << " ranks at h = " << h << ": " << 100.0 * counts[1] / counts[0]
+              << "% interior, " << double(counts[2]) / counts[0] << " halos per particle\n"
+              << "\tblocking: exchange " << exchange << " ms, total " << percentile(t[1], 50) << " ms\n"
+              << "\toverlapped: exchange exposed " << exposed << " ms, total " << percentile(t[3], 50)
+              << " ms, hidden " << 100.0 * std::max(exchange - exposed, 0.0) / std::max(exchange, 1e-9) << "%"
+              << std::endl;
+  }
+  reportCodec(codec, rank);
+}
+
+//! @brief the sorted particles and the tree processCpu leaves behind
+struct CpuTree {
+  const cstone::Box<Real> &box;
+  std::span<const KeyType> leaves;
+  std::span<const cstone::LocalIndex> layout;
+  cstone::OctreeView<KeyType> octree;
+  std::span<const Real> x, y, z;
+};
+
+//! @brief run the enabled queries on @p tree as stages of the current phase
+static void runQueries(const QueryOptions &queries, const CpuTree &tree, float theta, int rank,
+                       StageRecorder &stages) {
+  size_t np = tree.layout.back();
+
+  std::vector<cstone::Vec3<Real>> centers, sizes;
+  if (queries.neighbors > 0 || queries.adaptH > 0) {
+    centers.resize(tree.octree.numNodes);
+    sizes.resize(tree.octree.numNodes);
+    stages.time("NodeCenters", [&]() {
+      cstone::nodeFpCenters<KeyType>({tree.octree.prefixes, size_t(tree.octree.numNodes)}, centers.data(),
+                                     sizes.data(), tree.box);
+    });
+  }
+  cstone::OctreeNsView<Real, KeyType> nsView{.prefixes = tree.octree.prefixes,
+                                             .childOffsets = tree.octree.childOffsets,
+                                             .internalToLeaf = tree.octree.internalToLeaf,
+                                             .levelRange = tree.octree.levelRange,
+                                             .layout = tree.layout.data(),
+                                             .centers = centers.data(),
+                                             .sizes = sizes.data()};
+
+  if (queries.neighbors > 0) {
+    std::vector<Real> h(np);
+    stages.time("NeighborSetup", [&]() {
+      leafSmoothingLengths(tree.leaves, tree.layout, tree.box, queries.neighbors, std::span<Real>(h));
+    });
+
+    NeighborList list;
+    float us = stages.time("FindNeighbors", [&]() {
+      list = findNeighborsCsr(tree.x.data(), tree.y.data(), tree.z.data(), h.data(), nsView, tree.layout, tree.box,
+                              2 * queries.neighbors);
+    });
+    stages.addItems("FindNeighbors", list.neighbors.size());
+
+    if (rank == 0)
+      std::cout << "\tNeighbors within 2h: " << list.neighbors.size() << " ("
+                << double(list.neighbors.size()) / std::max<size_t>(np, 1) << " per particle), "
+                << list.neighbors.size() / std::max(us, 1.0f) << " M neighbors/s" << std::endl;
+  }
+
+  if (queries.adaptH > 0 && np > 0) {
+    std::vector<Real> h(np);
+    stages.time("NeighborSetup", [&]() {
+      leafSmoothingLengths(tree.leaves, tree.layout, tree.box, queries.adaptH, std::span<Real>(h));
+    });
+
+    HAdaptStats hStats;
+    stages.time("AdaptH", [&]() {
+      hStats = adaptSmoothingLengths(tree.x.data(), tree.y.data(), tree.z.data(), std::span<Real>(h), nsView,
+                                     tree.layout, tree.box, queries.adaptH, 0.05, 30);
+    });
+    stages.addItems("AdaptH", std::accumulate(hStats.active.begin(), hStats.active.end(), size_t(0)));
+
+    if (rank == 0) {
+      std::cout << "\th adaptation to " << queries.adaptH << " +- 5% neighbors: " << hStats.iterations()
+                << " iterations, " << hStats.unconverged << " unconverged\n\t\titeration  active  ms  M searches/s\n";
+      for (unsigned it = 0; it < hStats.iterations(); ++it)
+        std::cout << "\t\t" << it << "  " << hStats.active[it] << "  " << 1e3 * hStats.seconds[it] << "  "
+                  << hStats.active[it] / std::max(hStats.seconds[it], 1e-9) * 1e-6 << "\n";
+      std::cout << std::flush;
+    }
+  }
+
+  std::vector<NodeBox<Real>> boxes;
+  if (queries.knn > 0 || queries.ranges > 0 || queries.gravity || queries.pairBins > 0) {
+    stages.time("NodeBoxes", [&]() {
+      boxes = computeNodeBoxes(tree.octree, tree.layout, tree.x.data(), tree.y.data(), tree.z.data());
+    });
+  }
+
+  if (queries.knn > 0) {
+    KnnResult<Real> knn;
+    float us = stages.time("Knn", [&]() {
+      knn = findKnn(tree.x.data(), tree.y.data(), tree.z.data(), tree.octree, tree.layout,
+                    std::span<const NodeBox<Real>>(boxes), queries.knn);
+    });
+    stages.addItems("Knn", np);
+
+    if (rank == 0)
+      std::cout << "\tk-NN (k = " << queries.knn << "): " << np / std::max(us, 1.0f) << " M queries/s, "
+                << double(knn.distanceEvaluations) / std::max<size_t>(np, 1) << " distance evaluations per query"
+                << std::endl;
+  }
+
+  std::vector<NodeParticles> particles;
+  if (queries.ranges > 0 || queries.pairBins > 0) {
+    stages.time("NodeParticles", [&]() { particles = computeNodeParticles(tree.octree, tree.layout); });
+  }
+  RangeTree<Real, cstone::OctreeView<KeyType>> rt{tree.octree, boxes, particles, tree.x.data(), tree.y.data(),
+                                                  tree.z.data()};
+
+  if (queries.ranges > 0 && np > 0) {
+
+    // centered on random particles, so that the queries follow the distribution
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> pick(0, np - 1);
+    Real r = Real(0.02) * tree.box.lx();
+    std::vector<NodeBox<Real>> boxQueries(queries.ranges);
+    std::vector<Sphere<Real>> sphereQueries(queries.ranges);
+    for (unsigned q = 0; q < queries.ranges; ++q) {
+      size_t c = pick(gen);
+      boxQueries[q].add(tree.x[c] - r, tree.y[c] - r, tree.z[c] - r);
+      boxQueries[q].add(tree.x[c] + r, tree.y[c] + r, tree.z[c] + r);
+      sphereQueries[q] = {tree.x[c], tree.y[c], tree.z[c], r};
+    }
+
+    RangeQueryResult inBoxes, inSpheres;
+    float usBoxes = stages.time("RangeBoxes", [&]() {
+      inBoxes = rangeQueryBatch(std::span<const NodeBox<Real>>(boxQueries), rt);
+    });
+    float usSpheres = stages.time("RangeSpheres", [&]() {
+      inSpheres = rangeQueryBatch(std::span<const Sphere<Real>>(sphereQueries), rt);
+    });
+    stages.addItems("RangeBoxes", queries.ranges);
+    stages.addItems("RangeSpheres", queries.ranges);
+
+    if (rank == 0) {
+      auto report = [&](const char *name, const RangeQueryResult &res, float us) {
+        uint64_t found = std::accumulate(res.counts.begin(), res.counts.end(), uint64_t(0));
+        std::cout << "\tRange " << name << ": " << 1e3 * queries.ranges / std::max(us, 1.0f) << " K queries/s, "
+                  << double(found) / queries.ranges << " particles per query, "
+                  << 100.0 * res.particleTests / std::max<uint64_t>(found, 1)
+                  << "% of the found count tested individually" << std::endl;
+      };
+      report("boxes", inBoxes, usBoxes);
+      report("spheres", inSpheres, usSpheres);
+    }
+  }
+
+  if (queries.gravity && np > 0) {
+    // equal masses with total mass 1, softened well below the mean spacing of 1m particles
+    Real m = Real(1) / np;
+    Real eps = Real(0.01);
+    SourceCenters<Real> sources;
+    stages.time("SourceCenters", [&]() {
+      sources = computeSourceCenters(tree.octree, tree.layout, tree.box, tree.x.data(), tree.y.data(), tree.z.data(), m,
+                                     theta);
+    });
+
+    GravityResult<Real> g;
+    float us = stages.time("Gravity", [&]() {
+      g = computeGravity(tree.x.data(), tree.y.data(), tree.z.data(), m, eps, tree.octree, tree.layout,
+                         std::span<const NodeBox<Real>>(boxes), sources);
+    });
+    stages.addItems("Gravity", g.interactions());
+
+    if (rank == 0) {
+      // direct sums on a strided sample, outside the timed stages
+      size_t sample = std::min<size_t>(64, np);
+      double err2 = 0;
+      for (size_t s = 0; s < sample; ++s) {
+        size_t i = s * (np / sample);
+        double ax, ay, az;
+        directAcceleration(i, tree.x.data(), tree.y.data(), tree.z.data(), m, eps, np, ax, ay, az);
+        double d = std::hypot(g.ax[i] - ax, g.ay[i] - ay, g.az[i] - az) / std::max(std::hypot(ax, ay, az), 1e-30);
+        err2 += d * d;
+      }
+      std::cout << "\tGravity (theta = " << theta << "): " << g.interactions() / std::max(us, 1.0f)
+                << " M interactions/s, " << double(g.p2p) / np << " p2p + " << double(g.m2p) / np
+                << " m2p per particle, rms relative error " << std::sqrt(err2 / sample) << " on " << sample
+                << " particles" << std::endl;
+    }
+  }
+
+  if (queries.locate > 0) {
+    std::optional<LeafLocator<KeyType>> locator;
+    stages.time("LocatorBuild", [&]() { locator.emplace(tree.leaves); });
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<Real> ux(tree.box.xmin(), tree.box.xmax()), uy(tree.box.ymin(), tree.box.ymax()),
+        uz(tree.box.zmin(), tree.box.zmax());
+    std::vector<Real> px(queries.locate), py(queries.locate), pz(queries.locate);
+    for (unsigned i = 0; i < queries.locate; ++i) {
+      px[i] = ux(gen), py[i] = uy(gen), pz[i] = uz(gen);
+    }
+
+    std::vector<cstone::TreeNodeIndex> leafOf(queries.locate);
+    float usRandom = stages.time("LocateRandom", [&]() {
+      locatePoints(px.data(), py.data(), pz.data(), px.size(), tree.box, *locator,
+                   std::span<cstone::TreeNodeIndex>(leafOf));
+    });
+    stages.addItems("LocateRandom", queries.locate);
+
+    // the same points in SFC order, as tracers kept sorted between steps would be
+    std::vector<KeyType> keys(queries.locate);
+    cstone::computeSfcKeys(px.data(), py.data(), pz.data(), cstone::sfcKindPointer(keys.data()), keys.size(), tree.box);
+    std::sort(keys.begin(), keys.end());
+    float usSorted = stages.time("LocateSorted", [&]() {
+      locator->find(std::span<const KeyType>(keys), std::span<cstone::TreeNodeIndex>(leafOf));
+    });
+    stages.addItems("LocateSorted", queries.locate);
+
+    if (rank == 0)
+      std::cout << "\tPoint location: " << queries.locate / std::max(usRandom, 1.0f) << " M lookups/s random, "
+                << queries.locate / std::max(usSorted, 1.0f) << " M lookups/s sorted keys" << std::endl;
+  }
+
+  if (queries.adjacency) {
+    LeafAdjacency adj;
+    float us = stages.time("LeafAdjacency", [&]() { adj = buildLeafAdjacency(tree.leaves, tree.box, true); });
+    size_t numLeaves = adj.numLeaves();
+    stages.addItems("LeafAdjacency", numLeaves);
+
+    if (rank == 0) {
+      size_t byContact[4] = {0, 0, 0, 0};
+      for (uint8_t c : adj.contact)
+        ++byContact[c];
+      double perLeaf = 1.0 / std::max<size_t>(numLeaves, 1);
+      std::cout << "\tLeaf adjacency: " << numLeaves << " leaves, " << adj.neighbors.size() * perLeaf
+                << " neighbors per leaf (" << byContact[1] * perLeaf << " face, " << byContact[2] * perLeaf
+                << " edge, " << byContact[3] * perLeaf << " corner), " << toMiB(adj.bytes()) << " MiB, "
+                << numLeaves / std::max(us, 1.0f) << " M leaves/s, " << adj.unbalancedLeaves
+                << " leaves violate 2:1 balance" << std::endl;
+    }
+  }
+
+  if (queries.pairBins > 0 && np > 0) {
+    // logarithmic from 0.1% to 3% of the box
+    std::vector<Real> edges = logBinEdges(Real(1e-3) * tree.box.lx(), Real(3e-2) * tree.box.lx(), queries.pairBins);
+    PairCounts pairs;
+    float us = stages.time("PairCount", [&]() { pairs = countPairs(rt, std::span<const Real>(edges)); });
+    stages.addItems("PairCount", pairs.total());
+
+    if (rank == 0) {
+      std::cout << "\tPair counts in " << queries.pairBins << " bins up to " << edges.back() << ": " << pairs.total()
+                << " pairs, " << pairs.total() / std::max(us, 1.0f) << " M pairs/s, " << pairs.nodePairs
+                << " node pairs, " << double(pairs.distanceEvaluations) / std::max<uint64_t>(pairs.total(), 1)
+                << " distance evaluations per counted pair" << std::endl;
+    }
+  }
+}
+
+/*! @brief processCpu's coordinate stages and a neighbor count on positions
+ *         packed into 3x21 bits, next to their float counterparts
+ *
+ * @p x, @p y, @p z are the input of the last processCpu call and
+ * @p ordering its sort order, so the packed positions are reordered exactly
+ * like the floats in @p tree. The count runs the same walk over both with
+ * radius 2h at the leaf density h.
+ */
+static void quantizedBench(std::span<const Real> x, std::span<const Real> y, std::span<const Real> z,
+                           std::span<const unsigned> ordering, std::span<const KeyType> sortedKeys,
+                           const CpuTree &tree, unsigned ngTarget, int rank, StageRecorder &stages) {
+  size_t np = x.size();
+  CoordQuantizer<Real> quantizer(tree.box);
+  std::vector<uint64_t> packed(np), sorted(np);
+
+  // a compact layout stores the packed words; packing is its conversion cost
+  stages.time("QuantizeXYZ", [&]() { quantizeCoords(x.data(), y.data(), z.data(), np, quantizer, packed.data()); });
+  stages.addWork("QuantizeXYZ", np * (3 * sizeof(Real) + sizeof(uint64_t)), 9.0 * np);
+
+  // the integer coordinates are the key's input, no normalization left
+  std::vector<KeyType> keys(np);
+  stages.time("ComputeKeysQuantized", [&]() {
+    auto *k = cstone::sfcKindPointer(keys.data());
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < np; ++i) {
+      uint64_t q = packed[i];
+      k[i] = cstone::iSfcKey<cstone::SfcKind<KeyType>>(CoordQuantizer<Real>::ix(q), CoordQuantizer<Real>::iy(q),
+                                                        CoordQuantizer<Real>::iz(q));
+    }
+  });
+  stages.addWork("ComputeKeysQuantized", np * (sizeof(uint64_t) + sizeof(KeyType)), 0);
+
+  // one 8-byte gather instead of three 4-byte ones
+  stages.time("ReorderQuantized", [&]() { cstone::gatherCpu(ordering, packed.data(), sorted.data()); });
+  stages.addWork("ReorderQuantized", np * (sizeof(unsigned) + 2 * sizeof(uint64_t)), 0);
+
+  size_t sameKeys = 0;
+  double maxError = 0;
+  for (size_t i = 0; i < np; ++i) {
+    sameKeys += keys[ordering[i]] == sortedKeys[i];
+    auto p = quantizer.decode(sorted[i]);
+    maxError = std::max({maxError, double(std::abs(p[0] - tree.x[i])), double(std::abs(p[1] - tree.y[i])),
+                         double(std::abs(p[2] - tree.z[i]))});
+  }
+
+  std::vector<Real> h(np);
+  leafSmoothingLengths(tree.leaves, tree.layout, tree.box, ngTarget, std::span<Real>(h));
+  for (Real &r : h)
+    r *= 2;
+  std::span<const Real> radius(h);
+  auto nodes = computeNodeParticles(tree.octree, tree.layout);
+  auto boxes = computeNodeBoxes(tree.octree, tree.layout, tree.x.data(), tree.y.data(), tree.z.data());
+  std::vector<NodeBox<Real>> packedBoxes;
+  {
+    // the walk prunes with bounds of the positions it reads
+    std::vector<Real> dx(np), dy(np), dz(np);
+    for (size_t i = 0; i < np; ++i) {
+      auto p = quantizer.decode(sorted[i]);
+      dx[i] = p[0], dy[i] = p[1], dz[i] = p[2];
+    }
+    packedBoxes = computeNodeBoxes(tree.octree, tree.layout, dx.data(), dy.data(), dz.data());
+  }
+
+  std::vector<unsigned> floatCounts, packedCounts;
+  float floatUs = stages.time("CountNeighbors", [&]() {
+    floatCounts = countWithin(tree.octree, std::span<const NodeBox<Real>>(boxes), std::span<const NodeParticles>(nodes),
+                              SoaCoords<Real>{tree.x.data(), tree.y.data(), tree.z.data()}, radius);
+  });
+  float packedUs = stages.time("CountNeighborsQuantized", [&]() {
+    packedCounts = countWithin(tree.octree, std::span<const NodeBox<Real>>(packedBoxes),
+                               std::span<const NodeParticles>(nodes), PackedCoords<Real>{sorted.data(), quantizer},
+                               radius);
+  });
+  size_t floatPairs = std::accumulate(floatCounts.begin(), floatCounts.end(), size_t(0));
+  size_t differing = 0;
+  for (size_t i = 0; i < np; ++i)
+    differing += floatCounts[i] != packedCounts[i];
+  stages.addItems("CountNeighbors", floatPairs);
+  stages.addItems("CountNeighborsQuantized", std::accumulate(packedCounts.begin(), packedCounts.end(), size_t(0)));
+
+  if (rank == 0)
+    std::cout << "\tQuantized coordinates: " << 3 * sizeof(Real) << " -> " << sizeof(uint64_t)
+              << " B/particle, " << 3 * sizeof(Real) + sizeof(KeyType) << " -> " << sizeof(uint64_t)
+              << " with the key recomputed from them, max error " << maxError << ", keys identical for "
+              << 100.0 * sameKeys / std::max<size_t>(np, 1) << "%, neighbor counts differ for "
+              << 100.0 * differing / std::max<size_t>(np, 1) << "%, count " << floatUs << " -> " << packedUs
+              << " us" << std::endl;
 }
 
 std::pair<double, double> runnerCpu(const std::vector<KeyType> &keys, const std::vector<Real> &ix,
@@ -141,7 +1456,8 @@ std::pair<double, double> runnerCpu(const std::vector<KeyType> &keys, const std:
                const std::vector<Real> &h, const std::vector<Real> &px,
                const std::vector<Real> &py, const std::vector<Real> &pz, int rank,
                int numRanks, int bucketSize, int bucketSizeFocus, float theta,
-               std::string group_name, bool save) {
+               std::string group_name, bool save, bool validate, const QueryOptions &queries,
+               StageRecorder &stages) {
   cstone::Box<Real> box{-1.5, 1.5};
 
   size_t np = keys.size();
@@ -169,31 +1485,87 @@ std::pair<double, double> runnerCpu(const std::vector<KeyType> &keys, const std:
 
   std::vector<Real> x(ix), y(iy), z(iz);
 
+  BufferRegistry buffers;
+  buffers.add("x", x);
+  buffers.add("y", y);
+  buffers.add("z", z);
+  buffers.add("d_keys", d_keys);
+  buffers.add("d_keys_tmp", d_keys_tmp);
+  buffers.add("d_ordering", d_ordering);
+  buffers.add("d_values_tmp", d_values_tmp);
+  buffers.add("tmp", tmp);
+  buffers.add("cubTmpStorage", cubTmpStorage);
+  buffers.add("d_tree", d_tree);
+  buffers.add("d_counts", d_counts);
+  buffers.add("d_layout", d_layout);
+  buffers.add("prefixes", octreeData.prefixes);
+  buffers.add("childOffsets", octreeData.childOffsets);
+  buffers.add("parents", octreeData.parents);
+  buffers.add("internalToLeaf", octreeData.internalToLeaf);
+  buffers.add("leafToInternal", octreeData.leafToInternal);
+
   auto f = [&]() {
     processCpu(box, d_keys, d_keys_tmp, d_ordering, d_values_tmp, tmp, cubTmpStorage, tempStorageEle, 
-      d_counts, workArray, d_layout, d_tree, tmpTree, octreeData, x, y, z, bucketSize, np);
+      d_counts, workArray, d_layout, d_tree, tmpTree, octreeData, x, y, z, bucketSize, np, stages);
+  };
+
+  auto validateTree = [&](const std::string &phase) {
+    ValidationReport report;
+    std::span<const KeyType> leaves(d_tree), sortedKeys(d_keys);
+    validateLeaves(leaves, report);
+    validateCounts(leaves, std::span<const unsigned>(d_counts), sortedKeys, bucketSize, report);
+    validateLayout(std::span<const unsigned>(d_counts), std::span<const cstone::LocalIndex>(d_layout), np, report);
+    validateOctree(octreeData.data(), leaves, report);
+    validateParticles(sortedKeys, std::span<const Real>(x), std::span<const Real>(y), std::span<const Real>(z), box,
+                      report);
+    reportValidation(phase, rank, report);
   };
 
-  float sync_ms = timeCpu(f);
+  // processCpu sorts its input in place, the packed comparison starts from a copy
+  std::vector<Real> qx, qy, qz;
+  auto runQuantized = [&]() {
+    if (queries.quantized > 0)
+      quantizedBench(qx, qy, qz, std::span<const unsigned>(d_ordering.data(), np), d_keys,
+                     {box, d_tree, d_layout, octreeData.data(), x, y, z}, queries.quantized, rank, stages);
+  };
+
+  stages.setPhase("Initial");
+  if (queries.quantized > 0)
+    qx = x, qy = y, qz = z;
+  float sync_ms = stages.time("Total", f);
   t.first = sync_ms;
+  if (validate)
+    validateTree("Initial");
+  runQueries(queries, {box, d_tree, d_layout, octreeData.data(), x, y, z}, theta, rank, stages);
+  runQuantized();
 
   if (rank == 0)
     std::cout << "\tUpdate Octree Initial: " << sync_ms << "us, call count: " << call_count
               << std::endl;
 
+  if (stages.memoryTracking()) {
+    stages.recordBuffers(buffers);
+    if (rank == 0)
+      std::cout << "\tMemory Usage: " << toMiB(buffers.total()) << "Mb"
+                << std::endl;
+  }
+
   // thrust::copy(thrust::host, d_keys.data(), d_keys.data() + d_keys.size(), keys.begin());
 
   // saveOctreeH5Gpu(, group_name + "_initial", rank, numRanks, x, y, z, keys);
 
-  #pragma omp parallel for
-  for (auto i = 0; i < ix.size(); ++i) {
-    x[i] += px[i];
-    y[i] += py[i];
-    z[i] += pz[i];
-  }
+  // x, y, z are in SFC order now, px, py, pz still in input order
+  perturbSorted(std::span<const unsigned>(d_ordering.data(), np), px, py, pz, x, y, z);
 
-  sync_ms = timeCpu(f);
+  stages.setPhase("Perturb");
+  if (queries.quantized > 0)
+    qx = x, qy = y, qz = z;
+  sync_ms = stages.time("Total", f);
   t.second = sync_ms;
+  if (validate)
+    validateTree("Perturb");
+  runQueries(queries, {box, d_tree, d_layout, octreeData.data(), x, y, z}, theta, rank, stages);
+  runQuantized();
 
   call_count = 1;
 
@@ -208,50 +1580,210 @@ std::pair<double, double> runnerCpu(const std::vector<KeyType> &keys, const std:
   // saveOctreeH5Gpu(domain, group_name + "_perturbed", x, y, z, keys);
 }
 
+/*! @brief a model of a domain sync built from the harness components, timed
+ *         as SyncModel/... stages of the current phase
+ *
+ * Domain::sync is one call into cstone and its phases are not observable from
+ * here. This is not a breakdown of it: the model runs harness counterparts on
+ * the same particles and h, global box, keys, assignment by sampled
+ * splitters, particle exchange, a local tree in the focus tree's role, halo
+ * discovery and halo exchange. Domain::sync runs none of these, and its
+ * global tree update and LET exchange are not modelled.
+ */
+static void replaySyncModel(std::span<const Real> x, std::span<const Real> y, std::span<const Real> z, Real h,
+                             int bucketSize, StageRecorder &stages) {
+  std::vector<Real> rx(x.begin(), x.end()), ry(y.begin(), y.end()), rz(z.begin(), z.end());
+  cstone::Box<Real> box{0, 1};
+  stages.time("SyncModel/Box", [&]() { box = globalBox(rx, ry, rz, MPI_COMM_WORLD); });
+
+  std::vector<KeyType> keys(rx.size());
+  stages.time("SyncModel/Keys", [&]() {
+    cstone::computeSfcKeys(rx.data(), ry.data(), rz.data(), cstone::sfcKindPointer(keys.data()), keys.size(), box);
+  });
+
+  SfcSplitters<KeyType> splitters;
+  stages.time("SyncModel/Assignment", [&]() {
+    splitters = sampleSplitters(std::span<const KeyType>(keys), std::span<const double>{}, MPI_COMM_WORLD);
+  });
+
+  std::vector<Real> *arrays[] = {&rx, &ry, &rz};
+  stages.time("SyncModel/Exchange", [&]() {
+    exchangeByKey(keys, splitters, std::span<std::vector<Real> *const>(arrays), MPI_COMM_WORLD);
+  });
+
+  SearchTree tree;
+  stages.time("SyncModel/LocalTree", [&]() { tree.build(rx, ry, rz, rx.size(), box, bucketSize); });
+
+  std::optional<HaloExchange<KeyType, Real>> halos;
+  stages.time("SyncModel/HaloDiscovery", [&]() { halos.emplace(rx, ry, rz, 2 * h, MPI_COMM_WORLD); });
+  stages.time("SyncModel/HaloExchange", [&]() {
+    halos->start(rx.data(), ry.data(), rz.data());
+    halos->finish(rx, ry, rz);
+  });
+}
+
 std::pair<double, double> runnerCpuMulti(const std::vector<KeyType> &keys, const std::vector<Real> &ix,
                const std::vector<Real> &iy, const std::vector<Real> &iz,
                const std::vector<Real> &h, const std::vector<Real> &px,
                const std::vector<Real> &py, const std::vector<Real> &pz, int rank,
                int numRanks, int bucketSize, int bucketSizeFocus, float theta,
-               std::string group_name, bool save) {
+               std::string group_name, bool save, bool validate, bool syncModel,
+               const DomainCheckpoint<KeyType, Real> *restore, const std::string &checkpointOut,
+               const CheckpointHeader &checkpointHeader, StageRecorder &stages) {
   cstone::Domain<KeyType, Real, cstone::CpuTag> domain(
       rank, numRanks, bucketSize, bucketSizeFocus, theta);
 
   std::pair<double, double> t;
 
-  std::vector<KeyType> k(keys);
-  std::vector<Real> x(ix), y(iy), z(iz);
-  std::vector<Real> hh(h);
+  size_t used_initial_byte = heapStats().live;
+
+  // a restored run starts from the particles of a converged initial sync
+  std::vector<KeyType> k(restore ? restore->keys : keys);
+  std::vector<Real> x(restore ? restore->x : ix), y(restore ? restore->y : iy), z(restore ? restore->z : iz);
+  std::vector<Real> hh(restore ? restore->h : h);
+  // the perturbations travel with their particles through the initial sync
+  std::vector<Real> qx(restore ? restore->px : px), qy(restore ? restore->py : py), qz(restore ? restore->pz : pz);
   std::vector<Real> s1, s2, s3;
+
+  BufferRegistry buffers;
+  buffers.add("keys", k);
+  buffers.add("x", x);
+  buffers.add("y", y);
+  buffers.add("z", z);
+  buffers.add("h", hh);
+  buffers.add("qx", qx);
+  buffers.add("qy", qy);
+  buffers.add("qz", qz);
+  buffers.add("s1", s1);
+  buffers.add("s2", s2);
+  buffers.add("s3", s3);
+  auto initial_sync_f = [&]() {
+    domain.sync(k, x, y, z, hh, std::tie(qx, qy, qz),
+                std::tie(s1, s2, s3));
+  };
   auto sync_f = [&]() {
     domain.sync(k, x, y, z, hh, std::tuple{},
                 std::tie(s1, s2, s3));
   };
 
-  float sync_ms = timeCpu(sync_f);
+  unsigned long long numGlobal = k.size();
+  if (validate)
+    MPI_Allreduce(MPI_IN_PLACE, &numGlobal, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+  // the global and focus trees, and the assigned particles; leaf counts and
+  // the particle layout are internal to the Domain
+  auto validateDomain = [&](const std::string &phase) {
+    ValidationReport report;
+    auto global = domain.globalTree();
+    std::span<const KeyType> globalLeaves(global.leaves, global.numLeafNodes + 1);
+    validateLeaves(globalLeaves, report);
+    validateOctree(global, globalLeaves, report);
+    std::span<const KeyType> focusLeaves = domain.focusTree().treeLeaves();
+    validateLeaves(focusLeaves, report);
+    validateOctree(domain.focusTree().octreeViewAcc(), focusLeaves, report);
+
+    size_t first = domain.startIndex();
+    size_t n = domain.endIndex() - first;
+    validateParticles(std::span<const KeyType>(k.data() + first, n), std::span<const Real>(x.data() + first, n),
+                      std::span<const Real>(y.data() + first, n), std::span<const Real>(z.data() + first, n),
+                      domain.box(), report);
+    unsigned long long numAssigned = n;
+    MPI_Allreduce(MPI_IN_PLACE, &numAssigned, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    report.check(numAssigned == numGlobal, "particles.total", numAssigned, "of", numGlobal);
+
+    // fail on all ranks together, the next sync is collective
+    int failed = !report.ok();
+    MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (failed && report.ok())
+      throw std::runtime_error("Tree validation failed after " + phase + " on another rank");
+    reportValidation(phase, rank, report);
+  };
+
+  // the replay starts from the same input as the sync, the largest h sets
+  // the halo radius for all particles
+  Real hMax = hh.empty() ? 0 : *std::max_element(hh.begin(), hh.end());
+  MPI_Allreduce(MPI_IN_PLACE, &hMax, 1, mpiType<Real>(), MPI_MAX, MPI_COMM_WORLD);
+
+  stages.setPhase("Initial");
+  if (syncModel)
+    replaySyncModel(x, y, z, hMax, bucketSize, stages);
+  float sync_ms = stages.time("DomainSync", initial_sync_f);
   t.first = sync_ms;
+  if (validate)
+    validateDomain("Initial");
 
   if (rank == 0) {
-    std::cout << "\tDomain Sync Initial: " << sync_ms << "us" << std::endl;
+    std::cout << "\tDomain Sync Initial: " << sync_ms << "us";
+    if (stages.memoryTracking())
+      std::cout << ", Memory Usage: "
+                << toMiB(heapStats().live - used_initial_byte) << "Mb";
+    std::cout << std::endl;
   }
 
+  if (stages.memoryTracking())
+    stages.recordBuffers(buffers);
+
   if (save)
     saveDomainOctreeH5Cpu(domain, group_name + "_initial", rank, numRanks, x, y, z, k);
 
+  // the restored particles were the converged assignment of the run that
+  // wrote them; report whether the Domain kept it
+  if (restore) {
+    size_t first = domain.startIndex(), n = domain.endIndex() - first;
+    int kept = n == restore->keys.size() && std::equal(restore->keys.begin(), restore->keys.end(), k.begin() + first);
+    MPI_Allreduce(MPI_IN_PLACE, &kept, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (rank == 0)
+      std::cout << "\tRestored assignment " << (kept ? "kept" : "changed") << " by the initial sync" << std::endl;
+  }
+
+  // the checkpoint holds the state after the initial sync, it is written
+  // once the perturbed sync has been timed too
+  std::optional<DomainCheckpoint<KeyType, Real>> ckpt;
+  if (!checkpointOut.empty()) {
+    ckpt.emplace();
+    ckpt->header = checkpointHeader;
+    size_t first = domain.startIndex(), last = domain.endIndex();
+    ckpt->keys.assign(k.begin() + first, k.begin() + last);
+    ckpt->x.assign(x.begin() + first, x.begin() + last);
+    ckpt->y.assign(y.begin() + first, y.begin() + last);
+    ckpt->z.assign(z.begin() + first, z.begin() + last);
+    ckpt->h.assign(hh.begin() + first, hh.begin() + last);
+    ckpt->px.assign(qx.begin() + first, qx.begin() + last);
+    ckpt->py.assign(qy.begin() + first, qy.begin() + last);
+    ckpt->pz.assign(qz.begin() + first, qz.begin() + last);
+  }
+
+  // the initial sync reordered qx, qy, qz with the particles
 #pragma omp parallel for
   for (auto i = domain.startIndex(); i < domain.endIndex(); ++i) {
-    x[i] += px[i];
-    y[i] += py[i];
-    z[i] += pz[i];
+    x[i] += qx[i];
+    y[i] += qy[i];
+    z[i] += qz[i];
   }
 
-  sync_ms = timeCpu(sync_f);
+  stages.setPhase("Perturb");
+  if (syncModel) {
+    size_t first = domain.startIndex(), n = domain.endIndex() - first;
+    replaySyncModel({x.data() + first, n}, {y.data() + first, n}, {z.data() + first, n}, hMax, bucketSize, stages);
+  }
+  sync_ms = stages.time("DomainSync", sync_f);
 
   t.second = sync_ms;
+  if (validate)
+    validateDomain("Perturb");
+
+  if (ckpt) {
+    ckpt->header.freshInitialUs = t.first;
+    ckpt->header.freshPerturbUs = t.second;
+    writeCheckpoint(checkpointOut, *ckpt);
+  }
 
   if (rank == 0) {
-    std::cout << "\tDomain Sync with Perturbations: " << sync_ms << "us"
-              << std::endl;
+    std::cout << "\tDomain Sync with Perturbations: " << sync_ms << "us";
+    if (stages.memoryTracking())
+      std::cout << ", Memory Usage: "
+                << toMiB(heapStats().live - used_initial_byte) << "Mb";
+    std::cout << std::endl;
   }
 
   if (save)
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "bench.hpp"
+#include "checkpoint.hpp"
+#include "distributions.hpp"
 #include "pcah5.hpp"
+#include "stages.hpp"
 #include <highfive/H5File.hpp>
 #include <string>
 #include <filesystem>
@@ -14,7 +18,8 @@ std::pair<double, double> runnerCpu(const std::vector<KeyType> &keys, const std:
                const std::vector<Real> &h, const std::vector<Real> &px,
                const std::vector<Real> &py, const std::vector<Real> &pz, int rank,
                int numRanks, int bucketSize, int bucketSizeFocus, float theta,
-               std::string group_name, bool save);
+               std::string group_name, bool save, bool validate, const QueryOptions &queries,
+               StageRecorder &stages);
 
 std::pair<double, double> runnerGpu(const std::vector<KeyType> &keys, const std::vector<Real> &ix,
                const std::vector<Real> &iy, const std::vector<Real> &iz,
@@ -28,7 +33,9 @@ std::pair<double, double> runnerCpuMulti(const std::vector<KeyType> &keys, const
                const std::vector<Real> &h, const std::vector<Real> &px,
                const std::vector<Real> &py, const std::vector<Real> &pz, int rank,
                int numRanks, int bucketSize, int bucketSizeFocus, float theta,
-               std::string group_name, bool save);
+               std::string group_name, bool save, bool validate, bool syncModel,
+               const DomainCheckpoint<KeyType, Real> *restore, const std::string &checkpointOut,
+               const CheckpointHeader &checkpointHeader, StageRecorder &stages);
 
 std::pair<double, double> runnerGpuMulti(const std::vector<KeyType> &keys, const std::vector<Real> &ix,
                const std::vector<Real> &iy, const std::vector<Real> &iz,
@@ -37,6 +44,40 @@ std::pair<double, double> runnerGpuMulti(const std::vector<KeyType> &keys, const
                int numRanks, int bucketSize, int bucketSizeFocus, float theta,
                std::string group_name, bool save);
 
+//! @brief exchange @p particles so that each rank holds a contiguous SFC
+//!        range, and report what moved
+void sfcPartitionSlice(ParticleSlice<Real> &particles, int rank, int numRanks, const CompressOptions &compress);
+
+//! @brief move the SFC splitters of the harness slice @p particles to
+//!        equalize neighbor counts at one global h, and report the rank
+//!        imbalance before, after, and after a Domain sync of the result
+void costBalanceSlice(ParticleSlice<Real> &particles, int rank, int numRanks, unsigned ngTarget, int bucketSize,
+                      int bucketSizeFocus, float theta, const CompressOptions &compress);
+
+//! @brief time a neighbor count over local and halo particles with a blocking
+//!        and with an overlapped halo exchange
+void haloOverlapBench(const ParticleSlice<Real> &particles, int rank, int numRanks, unsigned ngTarget, int bucketSize,
+                      int trials, const CompressOptions &compress);
+
+//! @brief time the exchange of the index slices into SFC order through
+//!        messages and through a node's shared memory window
+void sharedExchangeBench(const ParticleSlice<Real> &particles, int rank, int numRanks, int ranksPerNode,
+                         int trials);
+
+//! @brief drift @p particles by their perturbation for @p steps steps and
+//!        compare resampling the splitters every step with keeping them up to
+//!        an imbalance of 1 + @p tolerance
+void hysteresisBench(const ParticleSlice<Real> &particles, int rank, int numRanks, double tolerance, int steps,
+                     const CompressOptions &compress);
+
 void runner(HighFive::File &file, std::string group_name, int rank,
-            int numRanks, bool gpu, bool lets, int bucketSize, int bucketSizeFocus,
-            float theta, bool save);
+            int numRanks, const BenchConfig &cfg);
+
+void runnerGenerated(std::string spec_name, int rank, int numRanks,
+                     const BenchConfig &cfg);
+
+BenchResult runner(const ParticleSlice<Real> &particles, std::string group_name,
+                   int rank, int numRanks, const BenchConfig &cfg);
+
+void runnerScaling(const ParticleSlice<Real> &particles, std::string group_name,
+                   int rank, int numRanks, const BenchConfig &cfg);
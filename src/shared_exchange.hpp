@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include <mpi.h>
+
+#include "partition.hpp"
+
+/*! @brief particle exchange by SFC key through an MPI-3 shared memory window
+ *         between the ranks of a node
+ *
+ * Every rank packs its particles in destination order into its own segment
+ * of a window allocated with MPI_Win_allocate_shared on the node
+ * communicator. Ranks on the same node copy their part straight out of the
+ * sender's segment; only particles for other nodes go through Alltoallv, with
+ * the packed segment as the send buffer. The result is identical to
+ * exchangeByKey: particles ordered by source rank, each source in its input
+ * order.
+ *
+ * @p ranksPerNode > 0 splits each shared memory node further into groups of
+ * that many consecutive ranks, so that the mixed path can be exercised on a
+ * single machine.
+ */
+template <class KeyType, class T> class SharedWindowExchange {
+public:
+  explicit SharedWindowExchange(MPI_Comm comm, int ranksPerNode = 0)
+      : comm_(comm) {
+    int rank, numRanks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &numRanks);
+    MPI_Comm shared;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                        &shared);
+    if (ranksPerNode > 0) {
+      MPI_Comm_split(shared, rank / ranksPerNode, rank, &nodeComm_);
+      MPI_Comm_free(&shared);
+    } else {
+      nodeComm_ = shared;
+    }
+
+    // world rank -> node rank, -1 off the node
+    int nodeSize;
+    MPI_Comm_size(nodeComm_, &nodeSize);
+    MPI_Group worldGroup, nodeGroup;
+    MPI_Comm_group(comm, &worldGroup);
+    MPI_Comm_group(nodeComm_, &nodeGroup);
+    std::vector<int> nodeRanks(nodeSize), worldRanks(nodeSize);
+    std::iota(nodeRanks.begin(), nodeRanks.end(), 0);
+    MPI_Group_translate_ranks(nodeGroup, nodeSize, nodeRanks.data(),
+                              worldGroup, worldRanks.data());
+    MPI_Group_free(&worldGroup);
+    MPI_Group_free(&nodeGroup);
+    nodeRankOf_.assign(numRanks, -1);
+    for (int k = 0; k < nodeSize; ++k)
+      nodeRankOf_[worldRanks[k]] = k;
+  }
+
+  SharedWindowExchange(const SharedWindowExchange &) = delete;
+  SharedWindowExchange &operator=(const SharedWindowExchange &) = delete;
+
+  ~SharedWindowExchange() {
+    freeWindow();
+    MPI_Comm_free(&nodeComm_);
+  }
+
+  int nodeSize() const {
+    return int(std::count_if(nodeRankOf_.begin(), nodeRankOf_.end(),
+                             [](int k) { return k >= 0; }));
+  }
+
+  /*! @brief send every particle with its key to the owner of the key, as
+   *         exchangeByKey without a codec. Collective over the communicator.
+   *
+   * bytesSent counts the bytes of messages to other nodes only.
+   */
+  ExchangeStats exchange(std::vector<KeyType> &keys,
+                         const SfcSplitters<KeyType> &splitters,
+                         std::span<std::vector<T> *const> arrays) {
+    auto t0 = std::chrono::steady_clock::now();
+    int rank, numRanks;
+    MPI_Comm_rank(comm_, &rank);
+    MPI_Comm_size(comm_, &numRanks);
+
+    size_t n = keys.size();
+    std::vector<int> dest(n);
+    std::vector<int> sendCounts(numRanks, 0), recvCounts(numRanks);
+    for (size_t i = 0; i < n; ++i) {
+      dest[i] = splitters.owner(keys[i]);
+      ++sendCounts[dest[i]];
+    }
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT,
+                 comm_);
+    std::vector<int> sendDispls(numRanks), recvDispls(numRanks);
+    std::exclusive_scan(sendCounts.begin(), sendCounts.end(),
+                        sendDispls.begin(), 0);
+    std::exclusive_scan(recvCounts.begin(), recvCounts.end(),
+                        recvDispls.begin(), 0);
+    size_t numRecv = recvDispls.back() + recvCounts.back();
+
+    // segment layout: particle count, send displacements, then the keys and
+    // every array as columns in destination order
+    size_t columns = arrays.size();
+    size_t headerBytes = sizeof(uint64_t) * (1 + numRanks);
+    auto columnOffset = [&](size_t count, size_t c) {
+      return headerBytes + count * sizeof(KeyType) + c * count * sizeof(T);
+    };
+    reserve(columnOffset(n, columns));
+
+    // peers may still be reading the previous exchange from this segment
+    MPI_Win_sync(win_);
+    MPI_Barrier(nodeComm_);
+
+    std::vector<int> fill(sendDispls);
+    std::vector<size_t> perm(n);
+    for (size_t i = 0; i < n; ++i)
+      perm[fill[dest[i]]++] = i;
+    auto *header = reinterpret_cast<uint64_t *>(base_);
+    header[0] = n;
+    for (int q = 0; q < numRanks; ++q)
+      header[1 + q] = sendDispls[q];
+    auto *sendKeys = reinterpret_cast<KeyType *>(base_ + headerBytes);
+    for (size_t i = 0; i < n; ++i)
+      sendKeys[i] = keys[perm[i]];
+    for (size_t c = 0; c < columns; ++c) {
+      auto *col = reinterpret_cast<T *>(base_ + columnOffset(n, c));
+      const std::vector<T> &a = *arrays[c];
+      for (size_t i = 0; i < n; ++i)
+        col[i] = a[perm[i]];
+    }
+
+    MPI_Win_sync(win_);
+    MPI_Barrier(nodeComm_);
+    MPI_Win_sync(win_);
+
+    std::vector<KeyType> recvKeys(numRecv);
+    std::vector<std::vector<T>> recvArrays(columns, std::vector<T>(numRecv));
+    for (int q = 0; q < numRanks; ++q) {
+      int k = nodeRankOf_[q];
+      if (k < 0 || recvCounts[q] == 0)
+        continue;
+      MPI_Aint size;
+      int dispUnit;
+      uint8_t *peer;
+      MPI_Win_shared_query(win_, k, &size, &dispUnit, &peer);
+      const auto *peerHeader = reinterpret_cast<const uint64_t *>(peer);
+      size_t peerCount = peerHeader[0], first = peerHeader[1 + rank];
+      std::memcpy(recvKeys.data() + recvDispls[q],
+                  peer + headerBytes + first * sizeof(KeyType),
+                  recvCounts[q] * sizeof(KeyType));
+      for (size_t c = 0; c < columns; ++c)
+        std::memcpy(recvArrays[c].data() + recvDispls[q],
+                    peer + columnOffset(peerCount, c) + first * sizeof(T),
+                    recvCounts[q] * sizeof(T));
+    }
+
+    // other nodes, the same displacements with the node's counts zeroed
+    std::vector<int> remoteSend(sendCounts), remoteRecv(recvCounts);
+    for (int q = 0; q < numRanks; ++q)
+      if (nodeRankOf_[q] >= 0)
+        remoteSend[q] = remoteRecv[q] = 0;
+    MPI_Alltoallv(sendKeys, remoteSend.data(), sendDispls.data(),
+                  mpiType<KeyType>(), recvKeys.data(), remoteRecv.data(),
+                  recvDispls.data(), mpiType<KeyType>(), comm_);
+    for (size_t c = 0; c < columns; ++c)
+      MPI_Alltoallv(reinterpret_cast<T *>(base_ + columnOffset(n, c)),
+                    remoteSend.data(), sendDispls.data(), mpiType<T>(),
+                    recvArrays[c].data(), remoteRecv.data(), recvDispls.data(),
+                    mpiType<T>(), comm_);
+
+    keys.swap(recvKeys);
+    for (size_t c = 0; c < columns; ++c)
+      arrays[c]->swap(recvArrays[c]);
+
+    ExchangeStats stats;
+    stats.particlesSent = n - sendCounts[rank];
+    size_t remote = std::accumulate(remoteSend.begin(), remoteSend.end(), size_t(0));
+    stats.bytesSent = remote * (sizeof(KeyType) + columns * sizeof(T));
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return stats;
+  }
+
+private:
+  //! @brief grow the window to at least @p bytes on every rank of the node
+  void reserve(size_t bytes) {
+    unsigned long long needed = bytes;
+    MPI_Allreduce(MPI_IN_PLACE, &needed, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX,
+                  nodeComm_);
+    if (needed <= capacity_)
+      return;
+    freeWindow();
+    // with 25% headroom, so that a drifting particle count does not
+    // reallocate every exchange
+    capacity_ = needed + needed / 4;
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    MPI_Win_allocate_shared(MPI_Aint(capacity_), 1, info, nodeComm_, &base_,
+                            &win_);
+    MPI_Info_free(&info);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win_);
+  }
+
+  void freeWindow() {
+    if (win_ == MPI_WIN_NULL)
+      return;
+    MPI_Win_unlock_all(win_);
+    MPI_Win_free(&win_);
+    capacity_ = 0;
+  }
+
+  MPI_Comm comm_;
+  MPI_Comm nodeComm_;
+  std::vector<int> nodeRankOf_;
+  MPI_Win win_ = MPI_WIN_NULL;
+  uint8_t *base_ = nullptr;
+  size_t capacity_ = 0;
+};
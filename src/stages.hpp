@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "memory.hpp"
+#include "perf_counters.hpp"
+
+//! @brief one measurement of a named pipeline stage
+struct StageSample {
+  double us = 0;
+  PerfSample counters;
+  //! peak heap bytes above the level at stage entry, 0 if not tracked
+  size_t heapPeak = 0;
+  //! process RSS high-water mark during the stage, 0 if not tracked
+  size_t rssPeak = 0;
+  //! modelled memory traffic and floating point work, 0 if not modelled
+  double bytes = 0;
+  double flops = 0;
+  //! work items completed, e.g. neighbors found, for a throughput rate
+  double items = 0;
+};
+
+/*! @brief per-stage timings of the CPU pipelines, optionally with counters
+ *
+ * Stage names match the NVTX ranges of the GPU path (ComputeKeys, SortKeys,
+ * ...), prefixed with the current phase, e.g. "Initial/SortKeys". Stages are
+ * kept in first-seen order so reports follow the pipeline.
+ *
+ * With memory tracking enabled, the heap and RSS peaks are reset on stage
+ * entry and read on exit. Nested stages propagate their peaks to the
+ * enclosing stage, so "Initial/Total" still sees the largest inner peak.
+ */
+class StageRecorder {
+public:
+  explicit StageRecorder(const PerfCounters *counters = nullptr)
+      : counters_(counters) {}
+
+  void setPhase(std::string phase) { phase_ = std::move(phase); }
+
+  void setMemoryTracking(bool enable) { trackMemory_ = enable; }
+  bool memoryTracking() const { return trackMemory_; }
+
+  //! @brief time @p f and record it under the current phase
+  template <class F> float time(const std::string &stage, F &&f) {
+    bool withCounters = counters_ && counters_->available();
+    PerfSnapshot c0;
+    if (withCounters)
+      c0 = counters_->snapshot();
+
+    size_t heapBase = 0;
+    if (trackMemory_) {
+      heapBase = heapStats().live;
+      resetHeapPeak();
+      resetRssPeak();
+      peaks_.push_back({0, 0});
+    }
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    StageSample sample;
+    sample.us =
+        std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+    if (withCounters)
+      sample.counters = counters_->delta(c0, counters_->snapshot());
+
+    if (trackMemory_) {
+      auto [innerHeap, innerRss] = peaks_.back();
+      peaks_.pop_back();
+      size_t heapPeak = std::max(innerHeap, heapStats().peak);
+      size_t rssPeak = std::max(innerRss, readRss().hwm);
+      sample.heapPeak = heapPeak > heapBase ? heapPeak - heapBase : 0;
+      sample.rssPeak = rssPeak;
+      if (!peaks_.empty()) {
+        // inner resets discard what the enclosing stage had seen so far
+        peaks_.back().first = std::max(peaks_.back().first, heapPeak);
+        peaks_.back().second = std::max(peaks_.back().second, rssPeak);
+      }
+    }
+
+    samplesOf(phase_.empty() ? stage : phase_ + "/" + stage)
+        .push_back(sample);
+    return float(sample.us);
+  }
+
+  /*! @brief attach modelled traffic to the last sample of @p stage
+   *
+   * Called after time() returns, since some stages only know their work
+   * (e.g. the number of tree update passes) once they have run.
+   */
+  void addWork(const std::string &stage, double bytes, double flops) {
+    if (StageSample *last = lastSample(stage)) {
+      last->bytes += bytes;
+      last->flops += flops;
+    }
+  }
+
+  //! @brief attach completed work items to the last sample of @p stage
+  void addItems(const std::string &stage, double items) {
+    if (StageSample *last = lastSample(stage))
+      last->items += items;
+  }
+
+  const std::vector<std::pair<std::string, std::vector<StageSample>>> &
+  stages() const {
+    return stages_;
+  }
+
+  void clear() {
+    stages_.clear();
+    buffers_.clear();
+  }
+
+  //! @brief keep the current footprint of @p registry for the report
+  void recordBuffers(const BufferRegistry &registry) {
+    buffers_ = registry.bytes();
+  }
+
+  const std::vector<std::pair<std::string, size_t>> &buffers() const {
+    return buffers_;
+  }
+
+private:
+  StageSample *lastSample(const std::string &stage) {
+    std::string name = phase_.empty() ? stage : phase_ + "/" + stage;
+    for (auto &[n, s] : stages_) {
+      if (n == name && !s.empty())
+        return &s.back();
+    }
+    return nullptr;
+  }
+
+  std::vector<StageSample> &samplesOf(const std::string &name) {
+    for (auto &[n, s] : stages_) {
+      if (n == name)
+        return s;
+    }
+    stages_.emplace_back(name, std::vector<StageSample>{});
+    return stages_.back().second;
+  }
+
+  const PerfCounters *counters_;
+  std::string phase_;
+  std::vector<std::pair<std::string, std::vector<StageSample>>> stages_;
+
+  bool trackMemory_ = false;
+  //! absolute heap and RSS peaks of finished children of each open stage
+  std::vector<std::pair<size_t, size_t>> peaks_;
+  std::vector<std::pair<std::string, size_t>> buffers_;
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "cstone/sfc/common.hpp"
+#include "cstone/tree/octree.hpp"
+
+/*! @brief tight axis-aligned bounds of the particles under a tree node
+ *
+ * Empty nodes keep the inverted default box, which is farther from any point
+ * than every real box and so is pruned by all distance tests.
+ */
+template <class T> struct NodeBox {
+  T lo[3] = {std::numeric_limits<T>::max(), std::numeric_limits<T>::max(),
+             std::numeric_limits<T>::max()};
+  T hi[3] = {std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest(),
+             std::numeric_limits<T>::lowest()};
+
+  bool empty() const { return lo[0] > hi[0]; }
+
+  void add(T x, T y, T z) {
+    lo[0] = std::min(lo[0], x), hi[0] = std::max(hi[0], x);
+    lo[1] = std::min(lo[1], y), hi[1] = std::max(hi[1], y);
+    lo[2] = std::min(lo[2], z), hi[2] = std::max(hi[2], z);
+  }
+
+  void add(const NodeBox &b) {
+    for (int d = 0; d < 3; ++d) {
+      lo[d] = std::min(lo[d], b.lo[d]);
+      hi[d] = std::max(hi[d], b.hi[d]);
+    }
+  }
+
+  //! @brief squared distance from a point, 0 inside
+  T minDistSq(T x, T y, T z) const {
+    if (empty())
+      return std::numeric_limits<T>::max();
+    T p[3] = {x, y, z};
+    T d2 = 0;
+    for (int d = 0; d < 3; ++d) {
+      T g = std::max({lo[d] - p[d], p[d] - hi[d], T(0)});
+      d2 += g * g;
+    }
+    return d2;
+  }
+
+  //! @brief squared distance between the closest points of two boxes
+  T minDistSq(const NodeBox &b) const {
+    if (empty() || b.empty())
+      return std::numeric_limits<T>::max();
+    T d2 = 0;
+    for (int d = 0; d < 3; ++d) {
+      T g = std::max({lo[d] - b.hi[d], b.lo[d] - hi[d], T(0)});
+      d2 += g * g;
+    }
+    return d2;
+  }
+
+  //! @brief squared distance from a point to the farthest corner
+  T maxDistSq(T x, T y, T z) const {
+    T p[3] = {x, y, z};
+    T d2 = 0;
+    for (int d = 0; d < 3; ++d) {
+      T g = std::max(p[d] - lo[d], hi[d] - p[d]);
+      d2 += g * g;
+    }
+    return d2;
+  }
+
+  bool contains(T x, T y, T z) const {
+    return lo[0] <= x && x <= hi[0] && lo[1] <= y && y <= hi[1] &&
+           lo[2] <= z && z <= hi[2];
+  }
+
+  //! @brief @p b lies inside, an empty @p b is inside every box
+  bool contains(const NodeBox &b) const {
+    for (int d = 0; d < 3; ++d) {
+      if (b.lo[d] < lo[d] || b.hi[d] > hi[d])
+        return false;
+    }
+    return true;
+  }
+
+  //! @brief squared distance between the farthest points of two boxes
+  T maxDistSq(const NodeBox &b) const {
+    T d2 = 0;
+    for (int d = 0; d < 3; ++d) {
+      T g = std::max(hi[d] - b.lo[d], b.hi[d] - lo[d]);
+      d2 += g * g;
+    }
+    return d2;
+  }
+};
+
+//! @brief particle range [first, last) of linked node @p i if it is a leaf
+template <class View, class IndexType>
+bool leafRange(const View &tree, std::span<const IndexType> layout,
+               cstone::TreeNodeIndex i, IndexType &first, IndexType &last) {
+  if (tree.childOffsets[i] != 0)
+    return false;
+  cstone::TreeNodeIndex leaf = tree.internalToLeaf[i];
+  first = layout[leaf];
+  last = layout[leaf + 1];
+  return true;
+}
+
+/*! @brief bounds of every linked node, indexed like the OctreeView
+ *
+ * Leaves bound their particles in @p layout order, then the levels are swept
+ * from the deepest up, each level in parallel.
+ */
+template <class T, class View, class IndexType>
+std::vector<NodeBox<T>> computeNodeBoxes(const View &tree,
+                                         std::span<const IndexType> layout,
+                                         const T *x, const T *y, const T *z) {
+  using cstone::TreeNodeIndex;
+  std::vector<NodeBox<T>> boxes(tree.numNodes);
+
+#pragma omp parallel for schedule(dynamic, 256)
+  for (TreeNodeIndex i = 0; i < tree.numNodes; ++i) {
+    IndexType first, last;
+    if (leafRange(tree, layout, i, first, last)) {
+      for (IndexType j = first; j < last; ++j)
+        boxes[i].add(x[j], y[j], z[j]);
+    }
+  }
+
+  constexpr int maxLevel = cstone::maxTreeLevel<
+      std::remove_const_t<std::remove_pointer_t<decltype(tree.prefixes)>>>{};
+  for (int level = maxLevel - 1; level >= 0; --level) {
+#pragma omp parallel for schedule(static)
+    for (TreeNodeIndex i = tree.levelRange[level];
+         i < tree.levelRange[level + 1]; ++i) {
+      TreeNodeIndex c = tree.childOffsets[i];
+      if (c == 0)
+        continue;
+      for (int k = 0; k < 8; ++k)
+        boxes[i].add(boxes[c + k]);
+    }
+  }
+  return boxes;
+}
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
 #if defined(__CUDACC__)
 
 //! @brief time a generic unary function
@@ -32,3 +38,76 @@ template <class F> float timeCpu(F &&f) {
   auto t1 = std::chrono::high_resolution_clock::now();
   return std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
 }
+
+//! @brief linear-interpolated percentile, @p q in [0, 100]
+inline double percentile(std::vector<double> v, double q) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  double pos = q / 100.0 * (v.size() - 1);
+  size_t lo = size_t(pos);
+  size_t hi = std::min(lo + 1, v.size() - 1);
+  return v[lo] + (pos - lo) * (v[hi] - v[lo]);
+}
+
+//! @brief two-sided 95% Student-t quantile for @p dof degrees of freedom
+inline double tQuantile95(size_t dof) {
+  static constexpr double table[] = {12.706, 4.303, 3.182, 2.776, 2.571,
+                                     2.447,  2.365, 2.306, 2.262, 2.228,
+                                     2.201,  2.179, 2.160, 2.145, 2.131,
+                                     2.120,  2.110, 2.101, 2.093, 2.086};
+  if (dof == 0)
+    return 0;
+  if (dof <= 20)
+    return table[dof - 1];
+  return dof <= 30 ? 2.042 : 1.960;
+}
+
+//! @brief statistics of a set of trial timings
+struct Summary {
+  size_t n = 0;
+  double avg = 0;
+  double min = 0;
+  double max = 0;
+  double stddev = 0;
+  double median = 0;
+  double p05 = 0;
+  double p95 = 0;
+  //! median absolute deviation from the median
+  double mad = 0;
+  //! half-width of the 95% confidence interval of the mean
+  double ci95 = 0;
+
+  //! @brief ci95 relative to the mean, the stopping criterion of runner()
+  double relCi95() const { return avg > 0 ? ci95 / avg : 0; }
+};
+
+inline Summary summarize(const std::vector<double> &v) {
+  Summary s;
+  if (v.empty())
+    return s;
+  s.n = v.size();
+  s.avg = std::accumulate(v.begin(), v.end(), 0.0) / v.size();
+  s.min = *std::min_element(v.begin(), v.end());
+  s.max = *std::max_element(v.begin(), v.end());
+  s.stddev = std::sqrt(std::accumulate(v.begin(), v.end(), 0.0,
+                                       [avg = s.avg](double acc, double x) {
+                                         return acc + (x - avg) * (x - avg);
+                                       }) /
+                       v.size());
+  s.median = percentile(v, 50);
+  s.p05 = percentile(v, 5);
+  s.p95 = percentile(v, 95);
+
+  std::vector<double> dev(v.size());
+  std::transform(v.begin(), v.end(), dev.begin(),
+                 [m = s.median](double x) { return std::abs(x - m); });
+  s.mad = percentile(dev, 50);
+
+  if (v.size() > 1) {
+    // sample standard deviation for the interval estimate
+    double sampleStd = s.stddev * std::sqrt(double(v.size()) / (v.size() - 1));
+    s.ci95 = tQuantile95(v.size() - 1) * sampleStd / std::sqrt(double(v.size()));
+  }
+  return s;
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cstone/sfc/common.hpp"
+#include "cstone/sfc/sfc.hpp"
+#include "cstone/tree/octree.hpp"
+
+/*! @brief violated tree invariants, counted per invariant
+ *
+ * Only the first violation of each invariant keeps its message, so a broken
+ * tree with millions of bad nodes still produces a short report.
+ */
+class ValidationReport {
+public:
+  /*! @brief record a violation of @p invariant unless @p condition holds
+   *
+   * @p detail is only formatted for the first violation, space separated.
+   * Returns @p condition.
+   */
+  template <class... Detail>
+  bool check(bool condition, const char *invariant, const Detail &...detail) {
+    if (condition)
+      return true;
+    for (auto &f : failures_) {
+      if (f.invariant == invariant) {
+        ++f.count;
+        return false;
+      }
+    }
+    std::ostringstream first;
+    ((first << detail << ' '), ...);
+    std::string msg = first.str();
+    if (!msg.empty())
+      msg.pop_back();
+    failures_.push_back({invariant, msg, 1});
+    return false;
+  }
+
+  bool ok() const { return failures_.empty(); }
+
+  //! @brief number of violations of @p invariant
+  size_t count(const std::string &invariant) const {
+    for (const auto &f : failures_) {
+      if (f.invariant == invariant)
+        return f.count;
+    }
+    return 0;
+  }
+
+  std::string summary() const {
+    if (ok())
+      return "all invariants hold";
+    std::ostringstream out;
+    for (const auto &f : failures_) {
+      out << f.invariant << ": " << f.count << " violation(s)";
+      if (!f.first.empty())
+        out << ", first: " << f.first;
+      out << "\n";
+    }
+    return out.str();
+  }
+
+private:
+  struct Failure {
+    std::string invariant;
+    std::string first;
+    size_t count;
+  };
+  std::vector<Failure> failures_;
+};
+
+/*! @brief cornerstone leaf array: sorted, spans [0, nodeRange(0)] and every
+ *         leaf is an aligned octree node
+ */
+template <class KeyType>
+void validateLeaves(std::span<const KeyType> leaves, ValidationReport &report) {
+  if (!report.check(leaves.size() >= 2, "leaves.size",
+                    "need at least one leaf"))
+    return;
+  report.check(leaves.front() == 0, "leaves.start",
+               "first key", 0, leaves.front());
+  report.check(leaves.back() == cstone::nodeRange<KeyType>(0), "leaves.end",
+               "last key", leaves.size() - 1, leaves.back());
+
+  for (size_t i = 0; i + 1 < leaves.size(); ++i) {
+    if (!report.check(leaves[i] < leaves[i + 1], "leaves.sorted",
+                      "leaf", i, leaves[i]))
+      continue;
+    KeyType range = leaves[i + 1] - leaves[i];
+    bool powerOf8 = std::has_single_bit(range) && std::countr_zero(range) % 3 == 0;
+    report.check(powerOf8 && leaves[i] % range == 0, "leaves.octreeNode",
+                 "leaf", i, leaves[i]);
+  }
+}
+
+/*! @brief leaf counts match the sorted keys, and are within @p bucketSize
+ *         except for leaves at the maximum tree level, which cannot split
+ */
+template <class KeyType>
+void validateCounts(std::span<const KeyType> leaves,
+                    std::span<const unsigned> counts,
+                    std::span<const KeyType> sortedKeys, unsigned bucketSize,
+                    ValidationReport &report) {
+  if (!report.check(counts.size() + 1 == leaves.size(), "counts.size"))
+    return;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    auto lo = std::lower_bound(sortedKeys.begin(), sortedKeys.end(), leaves[i]);
+    auto hi = std::lower_bound(lo, sortedKeys.end(), leaves[i + 1]);
+    report.check(counts[i] == unsigned(hi - lo), "counts.match",
+                 "leaf", i, counts[i]);
+    bool atMaxLevel = leaves[i + 1] - leaves[i] == 1;
+    report.check(counts[i] <= bucketSize || atMaxLevel, "counts.bucketSize",
+                 "leaf", i, counts[i]);
+  }
+}
+
+//! @brief layout is the exclusive scan of the counts and ends at @p np
+template <class IndexType>
+void validateLayout(std::span<const unsigned> counts,
+                    std::span<const IndexType> layout, size_t np,
+                    ValidationReport &report) {
+  if (!report.check(layout.size() == counts.size() + 1, "layout.size"))
+    return;
+  report.check(layout.front() == 0, "layout.start");
+  for (size_t i = 0; i < counts.size(); ++i)
+    report.check(layout[i + 1] - layout[i] == counts[i], "layout.scan",
+                 "leaf", i, layout[i]);
+  report.check(size_t(layout.back()) == np, "layout.total",
+               "np vs layout end", np, layout.back());
+}
+
+/*! @brief linked octree of @p leaves as built by updateInternalTree
+ *
+ * Prefixes are placeholder-bit keys sorted by level and then key, levelRange
+ * delimits the levels, every internal node has 8 consecutive children whose
+ * parent entry points back, and every cornerstone leaf appears exactly once
+ * through internalToLeaf / leafToInternal.
+ */
+template <class KeyType, class View>
+void validateOctree(const View &tree, std::span<const KeyType> leaves,
+                    ValidationReport &report) {
+  using cstone::TreeNodeIndex;
+  TreeNodeIndex numLeaves = TreeNodeIndex(leaves.size()) - 1;
+  if (!report.check(tree.numLeafNodes == numLeaves, "octree.numLeafNodes") ||
+      !report.check(tree.numInternalNodes == (numLeaves - 1) / 7,
+                    "octree.numInternalNodes") ||
+      !report.check(tree.numNodes == tree.numLeafNodes + tree.numInternalNodes,
+                    "octree.numNodes"))
+    return;
+
+  constexpr unsigned maxLevel = cstone::maxTreeLevel<KeyType>{};
+  const TreeNodeIndex *levelRange = tree.levelRange;
+  report.check(levelRange[0] == 0, "levelRange.start");
+  report.check(levelRange[maxLevel + 1] == tree.numNodes, "levelRange.end");
+  for (unsigned l = 0; l <= maxLevel; ++l) {
+    if (!report.check(levelRange[l] <= levelRange[l + 1], "levelRange.sorted",
+                      "level", l, levelRange[l]))
+      continue;
+    for (TreeNodeIndex i = levelRange[l]; i < levelRange[l + 1]; ++i)
+      report.check(cstone::decodePrefixLength(tree.prefixes[i]) == 3 * l,
+                   "levelRange.level", "node", i, l);
+  }
+
+  std::vector<char> seen(numLeaves, 0);
+  TreeNodeIndex numInternal = 0;
+  for (TreeNodeIndex i = 0; i < tree.numNodes; ++i) {
+    KeyType prefix = tree.prefixes[i];
+    report.check(i == 0 || tree.prefixes[i - 1] < prefix, "prefixes.sorted",
+                 "node", i, prefix);
+    KeyType start = cstone::decodePlaceholderBit(prefix);
+    unsigned level = cstone::decodePrefixLength(prefix) / 3;
+
+    TreeNodeIndex child = tree.childOffsets[i];
+    if (child != 0) {
+      ++numInternal;
+      if (!report.check(level < maxLevel && child > i &&
+                            child + 8 <= tree.numNodes,
+                        "childOffsets.range", "node", i, child))
+        continue;
+      KeyType childRange = cstone::nodeRange<KeyType>(level + 1);
+      for (int k = 0; k < 8; ++k) {
+        KeyType c = tree.prefixes[child + k];
+        report.check(cstone::decodePrefixLength(c) == 3 * (level + 1) &&
+                         cstone::decodePlaceholderBit(c) ==
+                             start + k * childRange,
+                     "childOffsets.children", "node", i, child);
+      }
+      report.check(tree.parents[(child - 1) / 8] == i, "parents",
+                   "node", i, child);
+      report.check(tree.internalToLeaf[i] < 0, "internalToLeaf.internal",
+                   "node", i, tree.internalToLeaf[i]);
+    } else {
+      TreeNodeIndex j = tree.internalToLeaf[i];
+      if (!report.check(j >= 0 && j < numLeaves, "internalToLeaf.range",
+                        "node", i, j))
+        continue;
+      report.check(!seen[j], "internalToLeaf.unique", "leaf", j, i);
+      seen[j] = 1;
+      report.check(leaves[j] == start &&
+                       leaves[j + 1] - leaves[j] ==
+                           cstone::nodeRange<KeyType>(level),
+                   "internalToLeaf.node", "leaf", j, leaves[j]);
+      report.check(tree.leafToInternal[tree.numInternalNodes + j] == i,
+                   "leafToInternal", "leaf", j, i);
+    }
+  }
+  report.check(numInternal == tree.numInternalNodes, "childOffsets.internal",
+               "internal nodes", numInternal, tree.numInternalNodes);
+  report.check(std::count(seen.begin(), seen.end(), 1) == numLeaves,
+               "internalToLeaf.complete");
+}
+
+/*! @brief particles are sorted by key and each key is the key of its own
+ *         coordinates, which catches reorders that permute x, y, z apart
+ */
+template <class KeyType, class T>
+void validateParticles(std::span<const KeyType> keys, std::span<const T> x,
+                       std::span<const T> y, std::span<const T> z,
+                       const cstone::Box<T> &box, ValidationReport &report) {
+  if (!report.check(x.size() == keys.size() && y.size() == keys.size() &&
+                        z.size() == keys.size(),
+                    "particles.size"))
+    return;
+  for (size_t i = 1; i < keys.size(); ++i)
+    report.check(keys[i - 1] <= keys[i], "particles.sorted",
+                 "particle", i, keys[i]);
+
+  std::vector<KeyType> expected(keys.size());
+  cstone::computeSfcKeys(x.data(), y.data(), z.data(),
+                         cstone::sfcKindPointer(expected.data()),
+                         expected.size(), box);
+  for (size_t i = 0; i < keys.size(); ++i)
+    report.check(keys[i] == expected[i], "particles.keys",
+                 "particle", i, keys[i]);
+}
@@ -3,10 +3,26 @@
 #define CATCH_CONFIG_MAIN
 #define CATCH_CONFIG_NO_POSIX_SIGNALS
 
+#include "adjacency.hpp"
 #include "catch.hpp"
+#include "checkpoint.hpp"
+#include "compress.hpp"
+#include "distributions.hpp"
+#include "gravity.hpp"
+#include "knn.hpp"
+#include "neighbors.hpp"
+#include "pair_count.hpp"
 #include "pcah5.hpp"
+#include "point_location.hpp"
+#include "quantized.hpp"
+#include "range_query.hpp"
+#include "regression.hpp"
+#include "utils.hpp"
+#include "validate.hpp"
+#include "cstone/tree/csarray.hpp"
 #include <cstdlib>
 #include <filesystem>
+#include <numeric>
 
 namespace fs = std::filesystem;
 
@@ -25,3 +41,797 @@ TEST_CASE("HDF5Read", "[unit]") {
   REQUIRE(py.size() == 1000);
   REQUIRE(pz.size() == 1000);
 }
+
+TEST_CASE("SummaryStatistics", "[unit]") {
+  Summary s = summarize({10, 12, 11, 13, 50});
+  REQUIRE(s.n == 5);
+  REQUIRE(s.min == 10);
+  REQUIRE(s.max == 50);
+  REQUIRE(s.median == 12);
+  REQUIRE(s.mad == 1);
+  REQUIRE(s.p05 == Approx(10.2));
+  REQUIRE(s.ci95 > 0);
+
+  Summary single = summarize({7});
+  REQUIRE(single.median == 7);
+  REQUIRE(single.ci95 == 0);
+}
+
+TEST_CASE("GeneratedSlicesIndependentOfRankCount", "[unit]") {
+  DistributionSpec spec = parseDistributionSpec("filament_xyz_rz30_s0p01_n1k");
+  REQUIRE(spec.n == 1000);
+  REQUIRE(spec.scale == Approx(0.01));
+
+  auto whole = generateSlice<float>(spec, 0, 1, 7);
+  size_t offset = 0;
+  for (int rank = 0; rank < 3; ++rank) {
+    auto part = generateSlice<float>(spec, rank, 3, 7);
+    REQUIRE(part.start == offset);
+    for (size_t i = 0; i < part.ix.size(); ++i) {
+      REQUIRE(part.ix[i] == whole.ix[offset + i]);
+      REQUIRE(part.pz[i] == whole.pz[offset + i]);
+    }
+    offset = part.end;
+  }
+  REQUIRE(offset == spec.n);
+
+  // a rotated cube loses its corners, each rank drops a different number
+  DistributionSpec cube = parseDistributionSpec("uniform_rz45_s0p01_n1k");
+  auto kept = generateSlice<float>(cube, 0, 1, 7, OutOfBounds::remove);
+  REQUIRE(kept.ix.size() < cube.n);
+  REQUIRE(kept.n == kept.ix.size());
+  REQUIRE(kept.end - kept.start == kept.ix.size());
+  std::vector<ParticleSlice<float>> parts;
+  for (int rank = 0; rank < 3; ++rank) {
+    parts.push_back(
+        generateSlice<float>(cube, rank, 3, 7, OutOfBounds::remove));
+    REQUIRE(parts.back().end - parts.back().start == parts.back().ix.size());
+  }
+  offset = 0;
+  for (auto &part : parts) {
+    renumberSlice(part, offset, kept.n);
+    REQUIRE(part.n == kept.n);
+    for (size_t i = 0; i < part.ix.size(); ++i) {
+      REQUIRE(part.ix[i] == kept.ix[part.start + i]);
+      REQUIRE(part.py[i] == kept.py[part.start + i]);
+    }
+    offset = part.end;
+  }
+  REQUIRE(offset == kept.n);
+
+  REQUIRE_THROWS(parseDistributionSpec("blob_s0p1_n1k"));
+}
+
+TEST_CASE("PerturbationFollowsSortedParticle", "[unit]") {
+  auto p = generateSlice<float>(parseDistributionSpec("normal_s0p01_n1k"), 0,
+                                1, 5);
+  size_t np = p.ix.size();
+  cstone::Box<float> box{-1.5, 1.5};
+  std::vector<uint64_t> keys(np);
+  cstone::computeSfcKeys(p.ix.data(), p.iy.data(), p.iz.data(),
+                         cstone::sfcKindPointer(keys.data()), np, box);
+  // the sort of processCpu: ordering[i] is the input index of position i
+  std::vector<unsigned> ordering(np);
+  std::iota(ordering.begin(), ordering.end(), 0);
+  std::sort(ordering.begin(), ordering.end(),
+            [&](unsigned a, unsigned b) { return keys[a] < keys[b]; });
+  REQUIRE(ordering[0] != 0);
+  std::vector<float> x(np), y(np), z(np);
+  for (size_t i = 0; i < np; ++i)
+    x[i] = p.ix[ordering[i]], y[i] = p.iy[ordering[i]], z[i] = p.iz[ordering[i]];
+
+  // only input particle 0 moves
+  const unsigned moved = 0;
+  std::vector<float> px(np, 0), py(np, 0), pz(np, 0);
+  px[moved] = 0.25f, py[moved] = -0.5f, pz[moved] = 0.125f;
+  perturbSorted(std::span<const unsigned>(ordering), px, py, pz, x, y, z);
+
+  for (size_t i = 0; i < np; ++i) {
+    unsigned j = ordering[i];
+    REQUIRE(x[i] == p.ix[j] + px[j]);
+    REQUIRE(y[i] == p.iy[j] + py[j]);
+    REQUIRE(z[i] == p.iz[j] + pz[j]);
+  }
+}
+
+TEST_CASE("RegressionGateThresholds", "[unit]") {
+  Baseline base;
+  base.entries = {{"a", 1000, 0, 9},
+                  {"b", 1000, 200, 9},
+                  {"c", 1000, 0, 9},
+                  {"e", 1000, 0, 9}};
+  std::vector<BaselineEntry> current{
+      {"a", 1100, 0, 9}, {"b", 1100, 200, 9}, {"c", 900, 0, 9}, {"d", 5, 0, 9}};
+
+  auto diffs = compareToBaseline(base, current, RegressionThreshold{});
+  REQUIRE(diffs.size() == 5);
+  // e: dropped by the current run, fails ahead of everything else
+  REQUIRE(diffs[0].key == "e");
+  REQUIRE(diffs[0].status == DiffStatus::missing);
+  REQUIRE(diffFails(diffs[0].status));
+  // a: +10% with no noise regresses; b: the same change is within its noise
+  REQUIRE(diffs[1].key == "a");
+  REQUIRE(diffs[1].status == DiffStatus::regression);
+  REQUIRE(diffs[2].key == "b");
+  REQUIRE(diffs[2].status == DiffStatus::ok);
+  REQUIRE(diffs[3].status == DiffStatus::improvement);
+  // d: new in the current run, listed last and passes
+  REQUIRE(diffs[4].key == "d");
+  REQUIRE(diffs[4].status == DiffStatus::added);
+  REQUIRE(!diffFails(diffs[4].status));
+
+  std::stringstream json;
+  writeBaseline(json, base);
+  auto path = std::filesystem::temp_directory_path() / "pca_baseline.json";
+  std::ofstream(path) << json.str();
+  Baseline read = readBaseline(path.string());
+  std::filesystem::remove(path);
+  REQUIRE(read.entries.size() == 4);
+  REQUIRE(read.find("b")->mad == 200);
+  REQUIRE(read.find("b")->n == 9);
+}
+
+//! @brief the processCpu pipeline with std algorithms for sort and gather
+struct ValidationTree {
+  cstone::Box<float> box{-1.5, 1.5};
+  std::vector<uint64_t> keys, leaves;
+  std::vector<float> x, y, z;
+  std::vector<unsigned> counts;
+  std::vector<cstone::LocalIndex> layout;
+  cstone::OctreeData<uint64_t, cstone::CpuTag> octree;
+  std::vector<cstone::Vec3<float>> centers, sizes;
+
+  ValidationTree(const std::string &spec, unsigned bucketSize) {
+    auto p = generateSlice<float>(parseDistributionSpec(spec), 0, 1, 3);
+    build(p.ix, p.iy, p.iz, bucketSize);
+  }
+
+  //! @brief the tree of the particles at @p ix, @p iy, @p iz in any order
+  ValidationTree(const std::vector<float> &ix, const std::vector<float> &iy,
+                 const std::vector<float> &iz, unsigned bucketSize) {
+    build(ix, iy, iz, bucketSize);
+  }
+
+  void build(const std::vector<float> &ix, const std::vector<float> &iy,
+             const std::vector<float> &iz, unsigned bucketSize) {
+    size_t np = ix.size();
+    std::vector<uint64_t> k(np);
+    cstone::computeSfcKeys(ix.data(), iy.data(), iz.data(),
+                           cstone::sfcKindPointer(k.data()), np, box);
+    std::vector<unsigned> order(np);
+    std::iota(order.begin(), order.end(), 0);
+    // stable, so that particles restored in SFC order keep their order
+    std::stable_sort(order.begin(), order.end(),
+                     [&](unsigned a, unsigned b) { return k[a] < k[b]; });
+    for (unsigned i : order) {
+      keys.push_back(k[i]);
+      x.push_back(ix[i]);
+      y.push_back(iy[i]);
+      z.push_back(iz[i]);
+    }
+
+    leaves = {0, cstone::nodeRange<uint64_t>(0)};
+    counts = {unsigned(np)};
+    while (!cstone::updateOctree<uint64_t>({keys.data(), keys.size()},
+                                           bucketSize, leaves, counts))
+      ;
+    octree.resize(cstone::nNodes(leaves));
+    cstone::updateInternalTree<uint64_t>({leaves.data(), leaves.size()},
+                                         octree.data());
+    layout.resize(counts.size() + 1);
+    layout[0] = 0;
+    std::inclusive_scan(counts.begin(), counts.end(), layout.begin() + 1);
+  }
+
+  //! @brief the view cstone::findNeighbors walks, valid while the tree lives
+  cstone::OctreeNsView<float, uint64_t> nsView() {
+    auto view = octree.data();
+    centers.resize(view.numNodes);
+    sizes.resize(view.numNodes);
+    cstone::nodeFpCenters<uint64_t>({view.prefixes, size_t(view.numNodes)},
+                                    centers.data(), sizes.data(), box);
+    return {.prefixes = view.prefixes,
+            .childOffsets = view.childOffsets,
+            .internalToLeaf = view.internalToLeaf,
+            .levelRange = view.levelRange,
+            .layout = layout.data(),
+            .centers = centers.data(),
+            .sizes = sizes.data()};
+  }
+
+  //! @brief indices of all particles within 2 @p h of particle @p i, itself
+  //!        excluded, ascending
+  std::vector<cstone::LocalIndex> neighborsWithin2h(size_t i, float h) const {
+    std::vector<cstone::LocalIndex> found;
+    for (size_t j = 0; j < x.size(); ++j) {
+      float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+      if (j != i && dx * dx + dy * dy + dz * dz < 4 * h * h)
+        found.push_back(cstone::LocalIndex(j));
+    }
+    return found;
+  }
+
+  ValidationReport validate(unsigned bucketSize) {
+    ValidationReport report;
+    std::span<const uint64_t> l(leaves), k(keys);
+    validateLeaves(l, report);
+    validateCounts(l, std::span<const unsigned>(counts), k, bucketSize,
+                   report);
+    validateLayout(std::span<const unsigned>(counts),
+                   std::span<const cstone::LocalIndex>(layout), keys.size(),
+                   report);
+    validateOctree(octree.data(), l, report);
+    validateParticles(k, std::span<const float>(x), std::span<const float>(y),
+                      std::span<const float>(z), box, report);
+    return report;
+  }
+};
+
+TEST_CASE("TreeInvariantsHold", "[unit]") {
+  for (const char *spec : {"uniform_s0p01_n20k", "normal_s0p01_n20k",
+                           "filament_xyz_s0p01_n20k", "uniform_s0p01_n1"}) {
+    ValidationTree tree(spec, 64);
+    ValidationReport report = tree.validate(64);
+    INFO(spec << ": " << report.summary());
+    REQUIRE(report.ok());
+  }
+}
+
+TEST_CASE("TreeValidatorDetectsCorruption", "[unit]") {
+  ValidationTree tree("normal_s0p01_n20k", 64);
+
+  SECTION("coordinates gathered into the wrong array") {
+    tree.x = tree.z;
+    REQUIRE(tree.validate(64).count("particles.keys") > 0);
+  }
+  SECTION("counts above the bucket size") {
+    REQUIRE(tree.validate(32).count("counts.bucketSize") > 0);
+  }
+  SECTION("unsorted leaves") {
+    std::swap(tree.leaves[1], tree.leaves[2]);
+    auto report = tree.validate(64);
+    REQUIRE(report.count("leaves.sorted") > 0);
+    REQUIRE(report.count("internalToLeaf.node") > 0);
+  }
+  SECTION("layout does not sum to np") {
+    tree.layout.back() -= 1;
+    REQUIRE(tree.validate(64).count("layout.total") == 1);
+  }
+  SECTION("broken child link") {
+    tree.octree.childOffsets[0] += 8;
+    auto report = tree.validate(64);
+    REQUIRE(report.count("childOffsets.children") > 0);
+    REQUIRE(report.count("parents") > 0);
+  }
+  SECTION("levelRange off by one") {
+    tree.octree.levelRange[2] += 1;
+    REQUIRE(tree.validate(64).count("levelRange.level") > 0);
+  }
+}
+
+TEST_CASE("KnnMatchesBruteForce", "[unit]") {
+  const unsigned k = 8;
+  for (const char *spec : {"uniform_s0p01_n4k", "filament_xyz_s0p01_n4k"}) {
+    ValidationTree tree(spec, 32);
+    auto view = tree.octree.data();
+    std::span<const cstone::LocalIndex> layout(tree.layout);
+    auto boxes = computeNodeBoxes(view, layout, tree.x.data(), tree.y.data(),
+                                  tree.z.data());
+    auto knn = findKnn(tree.x.data(), tree.y.data(), tree.z.data(), view,
+                       layout, std::span<const NodeBox<float>>(boxes), k);
+
+    size_t np = tree.x.size();
+    std::vector<float> d2(np);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < np; i += 37) {
+      for (size_t j = 0; j < np; ++j) {
+        float dx = tree.x[j] - tree.x[i], dy = tree.y[j] - tree.y[i],
+              dz = tree.z[j] - tree.z[i];
+        d2[j] = j == i ? std::numeric_limits<float>::infinity()
+                       : dx * dx + dy * dy + dz * dz;
+      }
+      std::nth_element(d2.begin(), d2.begin() + k - 1, d2.end());
+      std::sort(d2.begin(), d2.begin() + k);
+      for (unsigned n = 0; n < k; ++n)
+        mismatches += d2[n] != knn.distSq[i * k + n];
+    }
+    INFO(spec);
+    REQUIRE(mismatches == 0);
+    REQUIRE(knn.distanceEvaluations < uint64_t(np) * np / 4);
+  }
+}
+
+TEST_CASE("RangeQueriesMatchBruteForce", "[unit]") {
+  ValidationTree tree("normal_s0p01_n20k", 32);
+  auto view = tree.octree.data();
+  std::span<const cstone::LocalIndex> layout(tree.layout);
+  auto boxes = computeNodeBoxes(view, layout, tree.x.data(), tree.y.data(),
+                                tree.z.data());
+  auto particles = computeNodeParticles(view, layout);
+  REQUIRE(particles[0].count == tree.x.size());
+  RangeTree<float, decltype(view)> rt{view, boxes, particles, tree.x.data(),
+                                      tree.y.data(), tree.z.data()};
+
+  std::vector<NodeBox<float>> boxQueries(3);
+  boxQueries[0].add(-0.5f, -0.5f, -0.5f);
+  boxQueries[0].add(0.5f, 0.5f, 0.5f);
+  boxQueries[1].add(-1e6f, -1e6f, -1e6f);
+  boxQueries[1].add(1e6f, 1e6f, 1e6f);
+  boxQueries[2].add(0.2f, -1, 0);
+  boxQueries[2].add(0.3f, 1, 0.05f);
+  std::vector<Sphere<float>> sphereQueries{
+      {0, 0, 0, 0.7f}, {1, 1, 1, 0.3f}, {-0.4f, 0.1f, 0.3f, 0.25f}};
+
+  auto check = [&](const auto &queries) {
+    using Shape = typename std::decay_t<decltype(queries)>::value_type;
+    auto result = rangeQueryBatch(std::span<const Shape>(queries), rt);
+    for (size_t q = 0; q < queries.size(); ++q) {
+      std::vector<char> found(tree.x.size(), 0);
+      for (size_t r = result.offsets[q]; r < result.offsets[q + 1]; ++r)
+        std::fill_n(found.begin() + result.ranges[r].first,
+                    result.ranges[r].count, 1);
+      uint64_t expected = 0;
+      size_t wrong = 0;
+      for (size_t j = 0; j < tree.x.size(); ++j) {
+        bool inside = queries[q].contains(tree.x[j], tree.y[j], tree.z[j]);
+        expected += inside;
+        wrong += inside != bool(found[j]);
+      }
+      REQUIRE(wrong == 0);
+      REQUIRE(result.counts[q] == expected);
+      REQUIRE(rangeQuery(queries[q], rt) == expected);
+    }
+    return result;
+  };
+  check(sphereQueries);
+  // the enclosing box is answered by the root alone
+  auto all = check(boxQueries);
+  REQUIRE(all.counts[1] == tree.x.size());
+  REQUIRE(all.offsets[2] - all.offsets[1] == 1);
+}
+
+TEST_CASE("NeighborCsrMatchesBruteForce", "[unit]") {
+  ValidationTree tree("filament_xyz_s0p01_n4k", 32);
+  auto nsView = tree.nsView();
+  std::span<const cstone::LocalIndex> layout(tree.layout);
+  size_t np = tree.x.size();
+  std::vector<float> h(np);
+  leafSmoothingLengths(std::span<const uint64_t>(tree.leaves), layout,
+                       tree.box, 50, std::span<float>(h));
+
+  // 512 holds every particle's neighbors, with 16 most take the retry path
+  for (unsigned ngmax : {512u, 16u}) {
+    INFO("ngmax " << ngmax);
+    NeighborList list =
+        findNeighborsCsr(tree.x.data(), tree.y.data(), tree.z.data(),
+                         h.data(), nsView, layout, tree.box, ngmax);
+    REQUIRE(list.numParticles() == np);
+    REQUIRE(list.offsets.back() == list.neighbors.size());
+
+    size_t wrong = 0, retried = 0;
+    for (size_t i = 0; i < np; ++i) {
+      std::vector<cstone::LocalIndex> found(
+          list.neighbors.begin() + list.offsets[i],
+          list.neighbors.begin() + list.offsets[i + 1]);
+      std::sort(found.begin(), found.end());
+      wrong += found != tree.neighborsWithin2h(i, h[i]);
+      retried += list.count(i) > ngmax;
+    }
+    REQUIRE(wrong == 0);
+    REQUIRE((retried > 0) == (ngmax < 512));
+  }
+}
+
+TEST_CASE("AdaptedSmoothingLengthsHitTargetCount", "[unit]") {
+  const unsigned ngTarget = 50;
+  const double tolerance = 0.05;
+  for (const char *spec : {"uniform_s0p01_n4k", "filament_xyz_s0p01_n4k"}) {
+    ValidationTree tree(spec, 32);
+    auto nsView = tree.nsView();
+    std::span<const cstone::LocalIndex> layout(tree.layout);
+    size_t np = tree.x.size();
+    std::vector<float> h0(np);
+    leafSmoothingLengths(std::span<const uint64_t>(tree.leaves), layout,
+                         tree.box, ngTarget, std::span<float>(h0));
+
+    // the leaf estimate, and a guess 10x too large that starts with ~1000x
+    // the target count and needs the bracket to settle
+    for (float scale : {1.0f, 10.0f}) {
+      INFO(spec << ", initial h x" << scale);
+      std::vector<float> h(h0);
+      for (float &hi : h)
+        hi *= scale;
+      HAdaptStats stats = adaptSmoothingLengths(
+          tree.x.data(), tree.y.data(), tree.z.data(), std::span<float>(h),
+          nsView, layout, tree.box, ngTarget, tolerance, 30);
+      REQUIRE(stats.unconverged == 0);
+      REQUIRE(stats.active[0] == np);
+
+      size_t outside = 0;
+      for (size_t i = 0; i < np; ++i) {
+        double n = tree.neighborsWithin2h(i, h[i]).size();
+        outside += n < ngTarget * (1 - tolerance) ||
+                   n > ngTarget * (1 + tolerance);
+      }
+      REQUIRE(outside == 0);
+    }
+  }
+}
+
+TEST_CASE("GravityMatchesDirectSum", "[unit]") {
+  ValidationTree tree("uniform_s0p01_n4k", 32);
+  auto view = tree.octree.data();
+  std::span<const cstone::LocalIndex> layout(tree.layout);
+  auto boxes = computeNodeBoxes(view, layout, tree.x.data(), tree.y.data(),
+                                tree.z.data());
+  size_t np = tree.x.size();
+  float m = 1.0f / np, eps = 0.01f;
+
+  // with the quadrupoles zeroed the same walk is monopole only
+  auto rmsError = [&](float theta, bool quadrupole) {
+    auto sources = computeSourceCenters(view, layout, tree.box, tree.x.data(),
+                                        tree.y.data(), tree.z.data(), m, theta);
+    REQUIRE(sources.mass[0] == Approx(1.0f));
+    if (!quadrupole)
+      sources.quadrupole.assign(sources.quadrupole.size(), {});
+    auto g = computeGravity(tree.x.data(), tree.y.data(), tree.z.data(), m,
+                            eps, view, layout,
+                            std::span<const NodeBox<float>>(boxes), sources);
+    REQUIRE(g.m2p > 0);
+    double err2 = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < np; i += 97, ++n) {
+      double ax, ay, az;
+      directAcceleration(i, tree.x.data(), tree.y.data(), tree.z.data(), m,
+                         eps, np, ax, ay, az);
+      err2 += (std::pow(g.ax[i] - ax, 2) + std::pow(g.ay[i] - ay, 2) +
+               std::pow(g.az[i] - az, 2)) /
+              (ax * ax + ay * ay + az * az);
+    }
+    return std::sqrt(err2 / n);
+  };
+  double fine = rmsError(0.3f, true), coarse = rmsError(0.9f, true);
+  double fineMono = rmsError(0.3f, false), coarseMono = rmsError(0.9f, false);
+  INFO("quadrupole " << fine << ", " << coarse << "; monopole " << fineMono
+                     << ", " << coarseMono);
+  REQUIRE(fine < 1e-3);
+  REQUIRE(coarse < 2e-2);
+  REQUIRE(fine < coarse);
+  // the quadrupoles cut the error at both opening angles
+  REQUIRE(fine < 0.5 * fineMono);
+  REQUIRE(coarse < 0.5 * coarseMono);
+}
+
+TEST_CASE("LeafLocatorFindsContainingLeaf", "[unit]") {
+  ValidationTree tree("filament_xyz_s0p01_n20k", 16);
+  LeafLocator<uint64_t> locator{std::span<const uint64_t>(tree.leaves)};
+  auto expected = [&](uint64_t key) {
+    auto it = std::upper_bound(tree.leaves.begin(), tree.leaves.end(), key);
+    return cstone::TreeNodeIndex(it - tree.leaves.begin()) - 1;
+  };
+
+  std::vector<uint64_t> keys(10001);
+  uint64_t state = 12345;
+  for (auto &k : keys) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    k = (state >> 1) % cstone::nodeRange<uint64_t>(0);
+  }
+  keys.back() = cstone::nodeRange<uint64_t>(0) - 1;
+  std::vector<cstone::TreeNodeIndex> out(keys.size());
+
+  SECTION("unsorted batch") {
+    locator.find(std::span<const uint64_t>(keys),
+                 std::span<cstone::TreeNodeIndex>(out));
+    for (size_t i = 0; i < keys.size(); ++i)
+      REQUIRE(out[i] == expected(keys[i]));
+  }
+  SECTION("sorted batch") {
+    std::sort(keys.begin(), keys.end());
+    locator.find(std::span<const uint64_t>(keys),
+                 std::span<cstone::TreeNodeIndex>(out));
+    for (size_t i = 0; i < keys.size(); ++i)
+      REQUIRE(out[i] == expected(keys[i]));
+  }
+  SECTION("tree particles land in their own leaf") {
+    size_t np = tree.x.size();
+    out.resize(np);
+    locatePoints(tree.x.data(), tree.y.data(), tree.z.data(), np, tree.box,
+                 locator, std::span<cstone::TreeNodeIndex>(out));
+    for (size_t leaf = 0; leaf + 1 < tree.layout.size(); ++leaf) {
+      for (auto i = tree.layout[leaf]; i < tree.layout[leaf + 1]; ++i)
+        REQUIRE(out[i] == cstone::TreeNodeIndex(leaf));
+    }
+  }
+}
+
+TEST_CASE("LeafAdjacencyIsSymmetricAndBalanced", "[unit]") {
+  // a uniform tree is close to one level everywhere, a filament is not
+  for (const char *spec : {"uniform_s0p01_n20k", "filament_xyz_s0p01_n20k"}) {
+    ValidationTree tree(spec, 32);
+    auto adj = buildLeafAdjacency(std::span<const uint64_t>(tree.leaves),
+                                  tree.box, true);
+    size_t numLeaves = tree.leaves.size() - 1;
+    REQUIRE(adj.numLeaves() == numLeaves);
+
+    size_t asymmetric = 0, self = 0, unsorted = 0;
+    for (size_t i = 0; i < numLeaves; ++i) {
+      auto first = adj.neighbors.begin() + adj.offsets[i];
+      auto last = adj.neighbors.begin() + adj.offsets[i + 1];
+      unsorted += !std::is_sorted(first, last);
+      for (auto it = first; it != last; ++it) {
+        self += *it == cstone::TreeNodeIndex(i);
+        auto nFirst = adj.neighbors.begin() + adj.offsets[*it];
+        auto nLast = adj.neighbors.begin() + adj.offsets[*it + 1];
+        asymmetric += !std::binary_search(nFirst, nLast, i);
+      }
+    }
+    INFO(spec);
+    REQUIRE(asymmetric == 0);
+    REQUIRE(self == 0);
+    REQUIRE(unsorted == 0);
+    REQUIRE(std::count(adj.contact.begin(), adj.contact.end(), 0) == 0);
+    if (std::string(spec).starts_with("uniform")) {
+      // interior leaves of a uniform tree have all 26 neighbors
+      uint64_t maxCount = 0;
+      for (size_t i = 0; i < numLeaves; ++i)
+        maxCount = std::max(maxCount, adj.offsets[i + 1] - adj.offsets[i]);
+      REQUIRE(maxCount >= 26);
+      REQUIRE(adj.unbalancedLeaves == 0);
+    } else {
+      REQUIRE(adj.unbalancedLeaves > 0);
+    }
+  }
+}
+
+TEST_CASE("DualTreePairCountsMatchBruteForce", "[unit]") {
+  for (const char *spec : {"uniform_s0p01_n4k", "filament_xyz_s0p01_n4k"}) {
+    ValidationTree tree(spec, 32);
+    auto view = tree.octree.data();
+    std::span<const cstone::LocalIndex> layout(tree.layout);
+    auto boxes = computeNodeBoxes(view, layout, tree.x.data(), tree.y.data(),
+                                  tree.z.data());
+    auto particles = computeNodeParticles(view, layout);
+    RangeTree<float, decltype(view)> rt{view, boxes, particles, tree.x.data(),
+                                        tree.y.data(), tree.z.data()};
+    auto edges = logBinEdges(0.01f, 0.5f, 8);
+    // a small cutoff so that the test exercises the tasks
+    auto pairs = countPairs(rt, std::span<const float>(edges), 256);
+
+    std::vector<float> edges2;
+    for (float e : edges)
+      edges2.push_back(e * e);
+    std::vector<uint64_t> expected(8, 0);
+    size_t np = tree.x.size();
+    for (size_t i = 0; i < np; ++i) {
+      for (size_t j = i + 1; j < np; ++j) {
+        float dx = tree.x[j] - tree.x[i], dy = tree.y[j] - tree.y[i],
+              dz = tree.z[j] - tree.z[i];
+        float d2 = dx * dx + dy * dy + dz * dz;
+        if (d2 < edges2.front() || d2 >= edges2.back())
+          continue;
+        ++expected[std::upper_bound(edges2.begin(), edges2.end(), d2) -
+                   edges2.begin() - 1];
+      }
+    }
+    INFO(spec);
+    REQUIRE(pairs.counts == expected);
+    REQUIRE(pairs.distanceEvaluations < np * (np - 1) / 2);
+  }
+}
+
+TEST_CASE("ExchangeCodecsAreLossless", "[unit]") {
+  ValidationTree tree("uniform_s0p1_n64k", 64);
+  size_t np = tree.keys.size();
+
+  // SFC-sorted columns round-trip and shrink
+  std::vector<uint8_t> bytes;
+  appendColumn(tree.keys.data(), np, true, bytes);
+  size_t keyBytes = bytes.size();
+  appendColumn(tree.x.data(), np, true, bytes);
+  std::vector<uint64_t> keys(np);
+  std::vector<float> x(np);
+  const uint8_t *end = readColumn(bytes.data(), np, true, keys.data());
+  end = readColumn(end, np, true, x.data());
+  REQUIRE(end == bytes.data() + bytes.size());
+  REQUIRE(keys == tree.keys);
+  REQUIRE(std::memcmp(x.data(), tree.x.data(), np * sizeof(float)) == 0);
+  REQUIRE(keyBytes < np * sizeof(uint64_t));
+  REQUIRE(bytes.size() - keyBytes < np * sizeof(float));
+
+  // descending keys and special floats stay exact, odd lengths included
+  std::vector<uint64_t> jumps = {~uint64_t(0), 0, 5, 3, uint64_t(1) << 63};
+  std::vector<float> special = {-0.0f, 0.0f, std::numeric_limits<float>::infinity(),
+                                std::numeric_limits<float>::quiet_NaN(),
+                                std::numeric_limits<float>::denorm_min()};
+  bytes.clear();
+  appendColumn(jumps.data(), jumps.size(), true, bytes);
+  appendColumn(special.data(), special.size(), true, bytes);
+  std::vector<uint64_t> jumps2(jumps.size());
+  std::vector<float> special2(special.size());
+  end = readColumn(bytes.data(), jumps.size(), true, jumps2.data());
+  readColumn(end, special.size(), true, special2.data());
+  REQUIRE(jumps2 == jumps);
+  REQUIRE(std::memcmp(special2.data(), special.data(),
+                      special.size() * sizeof(float)) == 0);
+
+  ExchangeCodec codec;
+  codec.floats = codec.adaptive = true;
+  REQUIRE_FALSE(codec.compress(codec.minBytes - 1));
+  REQUIRE(codec.compress(1 << 20));
+  // a codec slower than the network does not pay off
+  codec.bandwidth = 1e10;
+  codec.learn(1 << 20, 1 << 19, 1e-3);
+  REQUIRE_FALSE(codec.compress(1 << 20));
+  codec.bandwidth = 1e8;
+  REQUIRE(codec.compress(1 << 20));
+}
+
+TEST_CASE("DomainCheckpointRoundTrips", "[unit]") {
+  ValidationTree tree("filament_xyz_s0p01_n4k", 32);
+  size_t np = tree.keys.size();
+
+  DomainCheckpoint<uint64_t, float> ckpt;
+  ckpt.header.rank = 1;
+  ckpt.header.numRanks = 4;
+  ckpt.header.numGlobal = 4 * np;
+  ckpt.header.bucketSize = 64;
+  ckpt.header.bucketSizeFocus = 8;
+  ckpt.header.theta = 0.5f;
+  ckpt.header.generator = generatorHash("filament_xyz_s0p01_n4k", true, 42, 0);
+  ckpt.header.freshInitialUs = 1500.0f;
+  ckpt.header.freshPerturbUs = 250.0f;
+  ckpt.keys = tree.keys;
+  ckpt.x = tree.x, ckpt.y = tree.y, ckpt.z = tree.z;
+  ckpt.h.assign(np, 0.1f);
+  ckpt.px.assign(np, 1e-3f), ckpt.py.assign(np, -1e-3f), ckpt.pz.assign(np, 0.0f);
+
+  auto path = (std::filesystem::temp_directory_path() / "pca_domain.ckpt").string();
+  writeCheckpoint(path, ckpt);
+
+  CheckpointHeader expected = ckpt.header;
+  DomainCheckpoint<uint64_t, float> restored;
+  REQUIRE(readCheckpoint(path, expected, restored));
+  REQUIRE(restored.header.numLocal == np);
+  REQUIRE(restored.header.freshInitialUs == 1500.0f);
+  REQUIRE(restored.header.freshPerturbUs == 250.0f);
+  REQUIRE(restored.keys == ckpt.keys);
+  REQUIRE(restored.x == ckpt.x);
+  REQUIRE(restored.z == ckpt.z);
+  REQUIRE(restored.h == ckpt.h);
+  REQUIRE(restored.py == ckpt.py);
+
+  // a different run, element type or a truncated file is not restored
+  expected.numRanks = 8;
+  REQUIRE_FALSE(readCheckpoint(path, expected, restored));
+  expected = ckpt.header;
+  REQUIRE(generatorHash("filament_xyz_s0p01_n4k", false, 42, 0) ==
+          generatorHash("filament_xyz_s0p01_n4k", false, 7, 1));
+  for (uint64_t other : {generatorHash("filament_xyz_s0p01_n4k", true, 7, 0),
+                         generatorHash("filament_xyz_s0p01_n4k", true, 42, 1),
+                         generatorHash("filament_xyz_s0p1_n4k", true, 42, 0)}) {
+    expected.generator = other;
+    REQUIRE_FALSE(readCheckpoint(path, expected, restored));
+  }
+  DomainCheckpoint<uint64_t, double> wide;
+  REQUIRE_FALSE(readCheckpoint(path, ckpt.header, wide));
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+  REQUIRE_FALSE(readCheckpoint(path, ckpt.header, restored));
+  std::filesystem::remove(path);
+  REQUIRE_FALSE(readCheckpoint(path, ckpt.header, restored));
+}
+
+TEST_CASE("RestoredCheckpointReproducesSyncedKeys", "[unit]") {
+  // the synced state of three ranks: contiguous key ranges in SFC order
+  ValidationTree synced("normal_s0p01_n20k", 64);
+  size_t np = synced.keys.size();
+  const int numRanks = 3;
+  auto dir = std::filesystem::temp_directory_path();
+  auto path = [&](int rank) {
+    return (dir / ("pca_restore_rank" + std::to_string(rank) + ".ckpt"))
+        .string();
+  };
+
+  CheckpointHeader header;
+  header.numRanks = numRanks;
+  header.numGlobal = np;
+  header.bucketSize = 64;
+  for (int rank = 0; rank < numRanks; ++rank) {
+    size_t first = np * rank / numRanks, last = np * (rank + 1) / numRanks;
+    DomainCheckpoint<uint64_t, float> ckpt;
+    ckpt.header = header;
+    ckpt.header.rank = rank;
+    ckpt.keys.assign(synced.keys.begin() + first, synced.keys.begin() + last);
+    ckpt.x.assign(synced.x.begin() + first, synced.x.begin() + last);
+    ckpt.y.assign(synced.y.begin() + first, synced.y.begin() + last);
+    ckpt.z.assign(synced.z.begin() + first, synced.z.begin() + last);
+    ckpt.h.assign(last - first, 0.01f);
+    ckpt.px = ckpt.py = ckpt.pz = ckpt.h;
+    writeCheckpoint(path(rank), ckpt);
+  }
+
+  // the relaunch syncs the restored particles of all ranks again
+  std::vector<uint64_t> restoredKeys;
+  std::vector<float> x, y, z;
+  for (int rank = 0; rank < numRanks; ++rank) {
+    CheckpointHeader expected = header;
+    expected.rank = rank;
+    DomainCheckpoint<uint64_t, float> ckpt;
+    REQUIRE(readCheckpoint(path(rank), expected, ckpt));
+    std::filesystem::remove(path(rank));
+    restoredKeys.insert(restoredKeys.end(), ckpt.keys.begin(), ckpt.keys.end());
+    x.insert(x.end(), ckpt.x.begin(), ckpt.x.end());
+    y.insert(y.end(), ckpt.y.begin(), ckpt.y.end());
+    z.insert(z.end(), ckpt.z.begin(), ckpt.z.end());
+  }
+  ValidationTree resynced(x, y, z, 64);
+
+  REQUIRE(restoredKeys == synced.keys);
+  REQUIRE(resynced.keys == synced.keys);
+  REQUIRE(resynced.x == synced.x);
+  REQUIRE(resynced.leaves == synced.leaves);
+  REQUIRE(resynced.layout == synced.layout);
+}
+
+TEST_CASE("QuantizedCoordinatesStayWithinHalfACell", "[unit]") {
+  ValidationTree tree("filament_xyz_s0p01_n16k", 32);
+  size_t np = tree.keys.size();
+  CoordQuantizer<float> quantizer(tree.box);
+  std::vector<uint64_t> packed(np);
+  quantizeCoords(tree.x.data(), tree.y.data(), tree.z.data(), np, quantizer, packed.data());
+
+  const std::vector<float> *coords[3] = {&tree.x, &tree.y, &tree.z};
+  for (size_t i = 0; i < np; ++i) {
+    REQUIRE(packed[i] >> 63 == 0);
+    auto p = quantizer.decode(packed[i]);
+    for (int d = 0; d < 3; ++d)
+      // half a cell, plus the float rounding of the decoded position
+      REQUIRE(std::abs(p[d] - (*coords[d])[i]) <= 0.75f * quantizer.cell[d]);
+  }
+  // the box edges clamp to the first and last cell
+  uint64_t corner = quantizer.encode(tree.box.xmax(), tree.box.ymin(), tree.box.zmax() + 1);
+  REQUIRE(CoordQuantizer<float>::ix(corner) == CoordQuantizer<float>::mask);
+  REQUIRE(CoordQuantizer<float>::iy(corner) == 0);
+  REQUIRE(CoordQuantizer<float>::iz(corner) == CoordQuantizer<float>::mask);
+
+  // stored positions match brute force, decoded ones differ only by the
+  // particles within the quantization error of a sphere's surface
+  auto view = tree.octree.data();
+  std::span<const cstone::LocalIndex> layout(tree.layout);
+  auto nodes = computeNodeParticles(view, layout);
+  auto boxes = computeNodeBoxes(view, layout, tree.x.data(), tree.y.data(), tree.z.data());
+  std::vector<float> radius(np, 0.02f);
+  auto exact = countWithin(view, std::span<const NodeBox<float>>(boxes), std::span<const NodeParticles>(nodes),
+                           SoaCoords<float>{tree.x.data(), tree.y.data(), tree.z.data()},
+                           std::span<const float>(radius));
+  for (size_t i = 0; i < np; i += 97) {
+    unsigned brute = 0;
+    for (size_t j = 0; j < np; ++j) {
+      float dx = tree.x[j] - tree.x[i], dy = tree.y[j] - tree.y[i], dz = tree.z[j] - tree.z[i];
+      brute += dx * dx + dy * dy + dz * dz <= radius[i] * radius[i];
+    }
+    REQUIRE(exact[i] == brute);
+  }
+
+  std::vector<float> dx(np), dy(np), dz(np);
+  for (size_t i = 0; i < np; ++i) {
+    auto p = quantizer.decode(packed[i]);
+    dx[i] = p[0], dy[i] = p[1], dz[i] = p[2];
+  }
+  auto decodedBoxes = computeNodeBoxes(view, layout, dx.data(), dy.data(), dz.data());
+  auto decoded = countWithin(view, std::span<const NodeBox<float>>(decodedBoxes),
+                             std::span<const NodeParticles>(nodes), PackedCoords<float>{packed.data(), quantizer},
+                             std::span<const float>(radius));
+  // both ends of a pair move by at most 0.75 cells per axis
+  float slack = 3 * quantizer.cell[0];
+  std::vector<float> inner(np, radius[0] - slack), outer(np, radius[0] + slack);
+  auto lower = countWithin(view, std::span<const NodeBox<float>>(boxes), std::span<const NodeParticles>(nodes),
+                           SoaCoords<float>{tree.x.data(), tree.y.data(), tree.z.data()},
+                           std::span<const float>(inner));
+  auto upper = countWithin(view, std::span<const NodeBox<float>>(boxes), std::span<const NodeParticles>(nodes),
+                           SoaCoords<float>{tree.x.data(), tree.y.data(), tree.z.data()},
+                           std::span<const float>(outer));
+  for (size_t i = 0; i < np; ++i) {
+    REQUIRE(decoded[i] >= lower[i]);
+    REQUIRE(decoded[i] <= upper[i]);
+  }
+}